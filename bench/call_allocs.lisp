@@ -0,0 +1,16 @@
+; counts the pool allocations made by the calls of (fib-recursive 25)
+;
+; usage: ./toylisp bench/call_allocs.lisp    (run from the repository root)
+
+(defun fib-recursive (n)
+  (if (< n 3)
+    1
+    (+ (fib-recursive (- n 1)) (fib-recursive (- n 2)))
+  )
+)
+
+(set allocs (lambda () (cdr (car (pool-stats)))))
+
+(set before (allocs))
+(fib-recursive 25)
+(println "fib-recursive 25 allocations:" (- (allocs) before))
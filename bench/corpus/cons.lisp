@@ -0,0 +1,16 @@
+; allocation stress: builds and drops 100000-element lists
+; ops: 1000000 conses
+
+(defun build (n i l)
+  (progn
+    (for (set i 0) (< i n) (++ i)
+      (set l (cons i l)))
+    l))
+
+(defun repeat (k i r)
+  (progn
+    (for (set i 0) (< i k) (++ i)
+      (set r (build 100000 0 NIL)))
+    r))
+
+(println (car (repeat 10 0 NIL)))
@@ -0,0 +1,15 @@
+; non-tail recursion 10000 frames deep
+; ops: 500050 calls
+
+(defun sum-to (n)
+  (if (== n 0)
+    0
+    (+ n (sum-to (- n 1)))))
+
+(defun repeat (k i r)
+  (progn
+    (for (set i 0) (< i k) (++ i)
+      (set r (sum-to 10000)))
+    r))
+
+(println (repeat 50 0 0))
@@ -0,0 +1,20 @@
+; tail-recursive fib-non-recursive from example/fib.lisp, called in a loop
+; ops: 455000 calls
+
+(defun fib-non-recursive (n)
+  (progn
+    (defun fib-iter (a b n)
+      (if (== n 1)
+        b
+        (fib-iter b (+ a b) (-- n))))
+    (if (< n 3)
+      1
+      (fib-iter 0 1 n))))
+
+(defun repeat (k i r)
+  (progn
+    (for (set i 0) (< i k) (++ i)
+      (set r (fib-non-recursive 90)))
+    r))
+
+(println (repeat 5000 0 0))
@@ -0,0 +1,9 @@
+; doubly recursive fib from example/fib.lisp, call-heavy
+; ops: 150049 calls
+
+(defun fib-recursive (n)
+  (if (< n 3)
+    1
+    (+ (fib-recursive (- n 1)) (fib-recursive (- n 2)))))
+
+(println (fib-recursive 25))
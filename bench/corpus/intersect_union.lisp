@@ -0,0 +1,40 @@
+; list intersection and union from example/intersect_union.lisp over 2000-element lists
+; ops: 80000 list cells walked
+
+(defun intersect (a b)
+  (if (or (isnull a) (isnull b))
+    NIL
+    (if (== (car a) (car b))
+      (cons (car a) (intersect (cdr a) (cdr b)))
+      (intersect (cdr a) b))))
+
+(defun union (a b)
+  (if (and (isnull a) (isnull b))
+    NIL
+    (if (isnull a)
+      (cons (car b) (union NIL (cdr b)))
+      (if (isnull b)
+        (cons (car a) (union (cdr a) NIL))
+        (if (== (car a) (car b))
+          (cons (car a) (union (cdr a) (cdr b)))
+          (cons (car a) (union (cdr a) b)))))))
+
+; descending from n-1 to 0 in steps of k, so consing yields an ascending list
+(defun range (n k i l)
+  (progn
+    (for (set i (- n k)) (>= i 0) (set i (- i k))
+      (set l (cons i l)))
+    l))
+
+(set evens (range 2000 2 0 NIL))
+(set thirds (range 3000 3 0 NIL))
+
+(defun repeat (k i r)
+  (progn
+    (for (set i 0) (< i k) (++ i)
+      (progn
+        (set r (intersect evens thirds))
+        (set r (union evens thirds))))
+    r))
+
+(println (car (repeat 20 0 NIL)))
@@ -0,0 +1,11 @@
+; the nested for loops of example/misc.lisp over a 1000x1000 triangle, without printing
+; ops: 500500 inner iterations
+
+(defun table (n i j acc)
+  (progn
+    (for (set i 1) (<= i n) (++ i)
+      (for (set j 1) (<= j i) (++ j)
+        (set acc (+ acc (* i j)))))
+    acc))
+
+(println (table 1000 0 0 0))
@@ -0,0 +1,17 @@
+; string building: appends 100000 short strings, then splits and joins them
+; ops: 200000 string operations
+
+(defun build (n s i)
+  (progn
+    (for (set i 0) (< i n) (++ i)
+      (set s (+ s "abcd")))
+    s))
+
+(defun split (s n i parts)
+  (progn
+    (for (set i 0) (< i n) (++ i)
+      (set parts (cons (substring s (* i 4) (+ (* i 4) 4)) parts)))
+    parts))
+
+(set text (build 100000 "" 0))
+(println (string-length (string-join (split text 100000 0 NIL) ",")))
@@ -0,0 +1,19 @@
+; factorial through the Y combinator from example/Y_fc.lisp, closure-heavy
+; ops: 105000 calls
+
+(set Y
+  (lambda (f)
+    ((lambda (g) (g g))
+      (lambda (g) (f (lambda (x) ((g g) x)))))))
+
+(defun fc (g)
+  (lambda (x)
+    (cond ((<= x 0) 1) ((> x 0) (* x (g (- x 1)))))))
+
+(defun repeat (k i r)
+  (progn
+    (for (set i 0) (< i k) (++ i)
+      (set r ((Y fc) 20)))
+    r))
+
+(println (repeat 5000 0 0))
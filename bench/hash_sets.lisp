@@ -0,0 +1,43 @@
+; set intersection micro-benchmark: counts the members of one list that are
+; also in another, by walking the second list for every item (O(n*m)) and by
+; a hash table (O(n+m)).
+;
+; usage: time ./toylisp [--engine=vm] bench/hash_sets.lisp    (run from the repository root)
+
+(defun range (from to acc)
+  (if (< to from)
+    acc
+    (range from (- to 1) (cons to acc))))
+
+(defun member (x l)
+  (cond
+    ((== l NIL) NIL)
+    ((== x (car l)) T)
+    (T (member x (cdr l)))))
+
+(defun list-intersect (a b count)
+  (progn
+    (while (!= a NIL)
+      (progn
+        (if (member (car a) b) (++ count) NIL)
+        (set a (cdr a))))
+    count))
+
+(defun hash-intersect (a b count seen)
+  (progn
+    (set seen (make-hash))
+    (while (!= b NIL)
+      (progn
+        (hash-set! seen (car b) T)
+        (set b (cdr b))))
+    (while (!= a NIL)
+      (progn
+        (if (hash-get seen (car a)) (++ count) NIL)
+        (set a (cdr a))))
+    count))
+
+(set n 3000)
+(set a (range 0 n NIL))
+(set b (range (/ n 2) (+ n (/ n 2)) NIL))
+(println (list-intersect a b 0))
+(println (hash-intersect a b 0 NIL))
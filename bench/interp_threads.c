@@ -0,0 +1,83 @@
+// runs independent interpreters on 1, 2, 4, ... up to N threads (default 16).
+// every thread makes its own interpreter, loads lib.lisp and runs the same
+// job JOBS times, so with no shared state throughput should scale with the
+// thread count up to the number of cores.
+//
+// usage: make bench/interp_threads && bench/interp_threads [N] [JOBS]
+//        (run from the repository root)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "../toylisp.h"
+
+static const char* Setup =
+  "(defun fib (n) (if (< n 3) 1 (+ (fib (- n 1)) (fib (- n 2)))))"
+  "(defun build (n i l) (progn (for (set i 0) (< i n) (++ i) (set l (cons i l))) l))";
+
+static const char* Job = "(fib 20) (car (build 20000 0 NIL)) (hash-count (make-hash)) (fib 6)";
+
+static int Jobs = 20;
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void* worker(void* arg) {
+  int* failed = (int*)arg;
+  Interp* interp = interp_new();
+  if(interp == NULL || interp_load_file(interp, "./lib.lisp") != 0 || interp_eval_string(interp, Setup, NULL) != 0) {
+    *failed = 1;
+    return NULL;
+  }
+  const char* result = NULL;
+  for(int i = 0; i < Jobs; i++) {
+    if(interp_eval_string(interp, Job, &result) != 0) {
+      *failed = 1;
+      break;
+    }
+  }
+  if(result == NULL || strcmp(result, "8") != 0) {
+    *failed = 1;
+  }
+  interp_free(interp);
+  return NULL;
+}
+
+int main(int argc, char const *argv[]) {
+  int max_threads = argc > 1 ? atoi(argv[1]) : 16;
+  if(argc > 2) {
+    Jobs = atoi(argv[2]);
+  }
+  pthread_t threads[256];
+  int failed[256];
+  double base = 0.0;
+  printf("threads   seconds   jobs/sec   speedup\n");
+  for(int n = 1; n <= max_threads && n <= 256; n *= 2) {
+    memset(failed, 0, sizeof(failed));
+    double start = now();
+    for(int i = 0; i < n; i++) {
+      pthread_create(&threads[i], NULL, worker, &failed[i]);
+    }
+    for(int i = 0; i < n; i++) {
+      pthread_join(threads[i], NULL);
+    }
+    double elapsed = now() - start;
+    for(int i = 0; i < n; i++) {
+      if(failed[i]) {
+        printf("thread %d of %d failed\n", i, n);
+        return 1;
+      }
+    }
+    double rate = (double)(n * Jobs) / elapsed;
+    if(n == 1) {
+      base = rate;
+    }
+    printf("%7d %9.3f %10.1f %8.2fx\n", n, elapsed, rate, rate / base);
+  }
+  return 0;
+}
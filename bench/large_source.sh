@@ -0,0 +1,28 @@
+#!/bin/bash
+# streaming reader benchmark: generates a file of N top-level forms (default
+# 200000), each quoting a 50-element list, and reports time and peak RSS.
+# peak memory should stay flat as N grows since forms are evaluated and
+# dropped as they are read.
+#
+# usage: bench/large_source.sh [N]    (run from the repository root)
+
+N=${1:-200000}
+TOYLISP=${TOYLISP:-./toylisp}
+FILE=${TMPDIR:-/tmp}/toylisp_forms_$N.lisp
+
+awk -v n="$N" 'BEGIN {
+  for(i = 0; i < n; i++) {
+    printf("(set x (quote (");
+    for(j = 0; j < 50; j++) printf(" %d", i + j);
+    printf(")))\n");
+  }
+  printf("%s\n", "(println (car x))");
+}' > "$FILE"
+
+echo "reading $N forms ($(du -h "$FILE" | cut -f1)) from $FILE"
+if [ -x /usr/bin/time ]; then
+  /usr/bin/time -f "%es %MKB peak RSS" "$TOYLISP" "$FILE"
+else
+  time "$TOYLISP" "$FILE"
+fi
+rm -f "$FILE"
@@ -0,0 +1,34 @@
+; numeric loop micro-benchmark: fixnum, float and mixed arithmetic and comparisons.
+;
+; usage: time ./toylisp [--engine=vm] bench/numeric.lisp    (run from the repository root)
+
+(defun int-loop (n i acc)
+  (progn
+    (for (set i 0) (< i n) (++ i)
+      (set acc (+ acc (* i 3) (- i 1) (/ i 7))))
+    acc))
+
+(defun float-loop (n i acc)
+  (progn
+    (for (set i 0) (< i n) (++ i)
+      (set acc (+ (* acc 0.5) (* i 1.5))))
+    acc))
+
+(defun mixed-loop (n i acc)
+  (progn
+    (for (set i 0) (< i n) (++ i)
+      (set acc (+ acc i 0.25)))
+    acc))
+
+(defun compare-loop (n i hits)
+  (progn
+    (for (set i 0) (< i n) (++ i)
+      (cond
+        ((< 100 i 200 n) (set hits (+ hits 1)))
+        ((>= i 1000.5) (set hits (+ hits 2)))))
+    hits))
+
+(println (int-loop 1000000 0 0))
+(println (float-loop 1000000 0 0.0))
+(println (mixed-loop 1000000 0 0))
+(println (compare-loop 1000000 0 0))
@@ -0,0 +1,20 @@
+#!/bin/bash
+# parse-time benchmark for symbol interning: generates a file with N distinct
+# symbols (default 100000) and times the interpreter loading it.
+#
+# usage: bench/parse_symbols.sh [N]    (run from the repository root)
+
+N=${1:-100000}
+TOYLISP=${TOYLISP:-./toylisp}
+FILE=${TMPDIR:-/tmp}/toylisp_symbols_$N.lisp
+
+awk -v n="$N" 'BEGIN {
+  printf("%s", "(set symbols (quote (");
+  for(i = 0; i < n; i++) printf(" sym-%d", i);
+  printf("%s\n", ")))");
+  printf("%s\n", "(println (quote parsed))");
+}' > "$FILE"
+
+echo "parsing $N symbols from $FILE"
+time "$TOYLISP" "$FILE"
+rm -f "$FILE"
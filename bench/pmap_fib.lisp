@@ -0,0 +1,17 @@
+; parallel map benchmark: fib-recursive of 1..30 with pmap, the items get
+; exponentially more expensive so the last chunks dominate unless the
+; workers steal them. bench/pmap_speedup.sh times it for 1, 2, 4, ... workers.
+;
+; usage: time ./toylisp [--workers=N] bench/pmap_fib.lisp    (run from the repository root)
+
+(defun fib-recursive (n)
+  (if (< n 3)
+    1
+    (+ (fib-recursive (- n 1)) (fib-recursive (- n 2)))))
+
+(defun range (from to acc)
+  (if (< to from)
+    acc
+    (range from (- to 1) (cons to acc))))
+
+(println (pmap fib-recursive (range 1 30 NIL)))
@@ -0,0 +1,22 @@
+#!/bin/bash
+# times bench/pmap_fib.lisp with 1, 2, 4, ... workers up to the number of
+# online cpus (or N) and prints the speedup over a single worker.
+#
+# usage: bench/pmap_speedup.sh [N]    (run from the repository root)
+
+N=${1:-$(getconf _NPROCESSORS_ONLN)}
+TOYLISP=${TOYLISP:-./toylisp}
+
+now_ns() {
+  date +%s%N
+}
+
+echo "workers   seconds   speedup"
+base=0
+for((workers = 1; workers <= N; workers *= 2)); do
+  start=$(now_ns)
+  "$TOYLISP" --workers=$workers bench/pmap_fib.lisp > /dev/null || exit 1
+  elapsed=$(( $(now_ns) - start ))
+  [ $base -eq 0 ] && base=$elapsed
+  awk -v w=$workers -v t=$elapsed -v b=$base 'BEGIN { printf("%7d %9.3f %8.2fx\n", w, t / 1e9, b / t) }'
+done
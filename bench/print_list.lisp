@@ -0,0 +1,12 @@
+; printer benchmark: builds a 1M-element list and prints it.
+;
+; usage: time ./toylisp [--engine=vm] bench/print_list.lisp > /dev/null    (run from the repository root)
+
+(defun range (n acc)
+  (if (== n 0)
+    acc
+    (range (- n 1) (cons n acc))))
+
+(set numbers (range 1000000 NIL))
+(println numbers)
+(println (list 1.5 "text" 'symbol (list (list 1 2) 3) (cons 1 2)))
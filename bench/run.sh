@@ -0,0 +1,95 @@
+#!/bin/bash
+# benchmark driver: runs every program in bench/corpus (plus a generated
+# symbol-heavy source file) N times (default 5) and writes one JSON report to
+# stdout. per benchmark it reports the best and mean wall time, ops/sec over
+# the ops count declared by the program's "; ops:" header, peak RSS and the
+# allocation counts printed by --gc-stats. a program that raises an error (toylisp
+# exits non-zero) is reported as {"name": ..., "failed": true, "error": ...}
+# and the script exits 1 once the report is written.
+#
+# usage: bench/run.sh [N] > report.json    (run from the repository root)
+#        TOYLISP=./toylisp ENGINE=vm JIT=on bench/run.sh 10
+#
+# compare two reports with e.g. jq '.benchmarks[] | [.name, .ops_per_sec]'
+
+N=${1:-5}
+TOYLISP=${TOYLISP:-./toylisp}
+ENGINE=${ENGINE:-tree}
+JIT=${JIT:-off}
+SYMBOLS=${TMPDIR:-/tmp}/toylisp_bench_symbols.lisp
+OUTPUT=${TMPDIR:-/tmp}/toylisp_bench_output.txt
+
+# 1000 forms quoting 100 distinct symbols each, exercises reading and interning
+awk 'BEGIN {
+  print("; ops: 100000 symbols");
+  for(i = 0; i < 1000; i++) {
+    printf("(set symbols (quote (");
+    for(j = 0; j < 100; j++) printf(" sym-%d-%d", i, j);
+    printf(")))\n");
+  }
+}' > "$SYMBOLS"
+
+now_ns() {
+  date +%s%N
+}
+
+echo "{"
+echo "  \"toylisp\": \"$TOYLISP\","
+echo "  \"engine\": \"$ENGINE\","
+echo "  \"jit\": \"$JIT\","
+echo "  \"iterations\": $N,"
+echo "  \"benchmarks\": ["
+first=1
+failed=0
+for file in bench/corpus/*.lisp "$SYMBOLS"; do
+  name=$(basename "$file" .lisp)
+  name=${name#toylisp_bench_}
+  ops=$(sed -n 's/^; ops: \([0-9]*\).*/\1/p' "$file" | head -1)
+  total_ns=0
+  best_ns=0
+  stats=""
+  error=""
+  for((i = 0; i < N; i++)); do
+    start=$(now_ns)
+    stats=$("$TOYLISP" --engine="$ENGINE" --jit="$JIT" --gc-stats "$file" 2>&1 >"$OUTPUT")
+    status=$?
+    elapsed=$(( $(now_ns) - start ))
+    if [ $status -ne 0 ]; then
+      # errors go to stdout after the traceback, e.g. "TypeError: car of type(INT)"
+      error=$(grep -E '^[A-Za-z]*Error: ' "$OUTPUT" | tail -1)
+      error=${error:-"exit status $status"}
+      break
+    fi
+    stats=$(echo "$stats" | grep '^gc: ')
+    if [ -z "$stats" ]; then
+      echo "$name: no stats from $TOYLISP" >&2
+      exit 1
+    fi
+    total_ns=$(( total_ns + elapsed ))
+    if [ $best_ns -eq 0 ] || [ $elapsed -lt $best_ns ]; then
+      best_ns=$elapsed
+    fi
+  done
+  [ $first -eq 1 ] || echo ","
+  first=0
+  if [ -n "$error" ]; then
+    echo "$name: failed, $error" >&2
+    failed=1
+    error=$(printf '%s' "$error" | sed 's/\\/\\\\/g; s/"/\\"/g')
+    printf '    {"name": "%s", "failed": true, "error": "%s"}' "$name" "$error"
+    continue
+  fi
+  echo "$name: best $(( best_ns / 1000000 ))ms" >&2
+  # "gc: A allocs, B bytes allocated, C collections, D us paused, E KB peak rss"
+  echo "$stats" | awk -v name="$name" -v ops="${ops:-1}" -v n="$N" -v best="$best_ns" -v total="$total_ns" '{
+    gsub(",", "");
+    mean = total / n;
+    printf("    {\"name\": \"%s\", \"ops\": %s, \"best_s\": %.6f, \"mean_s\": %.6f, \"ops_per_sec\": %.0f, ", name, ops, best / 1e9, mean / 1e9, ops / (mean / 1e9));
+    printf("\"peak_rss_kb\": %s, \"allocs\": %s, \"bytes_allocated\": %s, \"collections\": %s, \"gc_pause_us\": %s}", $12, $2, $4, $7, $9);
+  }'
+done
+echo
+echo "  ]"
+echo "}"
+rm -f "$SYMBOLS" "$OUTPUT"
+exit $failed
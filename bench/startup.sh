@@ -0,0 +1,42 @@
+#!/bin/bash
+# startup latency: launches the interpreter N times (default 100) and prints
+# the mean time per launch, loading the prelude from source and from a heap
+# image dumped with --dump-image. the prelude is lib.lisp alone, then
+# lib.lisp plus M (default 2000) generated definitions standing in for a
+# grown library.
+#
+# usage: bench/startup.sh [N] [M]    (run from the repository root)
+
+N=${1:-100}
+M=${2:-2000}
+TOYLISP=${TOYLISP:-./toylisp}
+DIR=${TMPDIR:-/tmp}/toylisp_startup
+mkdir -p "$DIR"
+
+echo "NIL" > "$DIR/empty.lisp"
+awk -v m="$M" 'BEGIN {
+  for(i = 0; i < m; i++) {
+    printf("(defun f-%d (x y) (if (< x y) (+ x (* y %d)) (swap x y)))\n", i, i);
+  }
+}' > "$DIR/defs.lisp"
+"$TOYLISP" --dump-image="$DIR/lib.img" || exit 1
+"$TOYLISP" --dump-image="$DIR/defs.img" "$DIR/defs.lisp" > /dev/null || exit 1
+
+now_ns() {
+  date +%s%N
+}
+
+launch() {
+  local start=$(now_ns)
+  for((i = 0; i < N; i++)); do
+    "$TOYLISP" "$@" > /dev/null || exit 1
+  done
+  local elapsed=$(( $(now_ns) - start ))
+  awk -v t=$elapsed -v n=$N 'BEGIN { printf("%8.3f ms/launch\n", t / n / 1e6) }'
+}
+
+echo "lib.lisp                 source $(launch "$DIR/empty.lisp")"
+echo "lib.lisp                 image  $(launch --image="$DIR/lib.img" "$DIR/empty.lisp")"
+echo "lib.lisp + $M defuns  source $(launch "$DIR/defs.lisp")"
+echo "lib.lisp + $M defuns  image  $(launch --image="$DIR/defs.img" "$DIR/empty.lisp")"
+rm -rf "$DIR"
@@ -0,0 +1,20 @@
+; string building micro-benchmark: appends to a string in a loop, then
+; splits it back up with substring and joins the pieces.
+;
+; usage: time ./toylisp [--engine=vm] bench/string_concat.lisp    (run from the repository root)
+
+(defun build (n s i)
+  (progn
+    (for (set i 0) (< i n) (++ i)
+      (set s (+ s "abcd")))
+    s))
+
+(defun split (s n i parts)
+  (progn
+    (for (set i 0) (< i n) (++ i)
+      (set parts (cons (substring s (* i 4) (+ (* i 4) 4)) parts)))
+    parts))
+
+(set text (build 100000 "" 0))
+(println (string-length text))
+(println (string-length (string-join (split text 100000 0 NIL) ",")))
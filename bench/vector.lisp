@@ -0,0 +1,22 @@
+; bulk vector kernel micro-benchmark: sums, dot products, element-wise adds
+; and scaling over 100000 item vectors, unboxed and boxed.
+; build with -DTOYLISP_NO_SIMD to time the scalar kernels.
+;
+; usage: time ./toylisp [--engine=vm] bench/vector.lisp    (run from the repository root)
+
+(defun kernels (v w n i acc)
+  (progn
+    (for (set i 0) (< i n) (++ i)
+      (set acc (+ acc (vsum v) (vdot v w) (vmin (vmap+ v w)) (vmax (vscale w 3)))))
+    acc))
+
+(set fv (make-f64vector 100000 0.5))
+(set fw (make-f64vector 100000 1.25))
+(set iv (make-i64vector 100000 3))
+(set iw (make-i64vector 100000 -2))
+(set gv (list->vector (vector->list fv)))
+(set gw (list->vector (vector->list fw)))
+
+(println (kernels fv fw 1000 0 0))
+(println (kernels iv iw 1000 0 0))
+(println (kernels gv gw 10 0 0))
@@ -0,0 +1,17 @@
+; macros defined after the lambdas that use them are expanded when the call
+; first runs, on the arguments as they were written
+
+(defun add-to-each (x) (map (add-to x) (list 1 2 3)))
+(defun quoted-type (x) (type-of-arg x))
+(defun wrapped (x) (wrap x))
+(defun collect (&rest xs) (make-adder xs))
+
+(defmacro add-to (v) (list 'lambda '(i) (list '+ 'i v)))
+(defmacro type-of-arg (v) (list 'quote (typeof v)))
+(defmacro wrap (v) (list 'progn (list 'set 'tmp 1) v))
+(defmacro make-adder (v) (list 'length v))
+
+(println (add-to-each 10))
+(println (quoted-type 10))
+(println (wrapped 10))
+(println (collect 1 2 3))
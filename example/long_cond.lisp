@@ -0,0 +1,9 @@
+; a cond with more clauses than the bytecode compiler patches jumps for
+; falls back to the tree form, run it with --engine=vm
+(defun clauses (i n)
+  (if (== i n)
+    (list (list T ''other))
+    (cons (list (list '== 'x i) (* i 10)) (clauses (+ i 1) n))))
+(defmacro big-cond () (cons 'cond (clauses 0 300)))
+(defun pick (x) (big-cond))
+(println (pick 0) (pick 255) (pick 256) (pick 299) (pick 1000))
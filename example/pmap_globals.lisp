@@ -0,0 +1,9 @@
+; a set on a global in a pmap worker is seen neither by the caller nor by the
+; jobs the same worker runs later, each job starts from the caller's value
+(set counter 0)
+(defun bump (x) (progn (set counter (+ counter x)) counter))
+(println (pmap bump (list 5)) (pmap bump (list 5)))
+(set fresh T)
+(for (set i 0) (< i 100) (++ i)
+  (if (== (car (pmap bump (list 1))) 1) NIL (set fresh NIL)))
+(println fresh counter)
@@ -0,0 +1,8 @@
+; a tail-recursive loop of 10 million iterations, runs in constant stack
+
+(defun count-down (n acc)
+  (if (== n 0)
+    acc
+    (count-down (- n 1) (+ acc 1))))
+
+(println (count-down 10000000 0))
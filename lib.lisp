@@ -1,48 +1,67 @@
 ; the library of toylisp
 
-(set list 
+(set list
   (lambda (&rest args) args))
 
-(defmacro defun (name params body) 
-  (list 'set name (list 'lambda params body)))
-
-(defun instanceof (a b) 
-  (== (typeof a) (typeof b)))
+; defun, if, and, or, ++, --, swap and for are special forms of the interpreter.
+; these macros only stand in for them in a build with TOYLISP_NO_NATIVE_FORMS.
 
-(defun typeif (a b) 
-  (== (typeof a) b))
+(cond ((isbound 'defun) NIL) (T
+(defmacro defun (name params body)
+  (list 'set name (list 'lambda params body)))
+))
 
-(defmacro if (test then else) 
+(cond ((isbound 'if) NIL) (T
+(defmacro if (test then else)
   (list 'cond (list test then) (list T else)))
+))
 
-(defmacro and (a b) 
+(cond ((isbound 'and) NIL) (T
+(defmacro and (a b)
   (list 'if a (list 'if b T NIL) NIL))
+))
 
+(cond ((isbound 'or) NIL) (T
 (defmacro or (a b)
   (list 'if a T (list 'if b T NIL)))
+))
 
-(defmacro isnull (a) (list '== a 'NIL))
-
-(defmacro atom (x) 
-  (list '!= (list 'typeof x) ''CONS))
-
-(defun length (l)
-  (if (== l NIL)
-    0
-    (+ 1 (length (cdr l)))))
-
+(cond ((isbound '++) NIL) (T
 (defmacro ++ (i)
   (list 'progn (list 'set i (list '+ i 1)) i)
 )
+))
 
+(cond ((isbound '--) NIL) (T
 (defmacro -- (i)
   (list 'progn (list 'set i (list '- i 1)) i)
 )
+))
 
+(cond ((isbound 'swap) NIL) (T
 (defmacro swap (a b)
   (list 'progn (list 'set '__temp a) (list 'set a b) (list 'set b '__temp))
 )
+))
 
+(cond ((isbound 'for) NIL) (T
 (defmacro for (_init _cond _iter _body)
   (list 'progn _init (list 'while _cond (list 'progn _body _iter)))
 )
+))
+
+(defun instanceof (a b)
+  (== (typeof a) (typeof b)))
+
+(defun typeif (a b)
+  (== (typeof a) b))
+
+(defmacro isnull (a) (list '== a 'NIL))
+
+(defmacro atom (x)
+  (list '!= (list 'typeof x) ''CONS))
+
+(defun length (l)
+  (if (== l NIL)
+    0
+    (+ 1 (length (cdr l)))))
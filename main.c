@@ -1,15 +1,28 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <inttypes.h>
 #include <ctype.h>
 #include <assert.h>
 #include <setjmp.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <signal.h>
+#if defined(__x86_64__) && !defined(TOYLISP_NO_SIMD)
+#include <immintrin.h>
+#endif
+#include <pthread.h>
+#include "toylisp.h"
 
-jmp_buf g_buf;
-
-#define type(x) (x->type)
+#define type(x) type_of(x)
 #define car(x) (x->v_cons.head)
 #define cdr(x) (x->v_cons.tail)
 #define cons(x, y) new_cons(x, y)
@@ -18,19 +31,128 @@ jmp_buf g_buf;
 #define param2 car(cdr(x))
 #define param3 car(cdr(cdr(x)))
 
-#define INT_CACHE_MIN -128
-#define INT_CACHE_MAX 128
-#define INT_CACHE_NORMAL_INDEX(index) (index + (-1 * INT_CACHE_MIN))
+// a value is a tagged word, heap objects are at least 8 byte aligned:
+//   ...xx1 fixnum, the 63 bit integer in the upper bits
+//   ...x10 flonum, a double whose exponent is rotated into the word
+//   0x4 NIL, 0xc T
+//   ...000 pointer to an Obj
+#define TAG_MASK 0x7
+#define TAG_FIXNUM 0x1
+#define TAG_FLONUM 0x2
+#define FIXNUM_MIN (INT64_MIN >> 1)
+#define FIXNUM_MAX (INT64_MAX >> 1)
+#define FLONUM_ZERO 0x8000000000000002ull
+#define is_fixnum(x) ((uintptr_t)(x) & TAG_FIXNUM)
+#define is_flonum(x) (((uintptr_t)(x) & 0x3) == TAG_FLONUM)
+#define is_heap_obj(x) (((uintptr_t)(x) & TAG_MASK) == 0)
+#define fixnum_value(x) ((int64_t)(intptr_t)(x) >> 1)
 #define TO_BOOL_OBJ(c) (c ? TrueObj : NilObj)
-#define DEFINE_BUILTIN(name) static inline Obj* builtin_##name(Obj* env, Obj* x)
-#define REF_COUNT(obj) (obj->ref_count)
-#define DEC_REF(obj) if(--REF_COUNT(obj) < 1) { destroy_obj(obj); }
-#define INC_REF(obj) (++REF_COUNT(obj))
+#define DEFINE_BUILTIN(name) static inline Obj* builtin_##name(Obj* env, int argc, Obj** argv)
+#define DEFINE_SPECIAL(name) static inline Obj* builtin_##name(Obj* env, Obj* x)
+#define SYMBOL_TABLE_INIT_CAPACITY 256
+#define POOL_CHUNK_SIZE (64 * 1024)
+#define POOL_GRANULE 16
+#define POOL_CLASS_COUNT 16
+#define POOL_MAX_CELL_SIZE (POOL_GRANULE * POOL_CLASS_COUNT)
+#define POOL_CLASS_OF(size) (((size) + POOL_GRANULE - 1) / POOL_GRANULE - 1)
+#define POOL_CHUNK_CELLS(chunk) ((char*)(chunk) + POOL_GRANULE * ((sizeof(PoolChunk) + POOL_GRANULE - 1) / POOL_GRANULE))
+#define POOL_OBJS_PER_CHUNK ((POOL_CHUNK_SIZE - POOL_GRANULE * ((sizeof(PoolChunk) + POOL_GRANULE - 1) / POOL_GRANULE)) / sizeof(Obj))
+#ifndef GC_MIN_HEAP_OBJECTS
+#define GC_MIN_HEAP_OBJECTS (64 * 1024)
+#endif
+#ifndef GC_MIN_EXTERNAL_BYTES
+#define GC_MIN_EXTERNAL_BYTES (32 * 1024 * 1024)
+#endif
+#define GC_DEFAULT_GROWTH 2.0
+#define VM_STACK_SIZE (1024 * 1024)
+#define VM_FRAMES_MAX (256 * 1024)
+#define FRAME_STACK_SIZE (64 * 1024)
+#define FRAME_SLOTS_SIZE (256 * 1024)
+#define FRAME_CALLER (-1)
+#define FRAME_HEAP (-2)
+#define ROPE_MIN_LENGTH 64
+#define PRINT_MAX_DEPTH 1000
+#define PRINT_BLOCK_SIZE (64 * 1024)
+#define ENV_INLINE_SLOTS 2
+#define HASH_MIN_CAPACITY 8
+#define CALL_STACK_MAX (64 * 1024)
+#define STACK_TRACE_MAX 16
+#define STACK_TRACE_FORM_MAX 72
+#define PROFILE_INTERVAL_US 1000
+#define PROFILE_MAX_DEPTH 256
+#define PROFILE_BUFFER_WORDS (1024 * 1024)
+#define HASH_MIGRATE_STEP 64
+#define WIRE_MAX_DEPTH 1000
+#define WIRE_MAX_LAMBDAS 64
+#define CHUNKS_PER_WORKER 4
+#define IMAGE_MAGIC "TLIMAGE1"
+#define IMAGE_EXT (1ull << 62)
+#define IMAGE_EXT_BUILTIN (1ull << 61)
+#define JIT_DEFAULT_THRESHOLD 100
+#define JIT_MAX_PARAMS 16
+#define JIT_MAX_BAILS 64
+#define JIT_NEVER -1
+// the C stack native code may use below the call entering it,
+// deeper recursion bails out to the interpreter
+#define JIT_STACK_BUDGET (1 << 20)
+// the C stack eval leaves to the builtins, the printer and error reporting,
+// a recursion that would go deeper is a stack overflow
+#define EVAL_STACK_MARGIN (256 * 1024)
+#define is_vector(x) (type(x) == T_VECTOR || type(x) == T_F64VECTOR || type(x) == T_I64VECTOR)
+#define OBJ_TYPE_COUNT (T_FREE + 1)
+
+// counters for --stats and (runtime-stats), TOYLISP_NO_STATS compiles them out
+#ifdef TOYLISP_NO_STATS
+#define STAT(expr) ((void)0)
+#else
+#define STAT(expr) ((void)(expr))
+#endif
 
 typedef struct Obj Obj;
 typedef enum ObjType ObjType;
 typedef struct Parser Parser;
-typedef Obj*(*Builtin)(Obj*, Obj*);
+typedef struct SymbolTable SymbolTable;
+typedef struct Scope Scope;
+typedef struct Optimizer Optimizer;
+typedef struct PoolCell PoolCell;
+typedef struct PoolChunk PoolChunk;
+typedef struct PoolStats PoolStats;
+typedef struct Pool Pool;
+typedef struct GcStats GcStats;
+typedef struct Heap Heap;
+typedef struct MacroCacheStats MacroCacheStats;
+typedef struct RuntimeStats RuntimeStats;
+typedef struct Bytecode Bytecode;
+typedef struct VmFrame VmFrame;
+typedef struct Vm Vm;
+typedef struct FrameStack FrameStack;
+typedef struct StrBuf StrBuf;
+typedef struct Printer Printer;
+typedef struct VecKernels VecKernels;
+typedef struct HashEntry HashEntry;
+typedef struct CallFrame CallFrame;
+typedef struct CallStack CallStack;
+typedef struct ProfileStack ProfileStack;
+typedef struct ProfileCount ProfileCount;
+typedef struct Profiler Profiler;
+typedef struct PtrTable PtrTable;
+typedef struct Wire Wire;
+typedef struct WireReader WireReader;
+typedef struct Job Job;
+typedef struct Task Task;
+typedef struct Deque Deque;
+typedef struct Worker Worker;
+typedef struct Scheduler Scheduler;
+typedef struct ImageHeader ImageHeader;
+typedef struct ImageWriter ImageWriter;
+typedef struct JitGuard JitGuard;
+typedef struct JitCode JitCode;
+typedef struct JitCompiler JitCompiler;
+typedef Obj*(*Builtin)(Obj*, int, Obj**);
+typedef Obj*(*Special)(Obj*, Obj*);
+typedef Obj*(*NumKernel)(Obj*, Obj*, Obj*);
+typedef int(*CmpKernel)(Obj*, Obj*);
+typedef Obj*(*JitEntry)(Obj**, char*);
 
 enum ObjType {
   T_NULL,
@@ -43,25 +165,70 @@ enum ObjType {
   T_BUILTIN,
   T_LAMBDA,
   T_MACRO,
-  T_ENV
+  T_ENV,
+  T_REF,
+  T_EXPANSION,
+  T_CODE,
+  T_VECTOR,
+  T_F64VECTOR,
+  T_I64VECTOR,
+  T_HASHTABLE,
+  T_FUTURE,
+  T_FREE
+};
+
+enum CallKind {
+  CALL_BUILTIN,
+  CALL_SPECIAL,
+  CALL_LAMBDA,
+  CALL_KIND_COUNT
+};
+
+enum Engine {
+  ENGINE_TREE,
+  ENGINE_VM
+};
+
+enum TaskState {
+  TASK_PENDING,
+  TASK_DONE,
+  TASK_FAILED
 };
 
 struct Obj {
   ObjType type;
-  int ref_count;
+  int marked;
   union {
     int64_t v_int;
     double v_float;
-    char* v_str;
-    char* v_symbol;
+    // chars is NULL while the string is a rope node, the concatenation of
+    // left and right. it is flattened the first time its bytes are needed.
+    // hash is computed by the first comparison, 0 until then.
+    struct {
+      char* chars;
+      size_t length;
+      uint32_t hash;
+      Obj* left;
+      Obj* right;
+    } v_string;
+    struct {
+      char* v_symbol;
+      uint32_t v_symbol_hash;
+      Obj* v_global;
+    };
     struct {
       Obj* head;
       Obj* tail;
     } v_cons;
+    // builtins with ep set get their evaluated arguments as argv,
+    // special forms get the unevaluated argument list.
     struct {
       Obj* name;
       int paramc;
-      Builtin ptr;
+      union {
+        Builtin ptr;
+        Special special;
+      };
       int ep;
     } v_builtin;
     struct {
@@ -71,6 +238,7 @@ struct Obj {
       Obj* body;
       Obj* env;
       Obj* rest;
+      Obj* code;
     } v_lambda;
     struct {
       Obj* name;
@@ -81,42 +249,536 @@ struct Obj {
     struct {
       Obj* up;
       Obj* vars;
+      Obj* names;
+      Obj** slots;
+      int count;
+      Obj* inline_slots[ENV_INLINE_SLOTS];
     } v_env;
+    struct {
+      Obj* symbol;
+      int depth;
+      int slot;
+    } v_ref;
+    struct {
+      Obj* head;
+      Obj* macro;
+      Obj* expansion;
+      uint64_t epoch;
+    } v_expansion;
+    // jit_calls counts the calls until the lambda is compiled to jit,
+    // JIT_NEVER if it can't be. captures is cleared for a lambda body
+    // that can't close over its frame, so calls put it on the frame stack.
+    struct {
+      Obj* body;
+      Bytecode* bytecode;
+      JitCode* jit;
+      int jit_calls;
+      int captures;
+    } v_code;
+    // a T_VECTOR holds values, T_F64VECTOR and T_I64VECTOR unboxed numbers.
+    // the items are malloc'd and paced by the collector like string bytes.
+    struct {
+      union {
+        Obj** items;
+        double* f64;
+        int64_t* i64;
+      };
+      size_t length;
+    } v_vector;
+    // open addressing with linear probing, entries has a power of 2 capacity.
+    // growing allocates a new array and moves the old one over a few slots
+    // per operation, lookups check both until old_entries is drained.
+    // used counts the occupied slots of entries, tombstones included, plus
+    // the keys still waiting in old_entries, so the load check covers both.
+    struct {
+      HashEntry* entries;
+      HashEntry* old_entries;
+      size_t capacity;
+      size_t old_capacity;
+      size_t old_index;
+      size_t count;
+      size_t used;
+    } v_hash;
+    // task is NULL once touch has decoded the result into value
+    struct {
+      Task* task;
+      Obj* value;
+    } v_future;
+    struct {
+      Obj* next;
+    } v_free;
   };
 };
 
+_Static_assert(sizeof(void*) == 8, "tagged values need 64 bit words");
+
+static inline ObjType type_of(Obj* x) {
+  uintptr_t bits = (uintptr_t)x;
+  if(bits & TAG_MASK) {
+    if(bits & TAG_FIXNUM) return T_INT;
+    if(bits & TAG_FLONUM) return T_FLOAT;
+    return bits == 0x4 ? T_NULL : T_BOOL;
+  }
+  return x->type;
+}
+
+struct SymbolTable {
+  Obj** slots;
+  uint32_t capacity;
+  uint32_t count;
+};
+
+struct PoolCell {
+  PoolCell* next;
+};
+
+// chunks are POOL_CHUNK_SIZE aligned, the header sits in front of the cells
+struct PoolChunk {
+  PoolChunk* next;
+  size_t cell_size;
+};
+
+struct PoolStats {
+  uint64_t allocs;
+  uint64_t frees;
+  uint64_t bytes_allocated;
+  uint64_t bytes_live;
+  uint64_t chunks;
+};
+
+// cells of each size class are handed out from a free list first,
+// then bump allocated from the newest chunk of that class.
+// objects live in chunks of their own, kept sorted by address so the collector
+// can tell whether an arbitrary word points into one of them.
+struct Pool {
+  PoolCell* free_list[POOL_CLASS_COUNT];
+  char* bump[POOL_CLASS_COUNT];
+  char* bump_end[POOL_CLASS_COUNT];
+  PoolChunk* chunks;
+#ifdef TOYLISP_USE_MALLOC
+  Obj** objs;
+  size_t obj_capacity;
+#else
+  Obj* free_objs;
+  PoolChunk** obj_chunks;
+  size_t obj_chunk_capacity;
+#endif
+  size_t obj_chunk_count;
+  size_t obj_count;
+  PoolStats stats;
+};
+
+struct GcStats {
+  uint64_t collections;
+  uint64_t pause_ns_total;
+  uint64_t pause_ns_max;
+  uint64_t objects_freed;
+  uint64_t objects_live;
+  uint64_t bytes_live;
+};
+
+// a collection starts once the object count reaches limit,
+// which is reset to growth times the survivors after each collection.
+// bytes malloc'd for string contents are paced the same way by external_limit.
+struct Heap {
+  size_t limit;
+  size_t external_bytes;
+  size_t external_limit;
+  double growth;
+  char* stack_bottom;
+  Obj** mark_stack;
+  size_t mark_top;
+  size_t mark_capacity;
+  GcStats stats;
+};
+
+struct MacroCacheStats {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t invalidations;
+};
+
+struct RuntimeStats {
+  uint64_t evals[OBJ_TYPE_COUNT]; // forms evaluated by the tree engine, by type
+  uint64_t calls[CALL_KIND_COUNT];
+  uint64_t macroexpands;
+  uint64_t allocs[OBJ_TYPE_COUNT];
+  uint64_t external_bytes; // string, vector and hash table payloads
+  uint64_t lookups; // find_var by name
+  uint64_t lookup_misses;
+  uint64_t lookup_depth; // environments walked by those lookups
+  uint64_t interns;
+  uint64_t symbols_created;
+  uint64_t fixnums;
+  uint64_t boxed_ints;
+  uint64_t flonums;
+  uint64_t boxed_floats;
+  uint64_t jit_compiled;
+  uint64_t jit_calls; // calls that ran native code to the end
+  uint64_t jit_bails;
+  uint64_t stack_frames; // lambda frames pushed on the frame stack
+  uint64_t heap_frames;
+  uint64_t promoted_frames; // stack frames copied to the heap for a closure
+};
+
+// instructions are int32 words, an opcode followed by its operands.
+// jump operands are absolute offsets into ops.
+struct Bytecode {
+  int32_t* ops;
+  int count;
+  int capacity;
+  Obj** consts;
+  int const_count;
+  int const_capacity;
+};
+
+// base indexes the stack slot of the called function,
+// the operand stack of the frame starts right above it.
+struct VmFrame {
+  Bytecode* bytecode;
+  int32_t* ip;
+  Obj* env;
+  int base;
+};
+
+struct Vm {
+  Obj** stack;
+  int sp;
+  VmFrame* frames;
+  int fp;
+};
+
+// the frames of lambdas that can't close over them (see may_capture) are
+// pushed and popped here like the C stack, their slots on a stack of their own.
+// a closure made over one anyway, by a macro say, is kept in escapes and gets
+// a heap copy of the frame when it's popped. escape_mark is the lowest frame
+// escapes refer to, FRAME_STACK_SIZE if none. used is the high water mark,
+// the dead frames below it are never traced. owners has the call depth of the
+// eval that pops each frame, FRAME_CALLER for one its caller pops itself.
+struct FrameStack {
+  Obj* cells;
+  Obj** slots;
+  int* owners;
+  int top;
+  int slot_top;
+  int used;
+  Obj* escapes;
+  int escape_mark;
+};
+
+// a lexical level seen by the resolver, mirrors one T_ENV at runtime.
+// names is NilObj for the unnamed levels created by progn.
+struct Scope {
+  Scope* up;
+  Obj* names;
+};
+
+// the unit the optimizer rewrites: shadowed are the symbols a set in it
+// may add as locals, bind is cleared if its globals can't be trusted
+// (it doesn't run in the global env or calls eval or defmacro)
+struct Optimizer {
+  Obj* shadowed;
+  int bind;
+};
+
+// a growable byte buffer, data is NUL terminated once anything was appended
+struct StrBuf {
+  char* data;
+  size_t length;
+  size_t capacity;
+};
+
+// the printer writes to fp when it is set, otherwise it appends to buf.
+// stdout is block buffered by stdio when it isn't a terminal, see main.
+// source prints builtins as their names, for code the optimizer bound
+struct Printer {
+  FILE* fp;
+  StrBuf* buf;
+  int source;
+};
+
+// key NULL marks a free slot, a deleted one (tombstone) keeps a non-NULL value
+// so probing goes on past it
+struct HashEntry {
+  Obj* key;
+  Obj* value;
+  uint32_t hash;
+};
+
+// the lisp call stack, kept next to the C one for tracebacks and the profiler.
+// a tail call replaces the top frame. frames beyond CALL_STACK_MAX are
+// counted in depth but not recorded.
+struct CallFrame {
+  Obj* fn;
+  Obj* form;
+};
+
+struct CallStack {
+  CallFrame frames[CALL_STACK_MAX];
+  int depth;
+};
+
+// a folded stack, the frame names from the root joined by ;
+struct ProfileStack {
+  char* key;
+  size_t length;
+  uint32_t hash;
+  uint64_t count;
+};
+
+// stamp is the last sample that counted towards total,
+// so a recursive function counts once per sample
+struct ProfileCount {
+  Obj* name;
+  uint64_t self;
+  uint64_t total;
+  uint64_t stamp;
+};
+
+// the SIGPROF handler appends each sample to samples as the stack depth
+// followed by the names of up to PROFILE_MAX_DEPTH innermost frames.
+// profile_drain folds them into stacks and functions outside of the handler.
+struct Profiler {
+  int running;
+  uintptr_t* samples;
+  size_t count;
+  uint64_t sample_count;
+  uint64_t dropped;
+  ProfileStack* stacks;
+  size_t stack_count;
+  size_t stack_capacity;
+  ProfileCount* funcs;
+  size_t func_count;
+  size_t func_capacity;
+};
+
+// bulk numeric kernels over unboxed vectors, see vector_init
+struct VecKernels {
+  double (*f64_sum)(const double* a, size_t n);
+  double (*f64_dot)(const double* a, const double* b, size_t n);
+  void (*f64_add)(double* out, const double* a, const double* b, size_t n);
+  void (*f64_scale)(double* out, const double* a, double k, size_t n);
+  double (*f64_min)(const double* a, size_t n);
+  double (*f64_max)(const double* a, size_t n);
+  int (*i64_sum)(const int64_t* a, size_t n, int64_t* res);
+  int (*i64_add)(int64_t* out, const int64_t* a, const int64_t* b, size_t n);
+};
+
+// keys hashed by address, order lists them as they were added.
+// used as a set of symbols and, with values, as a symbol to hash map
+struct PtrTable {
+  Obj** keys;
+  uint32_t* values;
+  Obj** order;
+  size_t count;
+  size_t capacity;
+};
+
+// values cross between interpreters as bytes, each one is rebuilt in the heap
+// of the receiver. code is sent as source: symbols collects the symbols of the
+// code being written so its lambda can send the captured variables among them
+// and globals the rest, open holds the lambdas being written.
+struct Wire {
+  StrBuf* out;
+  PtrTable* symbols;
+  PtrTable globals;
+  Obj* open[WIRE_MAX_LAMBDAS];
+  int open_count;
+};
+
+struct WireReader {
+  const char* p;
+  const char* end;
+};
+
+// a function sent to the workers, program is the globals it refers to
+// followed by the function itself, see job_new
+struct Job {
+  StrBuf program;
+  enum Engine engine;
+  int jit_threshold;
+  int optimize;
+  int refs;
+};
+
+// items is the encoded chunk of a pmap, NULL data for a future.
+// state is guarded by the scheduler lock, result is written by the worker
+// before it leaves TASK_PENDING.
+struct Task {
+  Job* job;
+  StrBuf items;
+  StrBuf result;
+  int state;
+  int refs;
+};
+
+// the owner pushes and pops at the tail, thieves steal from the head
+struct Deque {
+  pthread_mutex_t lock;
+  Task** tasks;
+  size_t head;
+  size_t count;
+  size_t capacity;
+};
+
+// a worker thread runs tasks in an interpreter of its own, installed
+// remembers the hash of the bytes each global was last installed from
+struct Worker {
+  pthread_t thread;
+  Interp* interp;
+  Deque deque;
+  PtrTable installed;
+  unsigned seed;
+};
+
+// pending counts the tasks sitting in deques, cond is signalled when
+// one is queued or finished and when the workers are to stop
+struct Scheduler {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  Worker* workers;
+  int count;
+  int next;
+  int pending;
+  int stopping;
+};
+
+// a heap image is this header, the object cells and then the bytes they own
+// (names, string contents, slots, items), see image_dump. pointers are stored
+// as offsets from the start of the file, builtins and the global environment
+// as IMAGE_EXT references resolved against the loading interpreter.
+struct ImageHeader {
+  char magic[8];
+  uint32_t obj_size;
+  uint32_t reserved;
+  uint64_t cells;
+  uint64_t count;
+  uint64_t size;
+  uint64_t macro_epoch;
+};
+
+// objs numbers the objects as they are found, bytes collects what they own
+struct ImageWriter {
+  PtrTable objs;
+  StrBuf bytes;
+  uint64_t bytes_offset;
+};
+
+// a global the native code of a lambda was compiled against
+struct JitGuard {
+  Obj* symbol;
+  Obj* value;
+};
+
+// entry is the native code of a lambda, mapped executable at size bytes.
+// it runs only while the macros are those of epoch and every guard holds,
+// and returns NULL to bail out on anything it doesn't handle.
+struct JitCode {
+  JitEntry entry;
+  size_t size;
+  int paramc;
+  uint64_t epoch;
+  JitGuard* guards;
+  int guard_count;
+  int bails;
+};
+
+// labels are offsets into code, -1 until bound. patches are pairs of the
+// offset of a rel32 and the label it jumps to, fixnum is set while rax is
+// known to hold a fixnum.
+struct JitCompiler {
+  StrBuf code;
+  Obj* self;
+  int* labels;
+  int label_count;
+  int label_capacity;
+  int* patches;
+  int patch_count;
+  int patch_capacity;
+  JitGuard* guards;
+  int guard_count;
+  int guard_capacity;
+  int fixnum;
+};
+
 struct Parser {
-  char* filename;
-  char* source;
-  int index;
-  int length;
+  const char* filename;
+  const char* source; // not NUL-terminated when mapped
+  size_t index;
+  size_t length;
+  int mapped;
+};
+
+static Obj* const NilObj = (Obj*)0x4;
+static Obj* const TrueObj = (Obj*)0xc;
+// everything one interpreter owns. a thread runs the interpreter in TheInterp,
+// the embedding api in toylisp.h switches it on entry and back on return.
+struct Interp {
+  Obj* global_env;
+  SymbolTable symbols;
+  Obj* closure_builtin;
+  Obj* seq_builtin;
+  Pool pool;
+  Heap heap;
+  uint64_t macro_epoch;
+  MacroCacheStats macro_cache;
+  RuntimeStats stats;
+  enum Engine engine;
+  int jit_threshold; // calls before a lambda is compiled, 0 with the jit off
+  int optimize; // run top-level forms and lambda bodies through the optimizer
+  Obj* nil_symbol;
+  Obj* t_symbol;
+  Vm vm;
+  FrameStack frames;
+  CallStack calls;
+  Profiler prof;
+  Obj* profile_root;
+  Obj* profile_lambda;
+  Obj* profile_elided;
+  jmp_buf* handler; // innermost run(), errors longjmp here
+  char* stack_limit; // eval raises a stack overflow below it, NULL if unknown
+  StrBuf repr; // obj_repr's result
+  int entered; // api calls active on the current thread
+  char* image; // the mapped heap image, its cells are never swept
+  size_t image_size;
+  Obj* image_cells;
+  size_t image_count;
 };
 
-static Obj* NilObj;
-static Obj* TrueObj;
-static Obj* GlobalEnv;
-static Obj* Symbols;
-static Obj* IntCache[INT_CACHE_MAX - INT_CACHE_MIN + 1];
+static __thread Interp* TheInterp;
 
 Obj* intern(const char* symbol);
-Obj* parse(Parser* parser);
+Obj* intern_n(const char* symbol, size_t len);
 Obj* parse_obj(Parser* parser);
-Obj* eval_list(Obj* env, Obj* x);
 Obj* eval(Obj* env, Obj* x);
 void add_var(Obj* env, Obj* symbol, Obj* obj);
-Obj* find_var(Obj* env, Obj* symbol);
-Obj* run(Obj* env, Obj* x);
-const char* obj_to_str(Obj* x, char* str);
+Obj** find_var(Obj* env, Obj* symbol);
+Obj** find_ref(Obj* env, Obj* ref);
+Obj* resolve(Scope* scope, Obj* x);
+int may_capture(Obj* x);
+Obj* optimize_toplevel(Obj* x);
+void optimize_lambda(Obj* lambda);
+Obj* run_string(Obj* env, const char* source, size_t length);
+Obj* expand_call_site(Obj* env, Obj* x, Obj* macro);
+Obj* vm_apply(Obj* lambda, int argc, Obj** argv);
+Obj* vm_run_toplevel(Obj* env, Obj* x);
+int jit_call(Obj* fn, int argc, Obj** argv, Obj** res);
+void jit_free(JitCode* jit);
+void print_obj(Printer* printer, Obj* x);
+const char* obj_repr(Obj* x);
+HashEntry* hash_next(Obj* h, size_t* pos);
+Obj* list_to_vector(Obj* env, const char* name, ObjType type, Obj* list);
+int vector_equals(Obj* env, Obj* a, Obj* b);
 
-void print_stack_trace(Obj* env) {
-  // TODO unimplements
-}
+void print_stack_trace(Obj* env);
+void profile_drain();
+void task_release(Task* task);
 
 void throw_error_v(Obj* env, const char* format, va_list ap) {
   print_stack_trace(env);
   vprintf(format, ap);
   printf("\n");
-  longjmp(g_buf, 1);
+  longjmp(*TheInterp->handler, 1);
 }
 
 void throw_error(Obj* env, const char* format, ...) {
@@ -143,746 +805,7056 @@ int list_length(Obj* x) {
   return i;
 }
 
-void destroy_obj(Obj* obj) {
-  assert(REF_COUNT(obj) == 0);
-  free(obj);
+void finalize_obj(Obj* obj);
+
+#ifdef TOYLISP_USE_MALLOC
+
+// plain malloc, keeps every allocation visible to ASan and valgrind.
+// objects are tracked in an address set rebuilt on every sweep.
+void* pool_alloc(size_t size) {
+  TheInterp->pool.stats.allocs++;
+  TheInterp->pool.stats.bytes_allocated += size;
+  TheInterp->pool.stats.bytes_live += size;
+  return malloc(size);
 }
 
-Obj* new_obj(ObjType type) {
-  Obj* obj = (Obj*)malloc(sizeof(Obj));
-  obj->type = type;
-  REF_COUNT(obj) = 0;
-  return obj;
+void pool_free(void* ptr, size_t size) {
+  TheInterp->pool.stats.frees++;
+  TheInterp->pool.stats.bytes_live -= size;
+  free(ptr);
 }
 
-Obj* new_cons(Obj* head, Obj* tail) {
-  Obj* obj = new_obj(T_CONS);
-  obj->v_cons.head = head;
-  obj->v_cons.tail = tail;
-  return obj;
+static inline size_t pool_obj_index(Obj* obj, size_t capacity) {
+  return (size_t)(((uintptr_t)obj >> 4) * 11400714819323198485ull) & (capacity - 1);
 }
 
-Obj* __new_int(int64_t val) {
-  Obj* obj = new_obj(T_INT);
-  obj->v_int = val;
-  return obj;
+void pool_insert_obj(Pool* pool, Obj* obj) {
+  size_t index = pool_obj_index(obj, pool->obj_capacity);
+  while(pool->objs[index] != NULL) {
+    index = (index + 1) & (pool->obj_capacity - 1);
+  }
+  pool->objs[index] = obj;
 }
 
-Obj* new_int(int64_t val) {
-  if(val >= INT_CACHE_MIN && val <= INT_CACHE_MAX) {
-    return IntCache[INT_CACHE_NORMAL_INDEX(val)];
+void pool_rebuild_objs(Pool* pool, size_t capacity) {
+  Obj** old_objs = pool->objs;
+  size_t old_capacity = pool->obj_capacity;
+  pool->objs = (Obj**)calloc(capacity, sizeof(Obj*));
+  pool->obj_capacity = capacity;
+  for(size_t i = 0; i < old_capacity; i++) {
+    if(old_objs[i] != NULL) {
+      pool_insert_obj(pool, old_objs[i]);
+    }
   }
-  return __new_int(val);
+  free(old_objs);
 }
 
-Obj* new_float(double val) {
-  Obj* obj = new_obj(T_FLOAT);
-  obj->v_float = val;
+Obj* pool_alloc_obj(Pool* pool) {
+  if((pool->obj_count + 1) * 2 > pool->obj_capacity) {
+    pool_rebuild_objs(pool, pool->obj_capacity ? pool->obj_capacity * 2 : 1024);
+  }
+  Obj* obj = (Obj*)pool_alloc(sizeof(Obj));
+  pool_insert_obj(pool, obj);
+  pool->obj_count++;
   return obj;
 }
 
-Obj* new_string(const char* val) {
-  Obj* obj = new_obj(T_STRING);
-  obj->v_str = strdup(val);
-  return obj;
+Obj* pool_lookup_obj(Pool* pool, void* ptr) {
+  if(pool->obj_capacity == 0) return NULL;
+  Obj* obj = (Obj*)ptr;
+  for(size_t index = pool_obj_index(obj, pool->obj_capacity); pool->objs[index] != NULL; index = (index + 1) & (pool->obj_capacity - 1)) {
+    if(pool->objs[index] == obj) return obj;
+  }
+  return NULL;
 }
 
-Obj* new_symbol(const char* val) {
-  Obj* obj = new_obj(T_SYMBOL);
-  obj->v_symbol = strdup(val);
-  Symbols = new_cons(obj, Symbols);
-  return obj;
+size_t pool_sweep_objs(Pool* pool) {
+  size_t freed = 0;
+  for(size_t i = 0; i < pool->obj_capacity; i++) {
+    Obj* obj = pool->objs[i];
+    if(obj == NULL) continue;
+    if(obj->marked) {
+      obj->marked = 0;
+      continue;
+    }
+    finalize_obj(obj);
+    pool_free(obj, sizeof(Obj));
+    pool->objs[i] = NULL;
+    freed++;
+  }
+  pool->obj_count -= freed;
+  pool_rebuild_objs(pool, pool->obj_capacity);
+  return freed;
 }
 
-Obj* new_env(Obj* up, Obj* vars) {
-  Obj* obj = new_obj(T_ENV);
-  obj->v_env.up = up;
-  obj->v_env.vars = vars;
+void pool_release(Pool* pool) {
+  for(size_t i = 0; i < pool->obj_capacity; i++) {
+    if(pool->objs[i] != NULL) {
+      finalize_obj(pool->objs[i]);
+      free(pool->objs[i]);
+    }
+  }
+  free(pool->objs);
+  memset(pool, 0, sizeof(Pool));
+}
+
+#else
+
+PoolChunk* pool_new_chunk(Pool* pool, size_t cell_size) {
+  PoolChunk* chunk = (PoolChunk*)aligned_alloc(POOL_CHUNK_SIZE, POOL_CHUNK_SIZE);
+  if(chunk == NULL) {
+    printf("out of memory\n");
+    exit(-1);
+  }
+  chunk->next = pool->chunks;
+  chunk->cell_size = cell_size;
+  pool->chunks = chunk;
+  pool->stats.chunks++;
+  return chunk;
+}
+
+void* pool_refill(Pool* pool, int index) {
+  size_t cell_size = (size_t)(index + 1) * POOL_GRANULE;
+  PoolChunk* chunk = pool_new_chunk(pool, cell_size);
+  char* cells = POOL_CHUNK_CELLS(chunk);
+  pool->bump[index] = cells + cell_size;
+  pool->bump_end[index] = cells + ((POOL_CHUNK_SIZE - (cells - (char*)chunk)) / cell_size) * cell_size;
+  return cells;
+}
+
+void* pool_alloc(size_t size) {
+  Pool* pool = &TheInterp->pool;
+  pool->stats.allocs++;
+  pool->stats.bytes_allocated += size;
+  pool->stats.bytes_live += size;
+  if(size > POOL_MAX_CELL_SIZE) {
+    return malloc(size);
+  }
+  int index = POOL_CLASS_OF(size);
+  PoolCell* cell = pool->free_list[index];
+  if(cell != NULL) {
+    pool->free_list[index] = cell->next;
+    return cell;
+  }
+  char* ptr = pool->bump[index];
+  if(ptr != NULL && ptr + (index + 1) * POOL_GRANULE <= pool->bump_end[index]) {
+    pool->bump[index] = ptr + (index + 1) * POOL_GRANULE;
+    return ptr;
+  }
+  return pool_refill(pool, index);
+}
+
+void pool_free(void* ptr, size_t size) {
+  Pool* pool = &TheInterp->pool;
+  pool->stats.frees++;
+  pool->stats.bytes_live -= size;
+  if(size > POOL_MAX_CELL_SIZE) {
+    free(ptr);
+    return;
+  }
+  int index = POOL_CLASS_OF(size);
+  PoolCell* cell = (PoolCell*)ptr;
+  cell->next = pool->free_list[index];
+  pool->free_list[index] = cell;
+}
+
+// carves a whole chunk into free objects at once, so every cell of an
+// object chunk is either live or T_FREE when the collector walks it.
+void pool_refill_objs(Pool* pool) {
+  PoolChunk* chunk = pool_new_chunk(pool, sizeof(Obj));
+  if(pool->obj_chunk_count == pool->obj_chunk_capacity) {
+    pool->obj_chunk_capacity = pool->obj_chunk_capacity ? pool->obj_chunk_capacity * 2 : 16;
+    pool->obj_chunks = (PoolChunk**)realloc(pool->obj_chunks, sizeof(PoolChunk*) * pool->obj_chunk_capacity);
+  }
+  size_t i = pool->obj_chunk_count++;
+  while(i > 0 && pool->obj_chunks[i - 1] > chunk) {
+    pool->obj_chunks[i] = pool->obj_chunks[i - 1];
+    i--;
+  }
+  pool->obj_chunks[i] = chunk;
+  Obj* cells = (Obj*)POOL_CHUNK_CELLS(chunk);
+  for(size_t j = POOL_OBJS_PER_CHUNK; j-- > 0;) {
+    cells[j].type = T_FREE;
+    cells[j].marked = 0;
+    cells[j].v_free.next = pool->free_objs;
+    pool->free_objs = &cells[j];
+  }
+}
+
+Obj* pool_alloc_obj(Pool* pool) {
+  if(pool->free_objs == NULL) {
+    pool_refill_objs(pool);
+  }
+  Obj* obj = pool->free_objs;
+  pool->free_objs = obj->v_free.next;
+  pool->obj_count++;
+  pool->stats.allocs++;
+  pool->stats.bytes_allocated += sizeof(Obj);
+  pool->stats.bytes_live += sizeof(Obj);
   return obj;
 }
 
-Obj* push_env(Obj* env, Obj* vars, Obj* values, Obj* rest_param) {
-  Obj* map = NilObj;
-  for(Obj* p = vars, *q = values; p != NilObj; p = cdr(p), q = cdr(q)) {
-    Obj* sym = car(p);
-    Obj* val = car(q);
-    if(rest_param != NilObj && sym == rest_param) {
-      map = acons(sym, q, map);
-      break;   
+static inline void pool_free_obj(Pool* pool, Obj* obj) {
+  obj->type = T_FREE;
+  obj->v_free.next = pool->free_objs;
+  pool->free_objs = obj;
+  pool->obj_count--;
+  pool->stats.frees++;
+  pool->stats.bytes_live -= sizeof(Obj);
+}
+
+// maps any address inside an object cell to that object, NULL for everything else
+Obj* pool_lookup_obj(Pool* pool, void* ptr) {
+  PoolChunk* chunk = (PoolChunk*)((uintptr_t)ptr & ~(uintptr_t)(POOL_CHUNK_SIZE - 1));
+  size_t lo = 0, hi = pool->obj_chunk_count;
+  while(lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    if(pool->obj_chunks[mid] < chunk) {
+      lo = mid + 1;
     } else {
-      map = acons(sym, val, map);
+      hi = mid;
     }
   }
-  return new_env(env, map);
+  if(lo == pool->obj_chunk_count || pool->obj_chunks[lo] != chunk) {
+    return NULL;
+  }
+  char* cells = POOL_CHUNK_CELLS(chunk);
+  if((char*)ptr < cells) {
+    return NULL;
+  }
+  size_t index = ((char*)ptr - cells) / sizeof(Obj);
+  if(index >= POOL_OBJS_PER_CHUNK) {
+    return NULL;
+  }
+  Obj* obj = (Obj*)cells + index;
+  return type(obj) == T_FREE ? NULL : obj;
 }
 
-const char* obj_type_to_str(ObjType type) {
-  switch(type) {
-    case T_NULL: return "NULL";
-    case T_BOOL: return "BOOL";
-    case T_INT: return "INT";
-    case T_FLOAT: return "FLOAT";
-    case T_STRING: return "STRING";
-    case T_SYMBOL: return "SYMBOL";
-    case T_CONS: return "CONS";
-    case T_BUILTIN: return "BUILTIN";
-    case T_LAMBDA: return "LAMBDA";
-    case T_MACRO: return "MACRO";
-    case T_ENV: return "ENV";
-    default: break;
+size_t pool_sweep_objs(Pool* pool) {
+  size_t freed = 0;
+  for(size_t i = 0; i < pool->obj_chunk_count; i++) {
+    Obj* cells = (Obj*)POOL_CHUNK_CELLS(pool->obj_chunks[i]);
+    for(size_t j = 0; j < POOL_OBJS_PER_CHUNK; j++) {
+      Obj* obj = &cells[j];
+      if(type(obj) == T_FREE) continue;
+      if(obj->marked) {
+        obj->marked = 0;
+        continue;
+      }
+      finalize_obj(obj);
+      pool_free_obj(pool, obj);
+      freed++;
+    }
   }
-  return "UNKOWN_TYPE";
+  return freed;
 }
 
-const char* obj_to_str(Obj* x, char* str) {
-  switch(type(x)) {
-    case T_NULL: strcpy(str, "NIL"); break;
-    case T_BOOL: strcpy(str, "T"); break;
-    case T_INT: sprintf(str, "%" PRId64, x->v_int); break;
-    case T_FLOAT: sprintf(str, "%.16g", x->v_float); break;
-    case T_STRING: strcpy(str, x->v_str); break;
-    case T_SYMBOL: strcpy(str, x->v_symbol); break;
-    case T_CONS: {
-      char* ptr = str;
-      *ptr++ = '(';
-      for(Obj* p = x; p != NilObj; p = cdr(p)) {
-        if(type(p) == T_CONS) {
-          ptr += (int)strlen(obj_to_str(car(p), ptr));
-          if(cdr(p) != NilObj) *ptr++ = ' ';
-        } else {
-          *ptr++ = '.';
-          *ptr++ = ' ';
-          ptr += (int)strlen(obj_to_str(p, ptr));
-          break;
-        }
+// returns every chunk of the pool at once, all cells carved from it become invalid
+void pool_release(Pool* pool) {
+  for(size_t i = 0; i < pool->obj_chunk_count; i++) {
+    Obj* cells = (Obj*)POOL_CHUNK_CELLS(pool->obj_chunks[i]);
+    for(size_t j = 0; j < POOL_OBJS_PER_CHUNK; j++) {
+      if(type(&cells[j]) != T_FREE) {
+        finalize_obj(&cells[j]);
+      }
+    }
+  }
+  for(PoolChunk* chunk = pool->chunks, *next; chunk != NULL; chunk = next) {
+    next = chunk->next;
+    free(chunk);
+  }
+  free(pool->obj_chunks);
+  memset(pool, 0, sizeof(Pool));
+}
+
+#endif
+
+void gc_collect();
+
+// releases what an object owns outside of its cell
+void finalize_obj(Obj* obj) {
+  switch(type(obj)) {
+    case T_STRING: {
+      if(obj->v_string.chars != NULL) {
+        TheInterp->heap.external_bytes -= obj->v_string.length + 1;
+        free(obj->v_string.chars);
       }
-      *ptr++ = ')';
-      *ptr = '\0';
       break;
     }
-    case T_BUILTIN: {
-      sprintf(str, "<BUILTIN %s(%d)>", x->v_builtin.name->v_symbol, x->v_builtin.paramc);      
+    case T_SYMBOL: free(obj->v_symbol); break;
+    case T_VECTOR:
+    case T_F64VECTOR:
+    case T_I64VECTOR: {
+      TheInterp->heap.external_bytes -= sizeof(Obj*) * obj->v_vector.length;
+      free(obj->v_vector.items);
       break;
     }
-    case T_LAMBDA: {
-      sprintf(str, "<LAMBDA %s(%d)>", x->v_lambda.name->v_symbol, x->v_lambda.paramc);      
+    case T_HASHTABLE: {
+      TheInterp->heap.external_bytes -= sizeof(HashEntry) * (obj->v_hash.capacity + obj->v_hash.old_capacity);
+      free(obj->v_hash.entries);
+      free(obj->v_hash.old_entries);
       break;
     }
-    case T_MACRO: {
-      sprintf(str, "<MACRO %s(%d)>", x->v_macro.name->v_symbol, x->v_macro.paramc);      
+    case T_ENV: {
+      if(obj->v_env.slots != NULL && obj->v_env.slots != obj->v_env.inline_slots) {
+        pool_free(obj->v_env.slots, sizeof(Obj*) * obj->v_env.count);
+      }
       break;
     }
-    default: {
-      sprintf(str, "<%s 0x%p>", obj_type_to_str(type(x)), x);
+    case T_FUTURE: {
+      if(obj->v_future.task != NULL) {
+        task_release(obj->v_future.task);
+      }
+      break;
+    }
+    case T_CODE: {
+      Bytecode* bytecode = obj->v_code.bytecode;
+      if(bytecode != NULL) {
+        free(bytecode->ops);
+        free(bytecode->consts);
+        free(bytecode);
+      }
+      if(obj->v_code.jit != NULL) {
+        jit_free(obj->v_code.jit);
+      }
       break;
     }
+    default: break;
   }
-  return str;
 }
 
-int peek_char(Parser* parser) {
-  if(parser->index < parser->length) {
-    return parser->source[parser->index];
-  }
-  return EOF;
+// malloc'd payloads owned by an object, they pace the collector like objects do
+static inline void gc_external_alloc(size_t bytes) {
+  TheInterp->heap.external_bytes += bytes;
+  STAT(TheInterp->stats.external_bytes += bytes);
 }
 
-int next_char(Parser* parser) {
-  if(parser->index < parser->length) {
-    return parser->source[parser->index++];
+Obj* new_obj(ObjType type) {
+  Interp* interp = TheInterp;
+  if(interp->pool.obj_count >= interp->heap.limit || interp->heap.external_bytes >= interp->heap.external_limit) {
+    gc_collect();
   }
-  return EOF;
+  Obj* obj = pool_alloc_obj(&interp->pool);
+  obj->type = type;
+  obj->marked = 0;
+  STAT(interp->stats.allocs[type]++);
+  return obj;
 }
 
-void skip_char(Parser* parser, int ch) {
-  int c = next_char(parser);
-  assert(c == ch);
+void gc_init(char* stack_bottom) {
+  Heap* heap = &TheInterp->heap;
+  memset(heap, 0, sizeof(Heap));
+  heap->limit = GC_MIN_HEAP_OBJECTS;
+  heap->external_limit = GC_MIN_EXTERNAL_BYTES;
+  heap->growth = GC_DEFAULT_GROWTH;
+  heap->stack_bottom = stack_bottom;
 }
 
-void skip_whitespace(Parser* parser) {
-  while(isspace(peek_char(parser))) {
-    next_char(parser);
+static inline void gc_mark(Obj* obj) {
+  Heap* heap = &TheInterp->heap;
+  if(obj == NULL || !is_heap_obj(obj) || obj->marked) return;
+  obj->marked = 1;
+  if(heap->mark_top == heap->mark_capacity) {
+    heap->mark_capacity = heap->mark_capacity ? heap->mark_capacity * 2 : 1024;
+    heap->mark_stack = (Obj**)realloc(heap->mark_stack, sizeof(Obj*) * heap->mark_capacity);
   }
+  heap->mark_stack[heap->mark_top++] = obj;
 }
 
-char* read_file_to_text(const char* filename) {
-  FILE* fp = fopen(filename, "r");
-  if(!fp) {
-    return NULL;
+// marking uses an explicit stack so long lists can't overflow the C stack
+void gc_mark_children() {
+  Heap* heap = &TheInterp->heap;
+  while(heap->mark_top > 0) {
+    Obj* obj = heap->mark_stack[--heap->mark_top];
+    switch(type(obj)) {
+      case T_SYMBOL: gc_mark(obj->v_global); break;
+      case T_STRING: {
+        gc_mark(obj->v_string.left);
+        gc_mark(obj->v_string.right);
+        break;
+      }
+      case T_CONS: {
+        gc_mark(obj->v_cons.head);
+        gc_mark(obj->v_cons.tail);
+        break;
+      }
+      case T_VECTOR: {
+        for(size_t i = 0; i < obj->v_vector.length; i++) {
+          gc_mark(obj->v_vector.items[i]);
+        }
+        break;
+      }
+      case T_HASHTABLE: {
+        for(size_t i = 0; i < obj->v_hash.capacity; i++) {
+          gc_mark(obj->v_hash.entries[i].key);
+          gc_mark(obj->v_hash.entries[i].value);
+        }
+        for(size_t i = obj->v_hash.old_index; i < obj->v_hash.old_capacity; i++) {
+          gc_mark(obj->v_hash.old_entries[i].key);
+          gc_mark(obj->v_hash.old_entries[i].value);
+        }
+        break;
+      }
+      case T_BUILTIN: gc_mark(obj->v_builtin.name); break;
+      case T_LAMBDA: {
+        gc_mark(obj->v_lambda.name);
+        gc_mark(obj->v_lambda.params);
+        gc_mark(obj->v_lambda.body);
+        gc_mark(obj->v_lambda.env);
+        gc_mark(obj->v_lambda.rest);
+        gc_mark(obj->v_lambda.code);
+        break;
+      }
+      case T_MACRO: {
+        gc_mark(obj->v_macro.name);
+        gc_mark(obj->v_macro.params);
+        gc_mark(obj->v_macro.body);
+        break;
+      }
+      case T_ENV: {
+        gc_mark(obj->v_env.up);
+        gc_mark(obj->v_env.vars);
+        gc_mark(obj->v_env.names);
+        for(int i = 0; i < obj->v_env.count; i++) {
+          gc_mark(obj->v_env.slots[i]);
+        }
+        break;
+      }
+      case T_REF: gc_mark(obj->v_ref.symbol); break;
+      case T_FUTURE: gc_mark(obj->v_future.value); break;
+      case T_CODE: {
+        gc_mark(obj->v_code.body);
+        Bytecode* bytecode = obj->v_code.bytecode;
+        if(bytecode != NULL) {
+          for(int i = 0; i < bytecode->const_count; i++) {
+            gc_mark(bytecode->consts[i]);
+          }
+        }
+        JitCode* jit = obj->v_code.jit;
+        if(jit != NULL) {
+          for(int i = 0; i < jit->guard_count; i++) {
+            gc_mark(jit->guards[i].symbol);
+            gc_mark(jit->guards[i].value);
+          }
+        }
+        break;
+      }
+      case T_EXPANSION: {
+        gc_mark(obj->v_expansion.head);
+        gc_mark(obj->v_expansion.macro);
+        gc_mark(obj->v_expansion.expansion);
+        break;
+      }
+      default: break;
+    }
   }
-  fseek(fp, 0, SEEK_END);
-  long size = ftell(fp);
-  fseek(fp, 0, SEEK_SET);
-  char* buf = (char*)malloc(size + 1);
-  fread(buf, 1, size, fp);
-  fclose(fp);
-  buf[size] = '\0';
-  return buf;
 }
 
-Obj* parse_file(const char* filename) {
-  Parser parser;
-  char* source = read_file_to_text(filename);
-  if(!source) {
-    printf("can't open file: %s\n", filename);
-    exit(-1);
-    return NULL;
+// temporaries held by eval/call and the builtins are found by
+// scanning the C stack (and the registers spilled onto it) conservatively,
+// everything reachable from them is traced precisely.
+__attribute__((noinline, no_sanitize_address)) void gc_mark_stack() {
+  jmp_buf regs;
+  __builtin_unwind_init();
+  setjmp(regs);
+  char* top = (char*)&regs;
+  uintptr_t* p = (uintptr_t*)((uintptr_t)top & ~(uintptr_t)(sizeof(uintptr_t) - 1));
+  for(; (char*)p < TheInterp->heap.stack_bottom; p++) {
+    Obj* obj = pool_lookup_obj(&TheInterp->pool, (void*)*p);
+    if(obj != NULL) {
+      gc_mark(obj);
+    }
   }
-  parser.filename = strdup(filename);
-  parser.source = source;
-  parser.index = 0;
-  parser.length = strlen(parser.source);
-  return parse(&parser);
 }
 
-Obj* parse_source(const char* source) {
-  Parser parser;
-  parser.filename = strdup("<STDIN>");
-  parser.source = strdup(source);
-  parser.index = 0;
-  parser.length = strlen(parser.source);
-  return parse(&parser);
+void gc_mark_roots() {
+  Interp* interp = TheInterp;
+  // the frames below used that were popped stay marked, whatever still points at them is stale
+  FrameStack* fs = &interp->frames;
+  for(int i = 0; i < fs->used; i++) {
+    fs->cells[i].marked = i >= fs->top;
+  }
+  for(int i = 0; i < fs->top; i++) {
+    gc_mark(&fs->cells[i]);
+  }
+  gc_mark(fs->escapes);
+  gc_mark(interp->global_env);
+  gc_mark(interp->closure_builtin);
+  gc_mark(interp->seq_builtin);
+  for(int i = 0; i < interp->vm.sp; i++) {
+    gc_mark(interp->vm.stack[i]);
+  }
+  for(int i = 0; i < interp->vm.fp; i++) {
+    gc_mark(interp->vm.frames[i].env);
+  }
+  for(int i = 0; i < interp->calls.depth && i < CALL_STACK_MAX; i++) {
+    gc_mark(interp->calls.frames[i].fn);
+    gc_mark(interp->calls.frames[i].form);
+  }
+  for(uint32_t i = 0; i < interp->symbols.capacity; i++) {
+    gc_mark(interp->symbols.slots[i]);
+  }
+  // any image object may have been set to point at a new one
+  for(size_t i = 0; i < interp->image_count; i++) {
+    interp->image_cells[i].marked = 0;
+  }
+  for(size_t i = 0; i < interp->image_count; i++) {
+    gc_mark(&interp->image_cells[i]);
+  }
+  gc_mark_stack();
+}
+
+uint64_t gc_clock_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+void gc_collect() {
+  Interp* interp = TheInterp;
+  uint64_t start = gc_clock_ns();
+  profile_drain();
+  gc_mark_roots();
+  gc_mark_children();
+  size_t freed = pool_sweep_objs(&interp->pool);
+  size_t live = interp->pool.obj_count;
+  size_t limit = (size_t)((double)live * interp->heap.growth);
+  interp->heap.limit = limit > GC_MIN_HEAP_OBJECTS ? limit : GC_MIN_HEAP_OBJECTS;
+  size_t external_limit = (size_t)((double)interp->heap.external_bytes * interp->heap.growth);
+  interp->heap.external_limit = external_limit > GC_MIN_EXTERNAL_BYTES ? external_limit : GC_MIN_EXTERNAL_BYTES;
+  uint64_t pause = gc_clock_ns() - start;
+  GcStats* stats = &interp->heap.stats;
+  stats->collections++;
+  stats->pause_ns_total += pause;
+  if(pause > stats->pause_ns_max) stats->pause_ns_max = pause;
+  stats->objects_freed += freed;
+  stats->objects_live = live;
+  stats->bytes_live = interp->pool.stats.bytes_live;
+}
+
+Obj* new_cons(Obj* head, Obj* tail) {
+  Obj* obj = new_obj(T_CONS);
+  obj->v_cons.head = head;
+  obj->v_cons.tail = tail;
+  return obj;
+}
+
+// integers beyond the fixnum range and doubles that aren't flonums are boxed
+Obj* new_boxed_int(int64_t val) {
+  STAT(TheInterp->stats.boxed_ints++);
+  Obj* obj = new_obj(T_INT);
+  obj->v_int = val;
+  return obj;
+}
+
+Obj* new_boxed_float(double val) {
+  STAT(TheInterp->stats.boxed_floats++);
+  Obj* obj = new_obj(T_FLOAT);
+  obj->v_float = val;
+  return obj;
+}
+
+static inline __attribute__((always_inline)) Obj* new_int(int64_t val) {
+  if(val >= FIXNUM_MIN && val <= FIXNUM_MAX) {
+    STAT(TheInterp->stats.fixnums++);
+    return (Obj*)(((uintptr_t)val << 1) | TAG_FIXNUM);
+  }
+  return new_boxed_int(val);
+}
+
+static inline int64_t int_value(Obj* x) {
+  return is_fixnum(x) ? fixnum_value(x) : x->v_int;
+}
+
+// doubles whose top three exponent bits are 011 or 100 (magnitudes between
+// about 2^-255 and 2^256) rotate those bits down below the tag, as CRuby's
+// flonums do. the two dropped exponent bits follow from the one kept.
+// +0.0 has a word of its own.
+static inline __attribute__((always_inline)) Obj* new_float(double val) {
+  uint64_t bits;
+  memcpy(&bits, &val, sizeof(bits));
+  int top = (int)(bits >> 60) & 0x7;
+  if(bits != 0x3000000000000000ull && (top == 3 || top == 4)) {
+    STAT(TheInterp->stats.flonums++);
+    return (Obj*)(uintptr_t)((((bits << 3) | (bits >> 61)) & ~(uint64_t)0x1) | TAG_FLONUM);
+  }
+  if(bits == 0) {
+    STAT(TheInterp->stats.flonums++);
+    return (Obj*)(uintptr_t)FLONUM_ZERO;
+  }
+  return new_boxed_float(val);
+}
+
+static inline double float_value(Obj* x) {
+  if(!is_flonum(x)) {
+    return x->v_float;
+  }
+  uint64_t word = (uint64_t)(uintptr_t)x;
+  if(word == FLONUM_ZERO) {
+    return 0.0;
+  }
+  uint64_t bits = (2 - (word >> 63)) | (word & ~(uint64_t)0x3);
+  bits = (bits >> 3) | (bits << 61);
+  double val;
+  memcpy(&val, &bits, sizeof(val));
+  return val;
+}
+
+void strbuf_append(StrBuf* buf, const char* s, size_t len) {
+  if(buf->length + len + 1 > buf->capacity) {
+    size_t capacity = buf->capacity ? buf->capacity : 64;
+    while(buf->length + len + 1 > capacity) {
+      capacity *= 2;
+    }
+    buf->data = (char*)realloc(buf->data, capacity);
+    buf->capacity = capacity;
+  }
+  memcpy(buf->data + buf->length, s, len);
+  buf->length += len;
+  buf->data[buf->length] = '\0';
+}
+
+static inline void strbuf_push(StrBuf* buf, char c) {
+  strbuf_append(buf, &c, 1);
+}
+
+// FNV-1a, never 0 so 0 can mark a hash that isn't computed yet
+uint32_t string_hash(const char* s, size_t len) {
+  uint32_t hash = 2166136261u;
+  for(size_t i = 0; i < len; i++) {
+    hash ^= (uint8_t)s[i];
+    hash *= 16777619u;
+  }
+  return hash ? hash : 1;
+}
+
+// takes ownership of chars, which must hold len bytes and a NUL
+Obj* new_string_owned(char* chars, size_t len) {
+  Obj* obj = new_obj(T_STRING);
+  obj->v_string.chars = chars;
+  obj->v_string.length = len;
+  obj->v_string.hash = 0;
+  obj->v_string.left = NULL;
+  obj->v_string.right = NULL;
+  gc_external_alloc(len + 1);
+  return obj;
+}
+
+Obj* new_string_n(const char* val, size_t len) {
+  char* chars = (char*)malloc(len + 1);
+  memcpy(chars, val, len);
+  chars[len] = '\0';
+  return new_string_owned(chars, len);
+}
+
+Obj* new_string(const char* val) {
+  return new_string_n(val, strlen(val));
+}
+
+// copies the pieces of the rope x into one buffer, right to left with an
+// explicit stack, so ropes built by long loops of + can't overflow the C stack.
+void string_flatten(Obj* x) {
+  size_t end = x->v_string.length;
+  char* chars = (char*)malloc(end + 1);
+  chars[end] = '\0';
+  size_t top = 0, capacity = 64;
+  Obj** stack = (Obj**)malloc(sizeof(Obj*) * capacity);
+  stack[top++] = x;
+  while(top > 0) {
+    Obj* node = stack[--top];
+    if(node->v_string.chars != NULL) {
+      end -= node->v_string.length;
+      memcpy(chars + end, node->v_string.chars, node->v_string.length);
+      continue;
+    }
+    if(top + 2 > capacity) {
+      capacity *= 2;
+      stack = (Obj**)realloc(stack, sizeof(Obj*) * capacity);
+    }
+    stack[top++] = node->v_string.left;
+    stack[top++] = node->v_string.right;
+  }
+  free(stack);
+  x->v_string.chars = chars;
+  gc_external_alloc(x->v_string.length + 1);
+  x->v_string.left = NULL;
+  x->v_string.right = NULL;
+}
+
+static inline const char* string_chars(Obj* x) {
+  if(x->v_string.chars == NULL) {
+    string_flatten(x);
+  }
+  return x->v_string.chars;
+}
+
+// short results are copied, longer ones share both operands in a rope node
+// so a loop appending to a string costs O(n) overall instead of O(n^2)
+Obj* string_concat(Obj* a, Obj* b) {
+  size_t len = a->v_string.length + b->v_string.length;
+  if(len < ROPE_MIN_LENGTH) {
+    char* chars = (char*)malloc(len + 1);
+    memcpy(chars, string_chars(a), a->v_string.length);
+    memcpy(chars + a->v_string.length, string_chars(b), b->v_string.length);
+    chars[len] = '\0';
+    return new_string_owned(chars, len);
+  }
+  Obj* obj = new_obj(T_STRING);
+  obj->v_string.chars = NULL;
+  obj->v_string.length = len;
+  obj->v_string.hash = 0;
+  obj->v_string.left = a;
+  obj->v_string.right = b;
+  return obj;
+}
+
+static inline uint32_t string_hash_of(Obj* x) {
+  if(x->v_string.hash == 0) {
+    x->v_string.hash = string_hash(string_chars(x), x->v_string.length);
+  }
+  return x->v_string.hash;
+}
+
+// lengths and hashes differ for almost all unequal strings, the bytes
+// are compared only when both match
+int string_equals(Obj* a, Obj* b) {
+  if(a->v_string.length != b->v_string.length) {
+    return 0;
+  }
+  if(string_hash_of(a) != string_hash_of(b)) {
+    return 0;
+  }
+  return memcmp(a->v_string.chars, b->v_string.chars, a->v_string.length) == 0;
+}
+
+Obj* new_symbol(const char* val, size_t len, uint32_t hash) {
+  Obj* obj = new_obj(T_SYMBOL);
+  obj->v_symbol = (char*)malloc(len + 1);
+  for(size_t i = 0; i < len; i++) {
+    obj->v_symbol[i] = toupper((unsigned char)val[i]);
+  }
+  obj->v_symbol[len] = '\0';
+  obj->v_symbol_hash = hash;
+  obj->v_global = NULL;
+  return obj;
+}
+
+Obj* new_env(Obj* up, Obj* vars) {
+  Obj* obj = new_obj(T_ENV);
+  obj->v_env.up = up;
+  obj->v_env.vars = vars;
+  obj->v_env.names = NilObj;
+  obj->v_env.slots = NULL;
+  obj->v_env.count = 0;
+  return obj;
+}
+
+// frames of up to ENV_INLINE_SLOTS parameters keep their slots in the env cell
+static inline void env_init_slots(Obj* env, Obj* names, int count) {
+  env->v_env.names = names;
+  env->v_env.count = count;
+  env->v_env.slots = count <= ENV_INLINE_SLOTS ? env->v_env.inline_slots : (Obj**)pool_alloc(sizeof(Obj*) * count);
+}
+
+// builds a frame whose slots are bound positionally to names,
+// the rest param (if any) takes the list of remaining values.
+Obj* push_env(Obj* env, Obj* names, Obj* values, Obj* rest_param) {
+  Obj* obj = new_env(env, NilObj);
+  env_init_slots(obj, names, list_length(names));
+  int i = 0;
+  for(Obj* p = names, *q = values; p != NilObj; p = cdr(p), q = cdr(q), ++i) {
+    if(rest_param != NilObj && car(p) == rest_param) {
+      obj->v_env.slots[i] = q;
+      break;
+    }
+    obj->v_env.slots[i] = car(q);
+  }
+  return obj;
+}
+
+static inline int frames_index(Obj* env) {
+  FrameStack* fs = &TheInterp->frames;
+  return env >= fs->cells && env < fs->cells + FRAME_STACK_SIZE ? (int)(env - fs->cells) : -1;
+}
+
+// a frame for count slots on the frame stack, NULL if it is full
+static inline Obj* frames_push(Obj* up, Obj* names, int count, int owner) {
+  FrameStack* fs = &TheInterp->frames;
+  if(fs->top == FRAME_STACK_SIZE || fs->slot_top + count > FRAME_SLOTS_SIZE) {
+    return NULL;
+  }
+  fs->owners[fs->top] = owner;
+  Obj* obj = &fs->cells[fs->top++];
+  if(fs->top > fs->used) {
+    fs->used = fs->top;
+  }
+  obj->type = T_ENV;
+  obj->v_env.up = up;
+  obj->v_env.vars = NilObj;
+  obj->v_env.names = names;
+  obj->v_env.slots = fs->slots + fs->slot_top;
+  obj->v_env.count = count;
+  fs->slot_top += count;
+  return obj;
+}
+
+// the lowest frame on the frame stack that env is or encloses, FRAME_STACK_SIZE if none
+static int frames_lowest(Obj* env) {
+  int lowest = FRAME_STACK_SIZE;
+  for(Obj* e = env; e != NilObj && e != TheInterp->global_env; e = e->v_env.up) {
+    int i = frames_index(e);
+    if(i >= 0 && i < lowest) {
+      lowest = i;
+    }
+  }
+  return lowest;
+}
+
+// a lambda closing over a frame on the frame stack is kept in escapes
+// until the frame is popped
+static inline void frames_capture(Obj* lambda) {
+  FrameStack* fs = &TheInterp->frames;
+  if(fs->top == 0) {
+    return;
+  }
+  int lowest = frames_lowest(lambda->v_lambda.env);
+  if(lowest == FRAME_STACK_SIZE) {
+    return;
+  }
+  fs->escapes = cons(lambda, fs->escapes);
+  if(lowest < fs->escape_mark) {
+    fs->escape_mark = lowest;
+  }
+}
+
+// env with the frames from base up that it is or encloses replaced by heap copies.
+// a copied frame is left as T_FREE pointing to its copy, for the other closures over it.
+static Obj* frames_move(Obj* env, int base) {
+  if(env == NilObj || env == TheInterp->global_env) {
+    return env;
+  }
+  if(frames_index(env) < base) {
+    env->v_env.up = frames_move(env->v_env.up, base);
+    return env;
+  }
+  if(env->type == T_FREE) {
+    return env->v_free.next;
+  }
+  STAT(TheInterp->stats.promoted_frames++);
+  Obj* copy = new_env(NilObj, env->v_env.vars);
+  env_init_slots(copy, env->v_env.names, env->v_env.count);
+  memcpy(copy->v_env.slots, env->v_env.slots, sizeof(Obj*) * env->v_env.count);
+  Obj* up = env->v_env.up;
+  env->type = T_FREE;
+  env->v_free.next = copy;
+  copy->v_env.up = frames_move(up, base);
+  return copy;
+}
+
+void frames_promote(int base) {
+  FrameStack* fs = &TheInterp->frames;
+  Obj* kept = NilObj;
+  int mark = FRAME_STACK_SIZE;
+  for(Obj* p = fs->escapes; p != NilObj; p = cdr(p)) {
+    Obj* lambda = car(p);
+    lambda->v_lambda.env = frames_move(lambda->v_lambda.env, base);
+    int lowest = frames_lowest(lambda->v_lambda.env);
+    if(lowest < FRAME_STACK_SIZE) {
+      kept = cons(lambda, kept);
+      mark = lowest < mark ? lowest : mark;
+    }
+  }
+  fs->escapes = kept;
+  fs->escape_mark = mark;
+}
+
+// drops the frames from base up, copying the ones a closure refers to into the heap first
+__attribute__((noinline)) void frames_drop(int base) {
+  FrameStack* fs = &TheInterp->frames;
+  if(fs->escape_mark >= base && fs->escape_mark < fs->top) {
+    frames_promote(base);
+  }
+  fs->slot_top = (int)(fs->cells[base].v_env.slots - fs->slots);
+  fs->top = base;
+}
+
+static inline void frames_pop(int base) {
+  if(TheInterp->frames.top != base) {
+    frames_drop(base);
+  }
+}
+
+__attribute__((noinline)) Obj* frames_drop_returning(int base, Obj* res) {
+  frames_drop(base);
+  return res;
+}
+
+// pops the frame of the eval at call depth depth, if it has one, and returns res.
+// an eval has at most one frame, on top, so this costs it no state beyond the depth
+// it keeps anyway, and eval can leave through it without a spill of its result.
+static inline Obj* frames_release(int depth, Obj* res) {
+  FrameStack* fs = &TheInterp->frames;
+  if(fs->top > 0 && fs->owners[fs->top - 1] == depth) {
+    return frames_drop_returning(fs->top - 1, res);
+  }
+  return res;
+}
+
+// a macro call site is displaced by putting one of these in place of its head,
+// it stays valid as long as no macro was (re)defined since the expansion.
+Obj* new_expansion(Obj* head, Obj* macro, Obj* expansion) {
+  Obj* obj = new_obj(T_EXPANSION);
+  obj->v_expansion.head = head;
+  obj->v_expansion.macro = macro;
+  obj->v_expansion.expansion = expansion;
+  obj->v_expansion.epoch = TheInterp->macro_epoch;
+  return obj;
+}
+
+Obj* new_code(Obj* body) {
+  Obj* obj = new_obj(T_CODE);
+  obj->v_code.body = body;
+  obj->v_code.bytecode = NULL;
+  obj->v_code.jit = NULL;
+  obj->v_code.jit_calls = 0;
+  obj->v_code.captures = 1;
+  return obj;
+}
+
+Obj* new_ref(Obj* symbol, int depth, int slot) {
+  Obj* obj = new_obj(T_REF);
+  obj->v_ref.symbol = symbol;
+  obj->v_ref.depth = depth;
+  obj->v_ref.slot = slot;
+  return obj;
+}
+
+const char* obj_type_to_str(ObjType type) {
+  switch(type) {
+    case T_NULL: return "NULL";
+    case T_BOOL: return "BOOL";
+    case T_INT: return "INT";
+    case T_FLOAT: return "FLOAT";
+    case T_STRING: return "STRING";
+    case T_SYMBOL: return "SYMBOL";
+    case T_CONS: return "CONS";
+    case T_BUILTIN: return "BUILTIN";
+    case T_LAMBDA: return "LAMBDA";
+    case T_MACRO: return "MACRO";
+    case T_ENV: return "ENV";
+    case T_REF: return "REF";
+    case T_EXPANSION: return "EXPANSION";
+    case T_CODE: return "CODE";
+    case T_VECTOR: return "VECTOR";
+    case T_F64VECTOR: return "F64VECTOR";
+    case T_I64VECTOR: return "I64VECTOR";
+    case T_HASHTABLE: return "HASHTABLE";
+    case T_FUTURE: return "FUTURE";
+    default: break;
+  }
+  return "UNKOWN_TYPE";
+}
+
+static inline void printer_write(Printer* printer, const char* s, size_t len) {
+  if(printer->fp != NULL) {
+    fwrite(s, 1, len, printer->fp);
+  } else {
+    strbuf_append(printer->buf, s, len);
+  }
+}
+
+static inline void printer_puts(Printer* printer, const char* s) {
+  printer_write(printer, s, strlen(s));
+}
+
+void printer_printf(Printer* printer, const char* format, ...) {
+  char str[256];
+  va_list ap;
+  va_start(ap, format);
+  int len = vsnprintf(str, sizeof(str), format, ap);
+  va_end(ap);
+  printer_write(printer, str, len < (int)sizeof(str) ? (size_t)len : sizeof(str) - 1);
+}
+
+void print_int(Printer* printer, int64_t val) {
+  char str[24];
+  char* ptr = str + sizeof(str);
+  uint64_t n = val < 0 ? -(uint64_t)val : (uint64_t)val;
+  do {
+    *--ptr = '0' + (char)(n % 10);
+    n /= 10;
+  } while(n != 0);
+  if(val < 0) {
+    *--ptr = '-';
+  }
+  printer_write(printer, ptr, str + sizeof(str) - ptr);
+}
+
+// lists are walked along their cdr chain in a loop, only the cars nest.
+// nesting beyond PRINT_MAX_DEPTH is elided as (...), the rest of a circular
+// list as ... once it comes round
+void print_obj_depth(Printer* printer, Obj* x, int depth) {
+  switch(type(x)) {
+    case T_NULL: printer_write(printer, "NIL", 3); break;
+    case T_BOOL: printer_write(printer, "T", 1); break;
+    case T_INT: print_int(printer, int_value(x)); break;
+    case T_FLOAT: printer_printf(printer, "%.16g", float_value(x)); break;
+    case T_STRING: printer_write(printer, string_chars(x), x->v_string.length); break;
+    case T_SYMBOL: printer_puts(printer, x->v_symbol); break;
+    case T_CONS: {
+      if(depth >= PRINT_MAX_DEPTH) {
+        printer_write(printer, "(...)", 5);
+        break;
+      }
+      printer_write(printer, "(", 1);
+      Obj* slow = x;
+      int count = 0;
+      for(Obj* p = x;;) {
+        print_obj_depth(printer, car(p), depth + 1);
+        p = cdr(p);
+        if(p == NilObj) {
+          break;
+        }
+        if(type(p) != T_CONS) {
+          printer_write(printer, " . ", 3);
+          print_obj_depth(printer, p, depth + 1);
+          break;
+        }
+        if(++count % 2 == 0 && (slow = cdr(slow)) == p) {
+          printer_write(printer, " ...", 4);
+          break;
+        }
+        printer_write(printer, " ", 1);
+      }
+      printer_write(printer, ")", 1);
+      break;
+    }
+    case T_VECTOR:
+    case T_F64VECTOR:
+    case T_I64VECTOR: {
+      printer_puts(printer, type(x) == T_F64VECTOR ? "#F64(" : type(x) == T_I64VECTOR ? "#I64(" : "#(");
+      if(depth >= PRINT_MAX_DEPTH && x->v_vector.length > 0) {
+        printer_write(printer, "...)", 4);
+        break;
+      }
+      for(size_t i = 0; i < x->v_vector.length; i++) {
+        if(i > 0) {
+          printer_write(printer, " ", 1);
+        }
+        if(type(x) == T_F64VECTOR) {
+          printer_printf(printer, "%.16g", x->v_vector.f64[i]);
+        } else if(type(x) == T_I64VECTOR) {
+          print_int(printer, x->v_vector.i64[i]);
+        } else {
+          print_obj_depth(printer, x->v_vector.items[i], depth + 1);
+        }
+      }
+      printer_write(printer, ")", 1);
+      break;
+    }
+    case T_HASHTABLE: {
+      printer_write(printer, "#HASH(", 6);
+      if(depth >= PRINT_MAX_DEPTH && x->v_hash.count > 0) {
+        printer_write(printer, "...)", 4);
+        break;
+      }
+      size_t pos = 0;
+      int first = 1;
+      for(HashEntry* e; (e = hash_next(x, &pos)) != NULL; first = 0) {
+        if(!first) {
+          printer_write(printer, " ", 1);
+        }
+        printer_write(printer, "(", 1);
+        print_obj_depth(printer, e->key, depth + 1);
+        printer_write(printer, " . ", 3);
+        print_obj_depth(printer, e->value, depth + 1);
+        printer_write(printer, ")", 1);
+      }
+      printer_write(printer, ")", 1);
+      break;
+    }
+    case T_BUILTIN: {
+      if(printer->source) {
+        printer_puts(printer, x->v_builtin.name->v_symbol);
+        break;
+      }
+      printer_printf(printer, "<BUILTIN %s(%d)>", x->v_builtin.name->v_symbol, x->v_builtin.paramc);
+      break;
+    }
+    case T_LAMBDA: {
+      if(x->v_lambda.name == NilObj) {
+        printer_printf(printer, "<LAMBDA <0X%" PRIXPTR ">(%d)>", (uintptr_t)x, x->v_lambda.paramc);
+      } else {
+        printer_printf(printer, "<LAMBDA %s(%d)>", x->v_lambda.name->v_symbol, x->v_lambda.paramc);
+      }
+      break;
+    }
+    case T_MACRO: {
+      printer_printf(printer, "<MACRO %s(%d)>", x->v_macro.name->v_symbol, x->v_macro.paramc);
+      break;
+    }
+    case T_FUTURE: printer_printf(printer, "<FUTURE <0X%" PRIXPTR ">>", (uintptr_t)x); break;
+    case T_REF: printer_puts(printer, x->v_ref.symbol->v_symbol); break;
+    case T_EXPANSION: print_obj_depth(printer, x->v_expansion.head, depth); break;
+    default: {
+      printer_printf(printer, "<%s 0x%p>", obj_type_to_str(type(x)), x);
+      break;
+    }
+  }
+}
+
+void print_obj(Printer* printer, Obj* x) {
+  print_obj_depth(printer, x, 0);
+}
+
+// the printed form of x for error messages, valid until the next call
+const char* obj_repr(Obj* x) {
+  StrBuf* buf = &TheInterp->repr;
+  Printer printer = { NULL, buf };
+  buf->length = 0;
+  strbuf_append(buf, "", 0);
+  print_obj(&printer, x);
+  return buf->data;
+}
+
+int peek_char(Parser* parser) {
+  if(parser->index < parser->length) {
+    return (unsigned char)parser->source[parser->index];
+  }
+  return EOF;
+}
+
+int next_char(Parser* parser) {
+  if(parser->index < parser->length) {
+    return (unsigned char)parser->source[parser->index++];
+  }
+  return EOF;
+}
+
+void skip_char(Parser* parser, int ch) {
+  int c = next_char(parser);
+  assert(c == ch);
+}
+
+void skip_whitespace(Parser* parser) {
+  while(isspace(peek_char(parser))) {
+    next_char(parser);
+  }
+}
+
+// skips whitespace and comments
+void skip_blank(Parser* parser) {
+  while(1) {
+    skip_whitespace(parser);
+    if(peek_char(parser) != ';') {
+      return;
+    }
+    while(peek_char(parser) != '\n' && peek_char(parser) != EOF) {
+      next_char(parser);
+    }
+  }
+}
+
+int parser_at_end(Parser* parser) {
+  skip_blank(parser);
+  int c = peek_char(parser);
+  return c == EOF || c == '\0';
+}
+
+void parser_init(Parser* parser, const char* filename, const char* source, size_t length) {
+  parser->filename = filename;
+  parser->source = source;
+  parser->index = 0;
+  parser->length = length;
+  parser->mapped = 0;
+}
+
+char* read_fd_to_text(int fd, size_t* length) {
+  size_t size = 0, capacity = 4096;
+  char* buf = (char*)malloc(capacity);
+  ssize_t n;
+  while((n = read(fd, buf + size, capacity - size)) > 0) {
+    size += n;
+    if(size == capacity) {
+      capacity *= 2;
+      buf = (char*)realloc(buf, capacity);
+    }
+  }
+  *length = size;
+  return buf;
+}
+
+// the file is mapped read-only and tokens are read in place, only the pages
+// of the form being read need to be resident. files that can't be mapped
+// (pipes, terminals) are read into memory instead.
+int parser_open(Parser* parser, const char* filename) {
+  int fd = open(filename, O_RDONLY);
+  if(fd < 0) {
+    return 0;
+  }
+  struct stat st;
+  if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+    parser_init(parser, filename, "", st.st_size);
+    if(st.st_size > 0) {
+      void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if(p != MAP_FAILED) {
+        madvise(p, st.st_size, MADV_SEQUENTIAL);
+        parser->source = (const char*)p;
+        parser->mapped = 1;
+      }
+    }
+    if(parser->mapped || st.st_size == 0) {
+      close(fd);
+      return 1;
+    }
+  }
+  size_t length;
+  char* source = read_fd_to_text(fd, &length);
+  close(fd);
+  if(length == 0) {
+    free(source);
+    source = "";
+  }
+  parser_init(parser, filename, source, length);
+  return 1;
+}
+
+void parser_close(Parser* parser) {
+  if(parser->mapped) {
+    munmap((void*)parser->source, parser->length);
+  } else if(parser->length > 0) {
+    free((void*)parser->source);
+  }
+}
+
+Obj* parse_quote(Parser* parser) {
+  skip_char(parser, '\'');
+  return cons(intern("quote"), cons(parse_obj(parser), NilObj));
+}
+
+Obj* parse_list(Parser* parser) {
+  skip_char(parser, '(');
+  skip_blank(parser);
+  if(peek_char(parser) == ')') {
+    next_char(parser);
+    return NilObj;
+  }
+  Obj *head, *tail;
+  head = tail = cons(parse_obj(parser), NilObj);
+  while(peek_char(parser) != ')') {
+    tail->v_cons.tail = cons(parse_obj(parser), NilObj);
+    tail = tail->v_cons.tail;
+    skip_blank(parser);
+  }
+  skip_char(parser, ')');
+  return head;
+}
+
+// strtod needs a terminated string, which a mapped source is not
+double parse_double(const char* s, size_t len) {
+  char small[64];
+  char* str = len < sizeof(small) ? small : (char*)malloc(len + 1);
+  memcpy(str, s, len);
+  str[len] = '\0';
+  double d = strtod(str, NULL);
+  if(str != small) {
+    free(str);
+  }
+  return d;
+}
+
+// digits are accumulated towards negative numbers so INT64_MIN can be read
+Obj* parse_number(Parser* parser) {
+  size_t start = parser->index;
+  int negative = peek_char(parser) == '-';
+  if(negative || peek_char(parser) == '+') {
+    next_char(parser);
+  }
+  int64_t n = 0;
+  int overflow = 0;
+  while(isdigit(peek_char(parser))) {
+    int d = next_char(parser) - '0';
+    overflow |= __builtin_mul_overflow(n, 10, &n) | __builtin_sub_overflow(n, d, &n);
+  }
+  if(!negative && !overflow) {
+    overflow = __builtin_mul_overflow(n, -1, &n);
+  }
+  if(peek_char(parser) != '.') {
+    if(overflow) {
+      throw_error(TheInterp->global_env, "ParserError: integer literal too large");
+    }
+    return new_int(n);
+  }
+  next_char(parser);
+  if(!isdigit(peek_char(parser))) {
+    throw_error(TheInterp->global_env, "ParserError: invalid number");
+  }
+  while(isdigit(peek_char(parser))) {
+    next_char(parser);
+  }
+  return new_float(parse_double(parser->source + start, parser->index - start));
+}
+
+Obj* parse_string(Parser* parser) {
+  skip_char(parser, '\"');
+  StrBuf buf = { NULL, 0, 0 };
+  while(peek_char(parser) != '\"') {
+    if(peek_char(parser) == EOF) {
+      free(buf.data);
+      throw_error(TheInterp->global_env, "ParserError: unterminated string");
+    }
+    char c = next_char(parser);
+    if(c == '\\') {
+      c = next_char(parser);
+      switch(c) {
+      case 'a':
+        c = '\a';
+        break;
+      case 'b':
+        c = '\b';
+        break;
+      case 'f':
+        c = '\f';
+        break;
+      case 'n':
+        c = '\n';
+        break;
+      case 't':
+        c = '\t';
+        break;
+      case 'r':
+        c = '\r';
+        break;
+      case 'v':
+        c = '\v';
+        break;
+      case '\\':
+        c = '\\';
+        break;
+      case '\"':
+        c = '\"';
+        break;
+      default: break;
+      }
+    }
+    strbuf_push(&buf, c);
+  }
+  skip_char(parser, '\"');
+  if(buf.data == NULL) {
+    return new_string("");
+  }
+  return new_string_owned(buf.data, buf.length);
+}
+
+Obj* parse_symbol(Parser* parser) {
+  size_t start = parser->index;
+  next_char(parser);
+  while(1) {
+    int c = peek_char(parser);
+    if(isalpha(c) || strchr("_+-*/=!@#$%^&<>", c) || isdigit(c)) {
+      next_char(parser);
+    } else {
+      break;
+    }
+  }
+  return intern_n(parser->source + start, parser->index - start);
+}
+
+int parser_looking_at(Parser* parser, const char* s) {
+  size_t len = strlen(s);
+  if(parser->length - parser->index < len) {
+    return 0;
+  }
+  for(size_t i = 0; i < len; i++) {
+    if(tolower((unsigned char)parser->source[parser->index + i]) != s[i]) return 0;
+  }
+  return 1;
+}
+
+// #(...) reads a vector, #f64(...) and #i64(...) unboxed ones,
+// the items are not evaluated. any other # starts a symbol.
+Obj* parse_vector(Parser* parser, ObjType type, size_t prefix) {
+  parser->index += prefix;
+  return list_to_vector(TheInterp->global_env, "read", type, parse_list(parser));
+}
+
+Obj* parse_obj(Parser* parser) {
+  skip_blank(parser);
+  int c = peek_char(parser);
+  if(c == EOF || c == '\0') {
+    throw_error(TheInterp->global_env, "ParserError: unexpected end of input");
+  }
+  if(c == '(') {
+    return parse_list(parser);
+  }
+  if(isdigit(c) || ((c == '-' || c == '+') && parser->index + 1 < parser->length && isdigit((unsigned char)parser->source[parser->index + 1]))) {
+    return parse_number(parser);
+  }
+  if(c == '\"') {
+    return parse_string(parser);
+  }
+  if(c == '\'') {
+    return parse_quote(parser);
+  }
+  if(c == '#') {
+    if(parser_looking_at(parser, "#(")) return parse_vector(parser, T_VECTOR, 1);
+    if(parser_looking_at(parser, "#f64(")) return parse_vector(parser, T_F64VECTOR, 4);
+    if(parser_looking_at(parser, "#i64(")) return parse_vector(parser, T_I64VECTOR, 4);
+  }
+  if(isalpha(c) || strchr("_+-*/=!@#$%^&<>", c)) {
+    return parse_symbol(parser);
+  }
+  throw_error(TheInterp->global_env, "ParserError: unprocessed character: %c", c);
+  return NilObj;
+}
+
+// symbols are case-insensitive, so the hash is computed over the upper-cased
+// name (FNV-1a) and stored on the symbol object.
+uint32_t symbol_hash(const char* s, size_t len) {
+  uint32_t hash = 2166136261u;
+  for(size_t i = 0; i < len; i++) {
+    hash ^= (uint32_t)toupper((unsigned char)s[i]);
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+int symbol_name_equals(Obj* symbol, const char* s, size_t len) {
+  const char* name = symbol->v_symbol;
+  for(size_t i = 0; i < len; i++) {
+    if(name[i] != toupper((unsigned char)s[i])) return 0;
+  }
+  return name[len] == '\0';
+}
+
+void init_symbol_table(SymbolTable* table, uint32_t capacity) {
+  table->slots = (Obj**)calloc(capacity, sizeof(Obj*));
+  table->capacity = capacity;
+  table->count = 0;
+}
+
+void grow_symbol_table(SymbolTable* table) {
+  Obj** old_slots = table->slots;
+  uint32_t old_capacity = table->capacity;
+  init_symbol_table(table, old_capacity * 2);
+  for(uint32_t i = 0; i < old_capacity; i++) {
+    Obj* symbol = old_slots[i];
+    if(symbol == NULL) continue;
+    uint32_t mask = table->capacity - 1;
+    uint32_t index = symbol->v_symbol_hash & mask;
+    while(table->slots[index] != NULL) {
+      index = (index + 1) & mask;
+    }
+    table->slots[index] = symbol;
+    table->count++;
+  }
+  free(old_slots);
+}
+
+// the slot holding the symbol named s, or the free slot it belongs in
+static inline uint32_t symbol_slot(SymbolTable* symbols, const char* s, size_t len, uint32_t hash) {
+  uint32_t mask = symbols->capacity - 1;
+  uint32_t index = hash & mask;
+  Obj* symbol;
+  while((symbol = symbols->slots[index]) != NULL) {
+    if(symbol->v_symbol_hash == hash && symbol_name_equals(symbol, s, len)) {
+      return index;
+    }
+    index = (index + 1) & mask;
+  }
+  return index;
+}
+
+// symbol goes into a free slot, see symbol_slot
+void add_symbol(SymbolTable* symbols, uint32_t index, Obj* symbol) {
+  symbols->slots[index] = symbol;
+  if(++symbols->count * 2 > symbols->capacity) {
+    grow_symbol_table(symbols);
+  }
+}
+
+Obj* intern_n(const char* s, size_t len) {
+  SymbolTable* symbols = &TheInterp->symbols;
+  STAT(TheInterp->stats.interns++);
+  uint32_t hash = symbol_hash(s, len);
+  uint32_t index = symbol_slot(symbols, s, len, hash);
+  Obj* symbol = symbols->slots[index];
+  if(symbol != NULL) {
+    return symbol;
+  }
+  symbol = new_symbol(s, len, hash);
+  STAT(TheInterp->stats.symbols_created++);
+  add_symbol(symbols, index, symbol);
+  return symbol;
+}
+
+Obj* intern(const char* s) {
+  return intern_n(s, strlen(s));
+}
+
+Obj* print(Obj* x) {
+  Printer printer = { stdout, NULL };
+  print_obj(&printer, x);
+  return NilObj;
+}
+
+Obj* progn(Obj* env, Obj* x) {
+  Obj* res = NilObj;
+  Obj* newEnv = new_env(env, NilObj);
+  for(Obj* p = x; p != NilObj; p = cdr(p)) {
+    res = eval(newEnv, car(p));
+  }
+  return res;
+}
+
+// evaluates all but the last form of a progn body, which is returned
+// so the caller can evaluate it in tail position.
+static inline Obj* progn_init(Obj* env, Obj* x) {
+  if(x == NilObj) {
+    return NilObj;
+  }
+  for(; cdr(x) != NilObj; x = cdr(x)) {
+    eval(env, car(x));
+  }
+  return car(x);
+}
+
+// the body runs right in the frame of the parameters, like seq
+Obj* macroexpand(Obj* env, Obj* macro, Obj* args) {
+  STAT(TheInterp->stats.macroexpands++);
+  Obj* frame = push_env(env, macro->v_macro.params, args, NilObj);
+  return eval(frame, progn_init(frame, macro->v_macro.body));
+}
+
+DEFINE_BUILTIN(print) {
+  Printer printer = { stdout, NULL };
+  for(int i = 0; i < argc; i++) {
+    print_obj(&printer, argv[i]);
+    printer_write(&printer, " ", 1);
+  }
+  return NilObj;
+}
+
+DEFINE_BUILTIN(println) {
+  builtin_print(env, argc, argv);
+  putchar('\n');
+  return NilObj;
+}
+
+DEFINE_BUILTIN(car) {
+  if(argv[0] == NilObj) return NilObj;
+  throw_error_assert(type(argv[0]) == T_CONS, env, "TypeError: car of type(%s)", obj_type_to_str(type(argv[0])));
+  return car(argv[0]);
+}
+
+DEFINE_BUILTIN(cdr) {
+  if(argv[0] == NilObj) return NilObj;
+  throw_error_assert(type(argv[0]) == T_CONS, env, "TypeError: cdr of type(%s)", obj_type_to_str(type(argv[0])));
+  return cdr(argv[0]);
+}
+
+DEFINE_BUILTIN(cons) {
+  return cons(argv[0], argv[1]);
+}
+
+DEFINE_SPECIAL(progn) {
+  return progn(env, x);
+}
+
+// a progn whose body can't add variables, the resolver emits it in place
+// of progn so the body runs in the enclosing env.
+DEFINE_SPECIAL(seq) {
+  return eval(env, progn_init(env, x));
+}
+
+// an anonymous lambda takes the name of the first variable it is bound to
+static inline void name_lambda(Obj* symbol, Obj* obj) {
+  if(type(obj) == T_LAMBDA && obj->v_lambda.name == NilObj) {
+    obj->v_lambda.name = type(symbol) == T_REF ? symbol->v_ref.symbol : symbol;
+  }
+}
+
+// whether assigning to target, which holds old, invalidates code expanded
+// against a macro or optimized against a builtin, NIL or T
+static inline int invalidates_code(Obj* target, Obj* old) {
+  Obj* symbol = type(target) == T_REF ? target->v_ref.symbol : target;
+  return type(old) == T_MACRO || (type(old) == T_BUILTIN && old->v_builtin.name == symbol)
+    || symbol == TheInterp->nil_symbol || symbol == TheInterp->t_symbol;
+}
+
+static inline void check_target(Obj* env, Obj* target) {
+  throw_error_assert(type(target) == T_SYMBOL || type(target) == T_REF, env, "can't set to type(%s)", obj_type_to_str(type(target)));
+}
+
+// stores obj in var, the variable target was found at, or adds target to env if there was none
+static void assign(Obj* env, Obj* target, Obj** var, Obj* obj) {
+  name_lambda(target, obj);
+  if(var != NULL) {
+    if(invalidates_code(target, *var)) {
+      TheInterp->macro_epoch++;
+    }
+    *var = obj;
+  } else {
+    add_var(env, type(target) == T_REF ? target->v_ref.symbol : target, obj);
+  }
+}
+
+DEFINE_SPECIAL(set) {
+  check_target(env, param1);
+  throw_error_assert(cdr(x) != NilObj, env, "can't set to too few arguments");
+  Obj** var = type(param1) == T_REF ? find_ref(env, param1) : find_var(env, param1);
+  assign(env, param1, var, eval(env, param2));
+  if(cdr(cdr(x)) != NilObj) {
+    builtin_set(env, cdr(cdr(x)));
+  }
+  return NilObj;
+}
+
+Obj* make_lambda(Obj* env, Obj* x) {
+  Obj* params = param1;
+  Obj* lambda = new_obj(T_LAMBDA);
+  lambda->v_lambda.rest = NilObj;
+  for(Obj* p = params; p != NilObj; p = cdr(p)) {
+    if(car(p) != intern("&rest")) {
+      continue;
+    }
+    if(cdr(p) == NilObj) {
+      throw_error(env, "invalid syntax: next param of &rest is null");
+    }
+    if(cdr(cdr(p)) != NilObj) {
+      throw_error(env, "invalid syntax: next param of &rest is not last param");
+    }
+    car(p) = car(cdr(p));
+    cdr(p) = NilObj;
+    lambda->v_lambda.rest = car(p);
+    break;
+  }
+  lambda->v_lambda.name = NilObj;
+  lambda->v_lambda.paramc = list_length(params);
+  lambda->v_lambda.params = params;
+  lambda->v_lambda.body = cdr(x);
+  lambda->v_lambda.code = NilObj;
+  lambda->v_lambda.env = env;
+  frames_capture(lambda);
+  return lambda;
+}
+
+// the body runs right in the parameter level, variables it adds with set
+// go to the frame of the call, see bind_frame().
+Obj* resolve_lambda(Scope* scope, Obj* lambda) {
+  Scope params = { scope, lambda->v_lambda.params };
+  Obj *head, *tail;
+  head = tail = NULL;
+  for(Obj* p = lambda->v_lambda.body; p != NilObj; p = cdr(p)) {
+    Obj* tmp = cons(resolve(&params, car(p)), NilObj);
+    if(head == NULL) {
+      head = tail = tmp;
+    } else {
+      tail->v_cons.tail = tmp;
+      tail = tmp;
+    }
+  }
+  lambda->v_lambda.code = new_code(head == NULL ? NilObj : head);
+  lambda->v_lambda.code->v_code.captures = may_capture(lambda->v_lambda.code->v_code.body);
+  return lambda;
+}
+
+DEFINE_SPECIAL(lambda) {
+  Obj* lambda = resolve_lambda(NULL, make_lambda(env, x));
+  if(TheInterp->optimize) {
+    optimize_lambda(lambda);
+  }
+  return lambda;
+}
+
+// instantiates a lambda resolved ahead of time by resolve(), x is (prototype)
+DEFINE_SPECIAL(closure) {
+  Obj* lambda = new_obj(T_LAMBDA);
+  lambda->v_lambda = param1->v_lambda;
+  lambda->v_lambda.env = env;
+  frames_capture(lambda);
+  return lambda;
+}
+
+DEFINE_SPECIAL(defmacro) {
+  Obj* macro = new_obj(T_MACRO);
+  macro->v_macro.name = param1;
+  macro->v_macro.params = param2;
+  macro->v_macro.paramc = list_length(param2);
+  macro->v_macro.body = cdr(cdr(x));
+  add_var(env, param1, macro);
+  TheInterp->macro_epoch++;
+  return macro;
+}
+
+DEFINE_BUILTIN(macroexpand) {
+  Obj* form = argv[0];
+  Obj** var = find_var(env, car(form));
+  throw_error_assert(var != NULL && type(*var) == T_MACRO, env, "macroexpand: %s is not a macro", car(form)->v_symbol);
+  return macroexpand(env, *var, cdr(form));
+}
+
+DEFINE_SPECIAL(quote) {
+  return car(x);
+}
+
+DEFINE_BUILTIN(typeof) {
+  return intern(obj_type_to_str(type(argv[0])));
+}
+
+static inline int is_number(Obj* x) {
+  return type(x) == T_INT || type(x) == T_FLOAT;
+}
+
+void throw_operand_error(Obj* env, const char* name, Obj* a, Obj* b) {
+  throw_error(env, "TypeError: unsupported operand type(s) for %s: '%s' and '%s'", name, obj_type_to_str(type(a)), obj_type_to_str(type(b)));
+}
+
+void check_min_args(Obj* env, const char* name, int argc, int min) {
+  throw_error_assert(argc >= min, env, "%s() takes at least %d arguments but %d were given", name, min, argc);
+}
+
+#define INT_CHECKED_OP(f, checked, name) \
+static inline Obj* int_##f(Obj* env, int64_t a, int64_t b) { \
+  int64_t res; \
+  if(checked(a, b, &res)) { \
+    throw_error(env, "OverflowError: integer overflow in %s", name); \
+  } \
+  return new_int(res); \
+}
+
+INT_CHECKED_OP(add, __builtin_add_overflow, "+")
+INT_CHECKED_OP(sub, __builtin_sub_overflow, "-")
+INT_CHECKED_OP(mul, __builtin_mul_overflow, "*")
+
+static inline Obj* int_div(Obj* env, int64_t a, int64_t b) {
+  throw_error_assert(b != 0, env, "ZeroDivisionError: division by zero");
+  throw_error_assert(a != INT64_MIN || b != -1, env, "OverflowError: integer overflow in /");
+  return new_int(a / b);
+}
+
+// the kernels of an operator for each pair of numeric operand types,
+// indexed by [type(a) == T_FLOAT][type(b) == T_FLOAT]. mixed operands are
+// computed as floats.
+#define ARITH_KERNELS(f, op) \
+static Obj* f##_ii(Obj* env, Obj* a, Obj* b) { return int_##f(env, int_value(a), int_value(b)); } \
+static Obj* f##_if(Obj* env, Obj* a, Obj* b) { return new_float((double)int_value(a) op float_value(b)); } \
+static Obj* f##_fi(Obj* env, Obj* a, Obj* b) { return new_float(float_value(a) op (double)int_value(b)); } \
+static Obj* f##_ff(Obj* env, Obj* a, Obj* b) { return new_float(float_value(a) op float_value(b)); } \
+static const NumKernel f##_kernels[2][2] = { { f##_ii, f##_if }, { f##_fi, f##_ff } };
+
+#define COMPARE_KERNELS(f, op) \
+static int f##_ii(Obj* a, Obj* b) { return int_value(a) op int_value(b); } \
+static int f##_if(Obj* a, Obj* b) { return (double)int_value(a) op float_value(b); } \
+static int f##_fi(Obj* a, Obj* b) { return float_value(a) op (double)int_value(b); } \
+static int f##_ff(Obj* a, Obj* b) { return float_value(a) op float_value(b); } \
+static const CmpKernel f##_kernels[2][2] = { { f##_ii, f##_if }, { f##_fi, f##_ff } };
+
+ARITH_KERNELS(add, +)
+ARITH_KERNELS(sub, -)
+ARITH_KERNELS(mul, *)
+ARITH_KERNELS(div, /)
+COMPARE_KERNELS(eq, ==)
+COMPARE_KERNELS(neq, !=)
+COMPARE_KERNELS(gt, >)
+COMPARE_KERNELS(gte, >=)
+COMPARE_KERNELS(lt, <)
+COMPARE_KERNELS(lte, <=)
+
+#define NUM_KERNEL(kernels, a, b) kernels[type(a) == T_FLOAT][type(b) == T_FLOAT]
+
+// a op b for two values, two fixnums never leave the inline fast path
+#define ARITH_OP(f, name) \
+static inline Obj* arith_##f(Obj* env, Obj* a, Obj* b) { \
+  if(is_fixnum(a) && is_fixnum(b)) return int_##f(env, fixnum_value(a), fixnum_value(b)); \
+  if(!is_number(a) || !is_number(b)) throw_operand_error(env, name, a, b); \
+  return NUM_KERNEL(f##_kernels, a, b)(env, a, b); \
+}
+
+static inline Obj* arith_add(Obj* env, Obj* a, Obj* b) {
+  if(is_fixnum(a) && is_fixnum(b)) return int_add(env, fixnum_value(a), fixnum_value(b));
+  if(type(a) == T_STRING && type(b) == T_STRING) return string_concat(a, b);
+  if(!is_number(a) || !is_number(b)) throw_operand_error(env, "+", a, b);
+  return NUM_KERNEL(add_kernels, a, b)(env, a, b);
+}
+
+ARITH_OP(sub, "-")
+ARITH_OP(mul, "*")
+ARITH_OP(div, "/")
+
+// == and != on anything but two numbers
+static inline int equal_other(Obj* env, const char* name, Obj* a, Obj* b) {
+  if(a == b || a == NilObj || b == NilObj) return a == b;
+  if(type(a) == T_STRING && type(b) == T_STRING) return string_equals(a, b);
+  if(type(a) == T_SYMBOL && type(b) == T_SYMBOL) return 0;
+  if(is_vector(a) && is_vector(b)) return vector_equals(env, a, b);
+  if(type(a) == T_HASHTABLE && type(b) == T_HASHTABLE) return 0;
+  throw_operand_error(env, name, a, b);
+  return 0;
+}
+
+static inline int compare_eq(Obj* env, Obj* a, Obj* b) {
+  if(is_fixnum(a) && is_fixnum(b)) return a == b;
+  if(is_number(a) && is_number(b)) return NUM_KERNEL(eq_kernels, a, b)(a, b);
+  return equal_other(env, "==", a, b);
+}
+
+static inline int compare_neq(Obj* env, Obj* a, Obj* b) {
+  if(is_fixnum(a) && is_fixnum(b)) return a != b;
+  if(is_number(a) && is_number(b)) return NUM_KERNEL(neq_kernels, a, b)(a, b);
+  return !equal_other(env, "!=", a, b);
+}
+
+#define COMPARE_OP(f, op, name) \
+static inline int compare_##f(Obj* env, Obj* a, Obj* b) { \
+  if(is_fixnum(a) && is_fixnum(b)) return (intptr_t)a op (intptr_t)b; \
+  if(!is_number(a) || !is_number(b)) throw_operand_error(env, name, a, b); \
+  return NUM_KERNEL(f##_kernels, a, b)(a, b); \
+}
+
+COMPARE_OP(gt, >, ">")
+COMPARE_OP(gte, >=, ">=")
+COMPARE_OP(lt, <, "<")
+COMPARE_OP(lte, <=, "<=")
+
+// (+ a b c) folds left, (+) and (*) give their identity,
+// (- a) negates and (/ a) is (/ 1 a)
+#define ARITH_BUILTIN(f, identity, min, name) \
+DEFINE_BUILTIN(f) { \
+  check_min_args(env, name, argc, min); \
+  if(argc == 0) return new_int(identity); \
+  if(argc == 1) return arith_##f(env, new_int(identity), argv[0]); \
+  Obj* res = argv[0]; \
+  for(int i = 1; i < argc; i++) { \
+    res = arith_##f(env, res, argv[i]); \
+  } \
+  return res; \
+}
+
+ARITH_BUILTIN(add, 0, 0, "+")
+ARITH_BUILTIN(sub, 0, 1, "-")
+ARITH_BUILTIN(mul, 1, 0, "*")
+ARITH_BUILTIN(div, 1, 1, "/")
+
+// (< a b c) holds if every adjacent pair does, like a < b && b < c
+#define COMPARE_BUILTIN(f, name) \
+DEFINE_BUILTIN(f) { \
+  check_min_args(env, name, argc, 1); \
+  for(int i = 1; i < argc; i++) { \
+    if(!compare_##f(env, argv[i - 1], argv[i])) return NilObj; \
+  } \
+  return TrueObj; \
+}
+
+COMPARE_BUILTIN(eq, "==")
+COMPARE_BUILTIN(neq, "!=")
+COMPARE_BUILTIN(gt, ">")
+COMPARE_BUILTIN(gte, ">=")
+COMPARE_BUILTIN(lt, "<")
+COMPARE_BUILTIN(lte, "<=")
+
+DEFINE_SPECIAL(cond) {
+  for(Obj* p = x; p != NilObj; p = cdr(p)) {
+    Obj* item = car(p);
+    Obj* cond = eval(env, car(item));
+    if(cond != NilObj) {
+      return eval(env, car(cdr(item)));
+    }
+  }
+  return NilObj;
+}
+
+DEFINE_SPECIAL(while) {
+  while(eval(env, car(x)) != NilObj) {
+    eval(env, car(cdr(x)));
+  }
+  return NilObj;
+}
+
+// if, and, or, ++, --, for, swap and defun used to be macros of lib.lisp,
+// which still has them for a build with TOYLISP_NO_NATIVE_FORMS. they keep
+// the semantics of the macros, except that and and or take any number of
+// arguments and swap needs no global.
+
+// eval_loop runs the branch taken in tail position
+DEFINE_SPECIAL(if) {
+  return eval(env, eval(env, car(x)) != NilObj ? car(cdr(x)) : car(cdr(cdr(x))));
+}
+
+// T unless an argument is NIL, the ones after it aren't evaluated
+DEFINE_SPECIAL(and) {
+  for(Obj* p = x; p != NilObj; p = cdr(p)) {
+    if(eval(env, car(p)) == NilObj) {
+      return NilObj;
+    }
+  }
+  return TrueObj;
+}
+
+// T once an argument isn't NIL, the ones after it aren't evaluated
+DEFINE_SPECIAL(or) {
+  for(Obj* p = x; p != NilObj; p = cdr(p)) {
+    if(eval(env, car(p)) != NilObj) {
+      return TrueObj;
+    }
+  }
+  return NilObj;
+}
+
+static Obj** find_target(Obj* env, Obj* target) {
+  check_target(env, target);
+  Obj** var = type(target) == T_REF ? find_ref(env, target) : find_var(env, target);
+  if(var == NULL) {
+    throw_error(env, "can't find symbol: %s", (type(target) == T_REF ? target->v_ref.symbol : target)->v_symbol);
+  }
+  return var;
+}
+
+// (++ i) adds 1 to the variable i where it lives and gives the new value
+DEFINE_SPECIAL(inc) {
+  Obj** var = find_target(env, param1);
+  Obj* obj = arith_add(env, *var, new_int(1));
+  assign(env, param1, var, obj);
+  return obj;
+}
+
+DEFINE_SPECIAL(dec) {
+  Obj** var = find_target(env, param1);
+  Obj* obj = arith_sub(env, *var, new_int(1));
+  assign(env, param1, var, obj);
+  return obj;
+}
+
+// (for init test step body) runs in a level of its own, and body and step
+// in a new one each time round, like the progns of the macro did. resolve()
+// turns it into that loop.
+DEFINE_SPECIAL(for) {
+  env = new_env(env, NilObj);
+  eval(env, car(x));
+  while(eval(env, car(cdr(x))) != NilObj) {
+    Obj* level = new_env(env, NilObj);
+    eval(level, car(cdr(cdr(cdr(x)))));
+    eval(level, car(cdr(cdr(x))));
+  }
+  return NilObj;
+}
+
+DEFINE_SPECIAL(swap) {
+  Obj** a = find_target(env, param1);
+  Obj** b = find_target(env, param2);
+  Obj* tmp = *a;
+  assign(env, param1, a, *b);
+  assign(env, param2, b, tmp);
+  return NilObj;
+}
+
+// (defun name params body) is (set name (lambda params body))
+DEFINE_SPECIAL(defun) {
+  check_target(env, param1);
+  Obj** var = type(param1) == T_REF ? find_ref(env, param1) : find_var(env, param1);
+  assign(env, param1, var, builtin_lambda(env, cdr(x)));
+  return NilObj;
+}
+
+// (isbound 'x) whether x names a variable where it's called
+DEFINE_BUILTIN(isbound) {
+  throw_error_assert(type(argv[0]) == T_SYMBOL, env, "TypeError: isbound() expects a symbol, got type(%s)", obj_type_to_str(type(argv[0])));
+  return find_var(env, argv[0]) != NULL ? TrueObj : NilObj;
+}
+
+DEFINE_BUILTIN(pool_stats) {
+  PoolStats stats = TheInterp->pool.stats;
+  Obj* res = NilObj;
+  res = acons(intern("chunks"), new_int((int64_t)stats.chunks), res);
+  res = acons(intern("bytes-live"), new_int((int64_t)stats.bytes_live), res);
+  res = acons(intern("bytes-allocated"), new_int((int64_t)stats.bytes_allocated), res);
+  res = acons(intern("frees"), new_int((int64_t)stats.frees), res);
+  res = acons(intern("allocs"), new_int((int64_t)stats.allocs), res);
+  return res;
+}
+
+DEFINE_BUILTIN(gc) {
+  gc_collect();
+  return new_int((int64_t)TheInterp->heap.stats.bytes_live);
+}
+
+DEFINE_BUILTIN(gc_stats) {
+  GcStats stats = TheInterp->heap.stats;
+  Obj* res = NilObj;
+  res = acons(intern("bytes-live"), new_int((int64_t)stats.bytes_live), res);
+  res = acons(intern("objects-live"), new_int((int64_t)stats.objects_live), res);
+  res = acons(intern("objects-freed"), new_int((int64_t)stats.objects_freed), res);
+  res = acons(intern("pause-us-max"), new_int((int64_t)(stats.pause_ns_max / 1000)), res);
+  res = acons(intern("pause-us-total"), new_int((int64_t)(stats.pause_ns_total / 1000)), res);
+  res = acons(intern("collections"), new_int((int64_t)stats.collections), res);
+  return res;
+}
+
+// one line the bench driver can parse: allocation counts and peak RSS for the whole run
+void print_gc_stats() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  fprintf(stderr, "gc: %" PRIu64 " allocs, %" PRIu64 " bytes allocated, %" PRIu64 " collections, %" PRIu64 " us paused, %ld KB peak rss\n",
+    TheInterp->pool.stats.allocs, TheInterp->pool.stats.bytes_allocated, TheInterp->heap.stats.collections,
+    TheInterp->heap.stats.pause_ns_total / 1000, usage.ru_maxrss);
+}
+
+#ifdef TOYLISP_NO_STATS
+void print_runtime_stats(FILE* fp) {
+  fprintf(fp, "runtime stats: disabled (built with TOYLISP_NO_STATS)\n");
+}
+
+// NIL when the counters are compiled out
+DEFINE_BUILTIN(runtime_stats) {
+  return NilObj;
+}
+#else
+static const char* const CallKindNames[CALL_KIND_COUNT] = { "BUILTIN", "SPECIAL", "LAMBDA" };
+
+static void print_counts(FILE* fp, const char* label, uint64_t total, const uint64_t* counts, int n, const char* (*name)(int)) {
+  fprintf(fp, "  %-13s%12" PRIu64 " ", label, total);
+  const char* sep = " (";
+  for(int i = 0; i < n; i++) {
+    if(counts[i] != 0) {
+      fprintf(fp, "%s%s %" PRIu64, sep, name(i), counts[i]);
+      sep = ", ";
+    }
+  }
+  fprintf(fp, "%s\n", sep[0] == ',' ? ")" : "");
+}
+
+static const char* type_name(int i) {
+  return obj_type_to_str((ObjType)i);
+}
+
+static const char* call_kind_name(int i) {
+  return CallKindNames[i];
+}
+
+static uint64_t sum_counts(const uint64_t* counts, int n) {
+  uint64_t total = 0;
+  for(int i = 0; i < n; i++) {
+    total += counts[i];
+  }
+  return total;
+}
+
+void print_runtime_stats(FILE* fp) {
+  RuntimeStats stats = TheInterp->stats;
+  uint64_t allocs = sum_counts(stats.allocs, OBJ_TYPE_COUNT);
+  fprintf(fp, "runtime stats:\n");
+  print_counts(fp, "evals", sum_counts(stats.evals, OBJ_TYPE_COUNT), stats.evals, OBJ_TYPE_COUNT, type_name);
+  print_counts(fp, "calls", sum_counts(stats.calls, CALL_KIND_COUNT), stats.calls, CALL_KIND_COUNT, call_kind_name);
+  fprintf(fp, "  %-13s%12" PRIu64 "\n", "macroexpands", stats.macroexpands);
+  print_counts(fp, "allocs", allocs, stats.allocs, OBJ_TYPE_COUNT, type_name);
+  fprintf(fp, "  %-13s%12" PRIu64 "  (%" PRIu64 " in objects, %" PRIu64 " in payloads)\n", "bytes",
+    allocs * sizeof(Obj) + stats.external_bytes, allocs * sizeof(Obj), stats.external_bytes);
+  fprintf(fp, "  %-13s%12" PRIu64 "  (%" PRIu64 " misses, %.2f environments walked on average)\n", "lookups",
+    stats.lookups, stats.lookup_misses, stats.lookups ? (double)stats.lookup_depth / (double)stats.lookups : 0.0);
+  fprintf(fp, "  %-13s%12" PRIu64 "  (%" PRIu64 " new symbols)\n", "interns", stats.interns, stats.symbols_created);
+  fprintf(fp, "  %-13s%12" PRIu64 "  (%" PRIu64 " fixnums, %" PRIu64 " boxed)\n", "ints",
+    stats.fixnums + stats.boxed_ints, stats.fixnums, stats.boxed_ints);
+  fprintf(fp, "  %-13s%12" PRIu64 "  (%" PRIu64 " flonums, %" PRIu64 " boxed)\n", "floats",
+    stats.flonums + stats.boxed_floats, stats.flonums, stats.boxed_floats);
+  fprintf(fp, "  %-13s%12" PRIu64 "  (%" PRIu64 " lambdas compiled, %" PRIu64 " bailed out)\n", "jit calls",
+    stats.jit_calls, stats.jit_compiled, stats.jit_bails);
+  uint64_t frames = stats.stack_frames + stats.heap_frames;
+  fprintf(fp, "  %-13s%12" PRIu64 "  (%.2f%% on the frame stack, %" PRIu64 " moved to the heap for a closure)\n", "frames",
+    frames, frames ? 100.0 * (double)stats.stack_frames / (double)frames : 0.0, stats.promoted_frames);
+}
+
+Obj* counts_alist(const uint64_t* counts, int n, const char* (*name)(int)) {
+  Obj* res = NilObj;
+  for(int i = n - 1; i >= 0; i--) {
+    if(counts[i] != 0) {
+      res = acons(intern(name(i)), new_int((int64_t)counts[i]), res);
+    }
+  }
+  return res;
+}
+
+DEFINE_BUILTIN(runtime_stats) {
+  RuntimeStats stats = TheInterp->stats;
+  uint64_t allocs = sum_counts(stats.allocs, OBJ_TYPE_COUNT);
+  uint64_t frames = stats.stack_frames + stats.heap_frames;
+  Obj* res = NilObj;
+  res = acons(intern("promoted-frames"), new_int((int64_t)stats.promoted_frames), res);
+  res = acons(intern("stack-frames-pct"), new_float(frames ? 100.0 * (double)stats.stack_frames / (double)frames : 0.0), res);
+  res = acons(intern("stack-frames"), new_int((int64_t)stats.stack_frames), res);
+  res = acons(intern("frames"), new_int((int64_t)frames), res);
+  res = acons(intern("jit-bails"), new_int((int64_t)stats.jit_bails), res);
+  res = acons(intern("jit-compiled"), new_int((int64_t)stats.jit_compiled), res);
+  res = acons(intern("jit-calls"), new_int((int64_t)stats.jit_calls), res);
+  res = acons(intern("boxed-floats"), new_int((int64_t)stats.boxed_floats), res);
+  res = acons(intern("flonums"), new_int((int64_t)stats.flonums), res);
+  res = acons(intern("boxed-ints"), new_int((int64_t)stats.boxed_ints), res);
+  res = acons(intern("fixnums"), new_int((int64_t)stats.fixnums), res);
+  res = acons(intern("symbols-created"), new_int((int64_t)stats.symbols_created), res);
+  res = acons(intern("interns"), new_int((int64_t)stats.interns), res);
+  res = acons(intern("lookup-depth-avg"), new_float(stats.lookups ? (double)stats.lookup_depth / (double)stats.lookups : 0.0), res);
+  res = acons(intern("lookup-misses"), new_int((int64_t)stats.lookup_misses), res);
+  res = acons(intern("lookups"), new_int((int64_t)stats.lookups), res);
+  res = acons(intern("bytes-allocated"), new_int((int64_t)(allocs * sizeof(Obj) + stats.external_bytes)), res);
+  res = acons(intern("allocs"), counts_alist(stats.allocs, OBJ_TYPE_COUNT, type_name), res);
+  res = acons(intern("macroexpands"), new_int((int64_t)stats.macroexpands), res);
+  res = acons(intern("calls"), counts_alist(stats.calls, CALL_KIND_COUNT, call_kind_name), res);
+  res = acons(intern("evals"), counts_alist(stats.evals, OBJ_TYPE_COUNT, type_name), res);
+  return res;
+}
+#endif
+
+void check_string(Obj* env, const char* name, Obj* x) {
+  throw_error_assert(type(x) == T_STRING, env, "TypeError: %s() expects a string, got type(%s)", name, obj_type_to_str(type(x)));
+}
+
+DEFINE_BUILTIN(string_length) {
+  check_string(env, "string-length", argv[0]);
+  return new_int((int64_t)argv[0]->v_string.length);
+}
+
+// (substring s start) or (substring s start end), end is exclusive
+DEFINE_BUILTIN(substring) {
+  throw_error_assert(argc == 2 || argc == 3, env, "substring() takes 2 or 3 arguments but %d were given", argc);
+  check_string(env, "substring", argv[0]);
+  int64_t length = (int64_t)argv[0]->v_string.length;
+  throw_error_assert(type(argv[1]) == T_INT && (argc == 2 || type(argv[2]) == T_INT), env, "TypeError: substring() indexes must be integers");
+  int64_t start = int_value(argv[1]);
+  int64_t end = argc == 3 ? int_value(argv[2]) : length;
+  throw_error_assert(start >= 0 && start <= end && end <= length, env,
+  "IndexError: substring(%" PRId64 ", %" PRId64 ") out of range for length %" PRId64, start, end, length);
+  return new_string_n(string_chars(argv[0]) + start, (size_t)(end - start));
+}
+
+// (string-join list) or (string-join list separator)
+DEFINE_BUILTIN(string_join) {
+  throw_error_assert(argc == 1 || argc == 2, env, "string-join() takes 1 or 2 arguments but %d were given", argc);
+  Obj* sep = argc == 2 ? argv[1] : NULL;
+  if(sep != NULL) {
+    check_string(env, "string-join", sep);
+  }
+  throw_error_assert(list_length(argv[0]) >= 0, env, "TypeError: string-join() expects a list");
+  StrBuf buf = { NULL, 0, 0 };
+  for(Obj* p = argv[0]; p != NilObj; p = cdr(p)) {
+    if(type(car(p)) != T_STRING) {
+      free(buf.data);
+      check_string(env, "string-join", car(p));
+    }
+    if(sep != NULL && p != argv[0]) {
+      strbuf_append(&buf, string_chars(sep), sep->v_string.length);
+    }
+    strbuf_append(&buf, string_chars(car(p)), car(p)->v_string.length);
+  }
+  if(buf.data == NULL) {
+    return new_string("");
+  }
+  return new_string_owned(buf.data, buf.length);
+}
+
+// the kernels are instantiated for AVX (4 lanes), SSE2 (2 lanes, always there
+// on x86-64) and plain C (1 lane), vector_init picks the widest the cpu has.
+// the lanes keep partial sums, so a float sum may round differently than a
+// left fold and an integer sum checks the partial sums for overflow.
+// x86 has no packed 64 bit multiply or min before AVX-512, those integer
+// kernels are scalar only.
+#define F64_KERNELS(isa, target, V, W, load, store, set1, add, mul, min, max) \
+target static double f64_sum_##isa(const double* a, size_t n) { \
+  V acc = set1(0.0); \
+  size_t i = 0; \
+  for(; i + W <= n; i += W) acc = add(acc, load(a + i)); \
+  double lanes[W], res = 0.0; \
+  store(lanes, acc); \
+  for(int k = 0; k < W; k++) res += lanes[k]; \
+  for(; i < n; i++) res += a[i]; \
+  return res; \
+} \
+target static double f64_dot_##isa(const double* a, const double* b, size_t n) { \
+  V acc = set1(0.0); \
+  size_t i = 0; \
+  for(; i + W <= n; i += W) acc = add(acc, mul(load(a + i), load(b + i))); \
+  double lanes[W], res = 0.0; \
+  store(lanes, acc); \
+  for(int k = 0; k < W; k++) res += lanes[k]; \
+  for(; i < n; i++) res += a[i] * b[i]; \
+  return res; \
+} \
+target static void f64_add_##isa(double* out, const double* a, const double* b, size_t n) { \
+  size_t i = 0; \
+  for(; i + W <= n; i += W) store(out + i, add(load(a + i), load(b + i))); \
+  for(; i < n; i++) out[i] = a[i] + b[i]; \
+} \
+target static void f64_scale_##isa(double* out, const double* a, double k, size_t n) { \
+  V kv = set1(k); \
+  size_t i = 0; \
+  for(; i + W <= n; i += W) store(out + i, mul(load(a + i), kv)); \
+  for(; i < n; i++) out[i] = a[i] * k; \
+} \
+target static double f64_min_##isa(const double* a, size_t n) { \
+  V acc = set1(a[0]); \
+  size_t i = 0; \
+  for(; i + W <= n; i += W) acc = min(acc, load(a + i)); \
+  double lanes[W], res = a[0]; \
+  store(lanes, acc); \
+  for(int k = 0; k < W; k++) res = res < lanes[k] ? res : lanes[k]; \
+  for(; i < n; i++) res = res < a[i] ? res : a[i]; \
+  return res; \
+} \
+target static double f64_max_##isa(const double* a, size_t n) { \
+  V acc = set1(a[0]); \
+  size_t i = 0; \
+  for(; i + W <= n; i += W) acc = max(acc, load(a + i)); \
+  double lanes[W], res = a[0]; \
+  store(lanes, acc); \
+  for(int k = 0; k < W; k++) res = res > lanes[k] ? res : lanes[k]; \
+  for(; i < n; i++) res = res > a[i] ? res : a[i]; \
+  return res; \
+}
+
+// a lane overflowed if the sum has the opposite sign of both operands
+#define I64_KERNELS(isa, target, V, W, load, store, set1, add, vxor, vand, vor, any_sign) \
+target static int i64_sum_##isa(const int64_t* a, size_t n, int64_t* res) { \
+  V acc = set1(0), ovf = set1(0); \
+  size_t i = 0; \
+  for(; i + W <= n; i += W) { \
+    V x = load(a + i), sum = add(acc, x); \
+    ovf = vor(ovf, vand(vxor(sum, acc), vxor(sum, x))); \
+    acc = sum; \
+  } \
+  if(any_sign(ovf)) return 0; \
+  int64_t lanes[W], total = 0; \
+  store(lanes, acc); \
+  for(int k = 0; k < W; k++) { \
+    if(__builtin_add_overflow(total, lanes[k], &total)) return 0; \
+  } \
+  for(; i < n; i++) { \
+    if(__builtin_add_overflow(total, a[i], &total)) return 0; \
+  } \
+  *res = total; \
+  return 1; \
+} \
+target static int i64_add_##isa(int64_t* out, const int64_t* a, const int64_t* b, size_t n) { \
+  V ovf = set1(0); \
+  size_t i = 0; \
+  for(; i + W <= n; i += W) { \
+    V x = load(a + i), y = load(b + i), sum = add(x, y); \
+    ovf = vor(ovf, vand(vxor(sum, x), vxor(sum, y))); \
+    store(out + i, sum); \
+  } \
+  if(any_sign(ovf)) return 0; \
+  for(; i < n; i++) { \
+    if(__builtin_add_overflow(a[i], b[i], &out[i])) return 0; \
+  } \
+  return 1; \
+}
+
+#define SCALAR_LOAD(p) (*(p))
+#define SCALAR_STORE(p, v) (*(p) = (v))
+#define SCALAR_SET1(x) (x)
+#define SCALAR_ADD(a, b) ((a) + (b))
+#define SCALAR_MUL(a, b) ((a) * (b))
+#define SCALAR_MIN(a, b) ((a) < (b) ? (a) : (b))
+#define SCALAR_MAX(a, b) ((a) > (b) ? (a) : (b))
+#define SCALAR_LOAD_I64(p) ((uint64_t)*(p))
+#define SCALAR_STORE_I64(p, v) (*(p) = (int64_t)(v))
+#define SCALAR_XOR(a, b) ((a) ^ (b))
+#define SCALAR_AND(a, b) ((a) & (b))
+#define SCALAR_OR(a, b) ((a) | (b))
+#define SCALAR_SIGN(v) ((v) >> 63)
+
+F64_KERNELS(scalar, , double, 1, SCALAR_LOAD, SCALAR_STORE, SCALAR_SET1, SCALAR_ADD, SCALAR_MUL, SCALAR_MIN, SCALAR_MAX)
+I64_KERNELS(scalar, , uint64_t, 1, SCALAR_LOAD_I64, SCALAR_STORE_I64, SCALAR_SET1, SCALAR_ADD, SCALAR_XOR, SCALAR_AND, SCALAR_OR, SCALAR_SIGN)
+
+#define F64_KERNEL_TABLE(isa) f64_sum_##isa, f64_dot_##isa, f64_add_##isa, f64_scale_##isa, f64_min_##isa, f64_max_##isa
+#define I64_KERNEL_TABLE(isa) i64_sum_##isa, i64_add_##isa
+
+static VecKernels Vec = { F64_KERNEL_TABLE(scalar), I64_KERNEL_TABLE(scalar) };
+
+#if defined(__x86_64__) && !defined(TOYLISP_NO_SIMD)
+#define SSE_LOAD_I64(p) _mm_loadu_si128((const __m128i*)(p))
+#define SSE_STORE_I64(p, v) _mm_storeu_si128((__m128i*)(p), v)
+#define SSE_SIGN(v) _mm_movemask_pd(_mm_castsi128_pd(v))
+#define AVX_LOAD_I64(p) _mm256_loadu_si256((const __m256i*)(p))
+#define AVX_STORE_I64(p, v) _mm256_storeu_si256((__m256i*)(p), v)
+#define AVX_SIGN(v) _mm256_movemask_pd(_mm256_castsi256_pd(v))
+
+F64_KERNELS(sse2, , __m128d, 2, _mm_loadu_pd, _mm_storeu_pd, _mm_set1_pd, _mm_add_pd, _mm_mul_pd, _mm_min_pd, _mm_max_pd)
+F64_KERNELS(avx, __attribute__((target("avx"))), __m256d, 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_set1_pd,
+  _mm256_add_pd, _mm256_mul_pd, _mm256_min_pd, _mm256_max_pd)
+I64_KERNELS(sse2, , __m128i, 2, SSE_LOAD_I64, SSE_STORE_I64, _mm_set1_epi64x, _mm_add_epi64,
+  _mm_xor_si128, _mm_and_si128, _mm_or_si128, SSE_SIGN)
+I64_KERNELS(avx2, __attribute__((target("avx2"))), __m256i, 4, AVX_LOAD_I64, AVX_STORE_I64, _mm256_set1_epi64x, _mm256_add_epi64,
+  _mm256_xor_si256, _mm256_and_si256, _mm256_or_si256, AVX_SIGN)
+#endif
+
+void vector_init() {
+#if defined(__x86_64__) && !defined(TOYLISP_NO_SIMD)
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2")) {
+    Vec = (VecKernels){ F64_KERNEL_TABLE(avx), I64_KERNEL_TABLE(avx2) };
+  } else if(__builtin_cpu_supports("avx")) {
+    Vec = (VecKernels){ F64_KERNEL_TABLE(avx), I64_KERNEL_TABLE(sse2) };
+  } else {
+    Vec = (VecKernels){ F64_KERNEL_TABLE(sse2), I64_KERNEL_TABLE(sse2) };
+  }
+#endif
+}
+
+int i64_dot(const int64_t* a, const int64_t* b, size_t n, int64_t* res) {
+  int64_t total = 0, prod;
+  for(size_t i = 0; i < n; i++) {
+    if(__builtin_mul_overflow(a[i], b[i], &prod) || __builtin_add_overflow(total, prod, &total)) return 0;
+  }
+  *res = total;
+  return 1;
+}
+
+int i64_scale(int64_t* out, const int64_t* a, int64_t k, size_t n) {
+  for(size_t i = 0; i < n; i++) {
+    if(__builtin_mul_overflow(a[i], k, &out[i])) return 0;
+  }
+  return 1;
+}
+
+int64_t i64_min(const int64_t* a, size_t n) {
+  int64_t res = a[0];
+  for(size_t i = 1; i < n; i++) {
+    res = a[i] < res ? a[i] : res;
+  }
+  return res;
+}
+
+int64_t i64_max(const int64_t* a, size_t n) {
+  int64_t res = a[0];
+  for(size_t i = 1; i < n; i++) {
+    res = a[i] > res ? a[i] : res;
+  }
+  return res;
+}
+
+// the items are allocated first so a failed allocation leaves no object behind
+Obj* new_vector(ObjType type, size_t length) {
+  Obj** items = length <= SIZE_MAX / sizeof(Obj*) ? (Obj**)calloc(length ? length : 1, sizeof(Obj*)) : NULL;
+  if(items == NULL) {
+    throw_error(TheInterp->global_env, "MemoryError: can't allocate a vector of length %zu", length);
+  }
+  Obj* obj = new_obj(type);
+  obj->v_vector.items = items;
+  obj->v_vector.length = length;
+  if(type == T_VECTOR) {
+    for(size_t i = 0; i < length; i++) {
+      items[i] = NilObj;
+    }
+  }
+  gc_external_alloc(sizeof(Obj*) * length);
+  return obj;
+}
+
+void check_vector(Obj* env, const char* name, Obj* x) {
+  throw_error_assert(is_vector(x), env, "TypeError: %s() expects a vector, got type(%s)", name, obj_type_to_str(type(x)));
+}
+
+size_t check_index(Obj* env, const char* name, Obj* v, Obj* index) {
+  throw_error_assert(type(index) == T_INT, env, "TypeError: %s() index must be an integer", name);
+  int64_t i = int_value(index);
+  throw_error_assert(i >= 0 && (uint64_t)i < v->v_vector.length, env,
+  "IndexError: %s(%" PRId64 ") out of range for length %zu", name, i, v->v_vector.length);
+  return (size_t)i;
+}
+
+void check_same_length(Obj* env, const char* name, Obj* a, Obj* b) {
+  throw_error_assert(a->v_vector.length == b->v_vector.length, env,
+  "ValueError: %s() expects vectors of the same length, got %zu and %zu", name, a->v_vector.length, b->v_vector.length);
+}
+
+static inline Obj* vector_ref(Obj* v, size_t i) {
+  switch(type(v)) {
+    case T_F64VECTOR: return new_float(v->v_vector.f64[i]);
+    case T_I64VECTOR: return new_int(v->v_vector.i64[i]);
+    default: return v->v_vector.items[i];
+  }
+}
+
+// unboxed vectors only take numbers of their kind, except that
+// an integer stored into an F64VECTOR is converted
+void vector_set(Obj* env, const char* name, Obj* v, size_t i, Obj* x) {
+  switch(type(v)) {
+    case T_F64VECTOR: {
+      throw_error_assert(is_number(x), env, "TypeError: %s() expects a number for an F64VECTOR, got type(%s)", name, obj_type_to_str(type(x)));
+      v->v_vector.f64[i] = type(x) == T_INT ? (double)int_value(x) : float_value(x);
+      break;
+    }
+    case T_I64VECTOR: {
+      throw_error_assert(type(x) == T_INT, env, "TypeError: %s() expects an integer for an I64VECTOR, got type(%s)", name, obj_type_to_str(type(x)));
+      v->v_vector.i64[i] = int_value(x);
+      break;
+    }
+    default: v->v_vector.items[i] = x; break;
+  }
+}
+
+Obj* list_to_vector(Obj* env, const char* name, ObjType type, Obj* list) {
+  int length = list_length(list);
+  throw_error_assert(length >= 0, env, "TypeError: %s() expects a list", name);
+  Obj* v = new_vector(type, (size_t)length);
+  size_t i = 0;
+  for(Obj* p = list; p != NilObj; p = cdr(p)) {
+    vector_set(env, name, v, i++, car(p));
+  }
+  return v;
+}
+
+Obj* args_to_vector(Obj* env, const char* name, ObjType type, int argc, Obj** argv) {
+  Obj* v = new_vector(type, (size_t)argc);
+  for(int i = 0; i < argc; i++) {
+    vector_set(env, name, v, i, argv[i]);
+  }
+  return v;
+}
+
+// (make-vector n) or (make-vector n fill), items default to NIL or 0
+Obj* make_vector(Obj* env, const char* name, ObjType type, int argc, Obj** argv) {
+  throw_error_assert(argc == 1 || argc == 2, env, "%s() takes 1 or 2 arguments but %d were given", name, argc);
+  throw_error_assert(type(argv[0]) == T_INT && int_value(argv[0]) >= 0, env, "TypeError: %s() expects a non-negative integer length", name);
+  Obj* v = new_vector(type, (size_t)int_value(argv[0]));
+  if(argc == 2) {
+    for(size_t i = 0; i < v->v_vector.length; i++) {
+      vector_set(env, name, v, i, argv[1]);
+    }
+  }
+  return v;
+}
+
+// vectors are equal if they have the same type and equal items
+int vector_equals(Obj* env, Obj* a, Obj* b) {
+  if(type(a) != type(b) || a->v_vector.length != b->v_vector.length) return 0;
+  for(size_t i = 0; i < a->v_vector.length; i++) {
+    switch(type(a)) {
+      case T_F64VECTOR: if(a->v_vector.f64[i] != b->v_vector.f64[i]) return 0; break;
+      case T_I64VECTOR: if(a->v_vector.i64[i] != b->v_vector.i64[i]) return 0; break;
+      default: if(!compare_eq(env, a->v_vector.items[i], b->v_vector.items[i])) return 0; break;
+    }
+  }
+  return 1;
+}
+
+DEFINE_BUILTIN(vector) {
+  return args_to_vector(env, "vector", T_VECTOR, argc, argv);
+}
+
+DEFINE_BUILTIN(f64vector) {
+  return args_to_vector(env, "f64vector", T_F64VECTOR, argc, argv);
+}
+
+DEFINE_BUILTIN(i64vector) {
+  return args_to_vector(env, "i64vector", T_I64VECTOR, argc, argv);
+}
+
+DEFINE_BUILTIN(make_vector) {
+  return make_vector(env, "make-vector", T_VECTOR, argc, argv);
+}
+
+DEFINE_BUILTIN(make_f64vector) {
+  return make_vector(env, "make-f64vector", T_F64VECTOR, argc, argv);
+}
+
+DEFINE_BUILTIN(make_i64vector) {
+  return make_vector(env, "make-i64vector", T_I64VECTOR, argc, argv);
+}
+
+DEFINE_BUILTIN(vector_length) {
+  check_vector(env, "vector-length", argv[0]);
+  return new_int((int64_t)argv[0]->v_vector.length);
+}
+
+DEFINE_BUILTIN(vector_ref) {
+  check_vector(env, "vector-ref", argv[0]);
+  return vector_ref(argv[0], check_index(env, "vector-ref", argv[0], argv[1]));
+}
+
+DEFINE_BUILTIN(vector_set) {
+  check_vector(env, "vector-set!", argv[0]);
+  vector_set(env, "vector-set!", argv[0], check_index(env, "vector-set!", argv[0], argv[1]), argv[2]);
+  return argv[2];
+}
+
+DEFINE_BUILTIN(vector_to_list) {
+  check_vector(env, "vector->list", argv[0]);
+  Obj* res = NilObj;
+  for(size_t i = argv[0]->v_vector.length; i > 0; i--) {
+    res = cons(vector_ref(argv[0], i - 1), res);
+  }
+  return res;
+}
+
+DEFINE_BUILTIN(list_to_vector) {
+  return list_to_vector(env, "list->vector", T_VECTOR, argv[0]);
+}
+
+// the bulk operations run a kernel when the vectors are unboxed and of the
+// same type, anything else is folded item by item with the generic arithmetic.
+DEFINE_BUILTIN(vsum) {
+  Obj* v = argv[0];
+  check_vector(env, "vsum", v);
+  size_t n = v->v_vector.length;
+  if(type(v) == T_F64VECTOR) return new_float(Vec.f64_sum(v->v_vector.f64, n));
+  if(type(v) == T_I64VECTOR) {
+    int64_t sum = 0;
+    throw_error_assert(Vec.i64_sum(v->v_vector.i64, n, &sum), env, "OverflowError: integer overflow in %s", "vsum");
+    return new_int(sum);
+  }
+  Obj* res = new_int(0);
+  for(size_t i = 0; i < n; i++) {
+    res = arith_add(env, res, v->v_vector.items[i]);
+  }
+  return res;
+}
+
+DEFINE_BUILTIN(vdot) {
+  Obj *a = argv[0], *b = argv[1];
+  check_vector(env, "vdot", a);
+  check_vector(env, "vdot", b);
+  check_same_length(env, "vdot", a, b);
+  size_t n = a->v_vector.length;
+  if(type(a) == T_F64VECTOR && type(b) == T_F64VECTOR) return new_float(Vec.f64_dot(a->v_vector.f64, b->v_vector.f64, n));
+  if(type(a) == T_I64VECTOR && type(b) == T_I64VECTOR) {
+    int64_t sum = 0;
+    throw_error_assert(i64_dot(a->v_vector.i64, b->v_vector.i64, n, &sum), env, "OverflowError: integer overflow in %s", "vdot");
+    return new_int(sum);
+  }
+  Obj* res = new_int(0);
+  for(size_t i = 0; i < n; i++) {
+    res = arith_add(env, res, arith_mul(env, vector_ref(a, i), vector_ref(b, i)));
+  }
+  return res;
+}
+
+DEFINE_BUILTIN(vmap_add) {
+  Obj *a = argv[0], *b = argv[1];
+  check_vector(env, "vmap+", a);
+  check_vector(env, "vmap+", b);
+  check_same_length(env, "vmap+", a, b);
+  size_t n = a->v_vector.length;
+  if(type(a) == type(b) && type(a) != T_VECTOR) {
+    Obj* res = new_vector(type(a), n);
+    if(type(a) == T_F64VECTOR) {
+      Vec.f64_add(res->v_vector.f64, a->v_vector.f64, b->v_vector.f64, n);
+    } else {
+      throw_error_assert(Vec.i64_add(res->v_vector.i64, a->v_vector.i64, b->v_vector.i64, n), env, "OverflowError: integer overflow in %s", "vmap+");
+    }
+    return res;
+  }
+  Obj* res = new_vector(T_VECTOR, n);
+  for(size_t i = 0; i < n; i++) {
+    res->v_vector.items[i] = arith_add(env, vector_ref(a, i), vector_ref(b, i));
+  }
+  return res;
+}
+
+DEFINE_BUILTIN(vscale) {
+  Obj *v = argv[0], *k = argv[1];
+  check_vector(env, "vscale", v);
+  size_t n = v->v_vector.length;
+  if(type(v) == T_F64VECTOR && is_number(k)) {
+    Obj* res = new_vector(T_F64VECTOR, n);
+    Vec.f64_scale(res->v_vector.f64, v->v_vector.f64, type(k) == T_INT ? (double)int_value(k) : float_value(k), n);
+    return res;
+  }
+  if(type(v) == T_I64VECTOR && type(k) == T_INT) {
+    Obj* res = new_vector(T_I64VECTOR, n);
+    throw_error_assert(i64_scale(res->v_vector.i64, v->v_vector.i64, int_value(k), n), env, "OverflowError: integer overflow in %s", "vscale");
+    return res;
+  }
+  Obj* res = new_vector(T_VECTOR, n);
+  for(size_t i = 0; i < n; i++) {
+    res->v_vector.items[i] = arith_mul(env, vector_ref(v, i), k);
+  }
+  return res;
+}
+
+#define VECTOR_EXTREMUM(f, compare, name) \
+DEFINE_BUILTIN(v##f) { \
+  Obj* v = argv[0]; \
+  check_vector(env, name, v); \
+  size_t n = v->v_vector.length; \
+  throw_error_assert(n > 0, env, "ValueError: %s() of an empty vector", name); \
+  if(type(v) == T_F64VECTOR) return new_float(Vec.f64_##f(v->v_vector.f64, n)); \
+  if(type(v) == T_I64VECTOR) return new_int(i64_##f(v->v_vector.i64, n)); \
+  Obj* res = v->v_vector.items[0]; \
+  for(size_t i = 1; i < n; i++) { \
+    if(compare(env, v->v_vector.items[i], res)) res = v->v_vector.items[i]; \
+  } \
+  return res; \
+}
+
+VECTOR_EXTREMUM(min, compare_lt, "vmin")
+VECTOR_EXTREMUM(max, compare_gt, "vmax")
+
+// keys are equal if they have the same type and value: strings by content,
+// numbers by value with 1 and 1.0 distinct, anything else by identity
+static inline uint32_t hash_mix(uint64_t x) {
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdull;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ull;
+  x ^= x >> 33;
+  return (uint32_t)x;
+}
+
+static inline uint64_t float_key_bits(Obj* x) {
+  double d = float_value(x);
+  uint64_t bits;
+  if(d == 0.0) {
+    d = 0.0;
+  }
+  memcpy(&bits, &d, sizeof(bits));
+  return bits;
+}
+
+uint32_t hash_key(Obj* x) {
+  switch(type(x)) {
+    case T_INT: return hash_mix((uint64_t)int_value(x));
+    case T_FLOAT: return hash_mix(float_key_bits(x));
+    case T_STRING: return string_hash_of(x);
+    case T_SYMBOL: return x->v_symbol_hash;
+    default: return hash_mix((uintptr_t)x);
+  }
+}
+
+static inline int hash_key_equals(Obj* a, Obj* b) {
+  if(a == b) return 1;
+  if(type(a) != type(b)) return 0;
+  switch(type(a)) {
+    case T_INT: return int_value(a) == int_value(b);
+    case T_FLOAT: return float_key_bits(a) == float_key_bits(b);
+    case T_STRING: return string_equals(a, b);
+    default: return 0;
+  }
+}
+
+// the entry holding key, NULL if there is none
+HashEntry* hash_probe(HashEntry* entries, size_t capacity, Obj* key, uint32_t hash) {
+  size_t mask = capacity - 1;
+  for(size_t i = hash & mask;; i = (i + 1) & mask) {
+    HashEntry* e = &entries[i];
+    if(e->key == NULL) {
+      if(e->value == NULL) return NULL;
+      continue;
+    }
+    if(e->hash == hash && hash_key_equals(e->key, key)) return e;
+  }
+}
+
+// key must not be in entries yet
+void hash_insert_new(Obj* h, Obj* key, Obj* value, uint32_t hash) {
+  size_t mask = h->v_hash.capacity - 1;
+  for(size_t i = hash & mask;; i = (i + 1) & mask) {
+    HashEntry* e = &h->v_hash.entries[i];
+    if(e->key == NULL) {
+      if(e->value == NULL) {
+        h->v_hash.used++;
+      }
+      e->key = key;
+      e->value = value;
+      e->hash = hash;
+      return;
+    }
+  }
+}
+
+// moves up to steps slots of old_entries over, a moved slot becomes a tombstone
+// so lookups in the old array still probe past it
+void hash_migrate(Obj* h, size_t steps) {
+  while(h->v_hash.old_entries != NULL && steps-- > 0) {
+    HashEntry* e = &h->v_hash.old_entries[h->v_hash.old_index++];
+    if(e->key != NULL) {
+      h->v_hash.used--;
+      hash_insert_new(h, e->key, e->value, e->hash);
+      e->key = NULL;
+      e->value = NilObj;
+    }
+    if(h->v_hash.old_index == h->v_hash.old_capacity) {
+      TheInterp->heap.external_bytes -= sizeof(HashEntry) * h->v_hash.old_capacity;
+      free(h->v_hash.old_entries);
+      h->v_hash.old_entries = NULL;
+      h->v_hash.old_capacity = 0;
+      h->v_hash.old_index = 0;
+    }
+  }
+}
+
+// the smallest capacity that holds twice count keys below the 3/4 load factor
+size_t hash_capacity_for(size_t count) {
+  size_t capacity = HASH_MIN_CAPACITY;
+  while(capacity * 3 < (count + 1) * 8) {
+    capacity *= 2;
+  }
+  return capacity;
+}
+
+// a resize still in progress is finished first, so there is only ever one old array
+void hash_grow(Obj* h) {
+  hash_migrate(h, SIZE_MAX);
+  size_t capacity = hash_capacity_for(h->v_hash.count);
+  HashEntry* entries = (HashEntry*)calloc(capacity, sizeof(HashEntry));
+  if(entries == NULL) {
+    throw_error(TheInterp->global_env, "MemoryError: can't grow a hash table to %zu entries", capacity);
+  }
+  h->v_hash.old_entries = h->v_hash.entries;
+  h->v_hash.old_capacity = h->v_hash.capacity;
+  h->v_hash.old_index = 0;
+  h->v_hash.entries = entries;
+  h->v_hash.capacity = capacity;
+  h->v_hash.used = h->v_hash.count;
+  gc_external_alloc(sizeof(HashEntry) * capacity);
+}
+
+Obj* new_hash(size_t count) {
+  size_t capacity = hash_capacity_for(count);
+  HashEntry* entries = (HashEntry*)calloc(capacity, sizeof(HashEntry));
+  if(entries == NULL) {
+    throw_error(TheInterp->global_env, "MemoryError: can't allocate a hash table of %zu entries", capacity);
+  }
+  Obj* obj = new_obj(T_HASHTABLE);
+  obj->v_hash.entries = entries;
+  obj->v_hash.old_entries = NULL;
+  obj->v_hash.capacity = capacity;
+  obj->v_hash.old_capacity = 0;
+  obj->v_hash.old_index = 0;
+  obj->v_hash.count = 0;
+  obj->v_hash.used = 0;
+  gc_external_alloc(sizeof(HashEntry) * capacity);
+  return obj;
+}
+
+static inline int hash_in_old(Obj* h, HashEntry* e) {
+  return h->v_hash.old_entries != NULL && e >= h->v_hash.old_entries && e < h->v_hash.old_entries + h->v_hash.old_capacity;
+}
+
+HashEntry* hash_find(Obj* h, Obj* key, uint32_t hash) {
+  HashEntry* e = hash_probe(h->v_hash.entries, h->v_hash.capacity, key, hash);
+  if(e == NULL && h->v_hash.old_entries != NULL) {
+    e = hash_probe(h->v_hash.old_entries, h->v_hash.old_capacity, key, hash);
+  }
+  return e;
+}
+
+Obj* hash_get(Obj* h, Obj* key, Obj* missing) {
+  hash_migrate(h, HASH_MIGRATE_STEP);
+  HashEntry* e = hash_find(h, key, hash_key(key));
+  return e != NULL ? e->value : missing;
+}
+
+// a key still in the old array is moved over as it is set
+void hash_set(Obj* h, Obj* key, Obj* value) {
+  hash_migrate(h, HASH_MIGRATE_STEP);
+  uint32_t hash = hash_key(key);
+  HashEntry* e = hash_probe(h->v_hash.entries, h->v_hash.capacity, key, hash);
+  if(e != NULL) {
+    e->value = value;
+    return;
+  }
+  if(h->v_hash.old_entries != NULL) {
+    e = hash_probe(h->v_hash.old_entries, h->v_hash.old_capacity, key, hash);
+    if(e != NULL) {
+      e->key = NULL;
+      e->value = NilObj;
+      h->v_hash.count--;
+      h->v_hash.used--;
+    }
+  }
+  if((h->v_hash.used + 1) * 4 > h->v_hash.capacity * 3) {
+    hash_grow(h);
+  }
+  hash_insert_new(h, key, value, hash);
+  h->v_hash.count++;
+}
+
+int hash_del(Obj* h, Obj* key) {
+  hash_migrate(h, HASH_MIGRATE_STEP);
+  HashEntry* e = hash_find(h, key, hash_key(key));
+  if(e == NULL) return 0;
+  if(hash_in_old(h, e)) {
+    h->v_hash.used--;
+  }
+  e->key = NULL;
+  e->value = NilObj;
+  h->v_hash.count--;
+  return 1;
+}
+
+// walks the live entries of the old array, then of the new one.
+// pos starts at 0, returns NULL once every entry was seen
+HashEntry* hash_next(Obj* h, size_t* pos) {
+  size_t old_capacity = h->v_hash.old_entries != NULL ? h->v_hash.old_capacity : 0;
+  while(*pos < old_capacity + h->v_hash.capacity) {
+    size_t i = (*pos)++;
+    HashEntry* e = i < old_capacity ? &h->v_hash.old_entries[i] : &h->v_hash.entries[i - old_capacity];
+    if(e->key != NULL) return e;
+  }
+  return NULL;
+}
+
+void check_hash(Obj* env, const char* name, Obj* x) {
+  throw_error_assert(type(x) == T_HASHTABLE, env, "TypeError: %s() expects a hash table, got type(%s)", name, obj_type_to_str(type(x)));
+}
+
+// (make-hash) or (make-hash n) to size it for n keys up front
+DEFINE_BUILTIN(make_hash) {
+  throw_error_assert(argc <= 1, env, "make-hash() takes 0 or 1 arguments but %d were given", argc);
+  if(argc == 0) {
+    return new_hash(0);
+  }
+  throw_error_assert(type(argv[0]) == T_INT && int_value(argv[0]) >= 0, env, "TypeError: make-hash() expects a non-negative integer size");
+  return new_hash((size_t)int_value(argv[0]));
+}
+
+// (hash-get h key) or (hash-get h key default), default is NIL
+DEFINE_BUILTIN(hash_get) {
+  throw_error_assert(argc == 2 || argc == 3, env, "hash-get() takes 2 or 3 arguments but %d were given", argc);
+  check_hash(env, "hash-get", argv[0]);
+  return hash_get(argv[0], argv[1], argc == 3 ? argv[2] : NilObj);
+}
+
+DEFINE_BUILTIN(hash_set) {
+  check_hash(env, "hash-set!", argv[0]);
+  hash_set(argv[0], argv[1], argv[2]);
+  return argv[2];
+}
+
+DEFINE_BUILTIN(hash_del) {
+  check_hash(env, "hash-del!", argv[0]);
+  return TO_BOOL_OBJ(hash_del(argv[0], argv[1]));
+}
+
+DEFINE_BUILTIN(hash_keys) {
+  check_hash(env, "hash-keys", argv[0]);
+  Obj* res = NilObj;
+  size_t pos = 0;
+  for(HashEntry* e; (e = hash_next(argv[0], &pos)) != NULL;) {
+    res = cons(e->key, res);
+  }
+  return res;
+}
+
+DEFINE_BUILTIN(hash_count) {
+  check_hash(env, "hash-count", argv[0]);
+  return new_int((int64_t)argv[0]->v_hash.count);
+}
+
+// a copy of the conses of code x, quoted data is shared. evaluating code
+// displaces its macro call sites (see expand_call_site), which must not
+// rewrite a list the program still holds as data.
+static Obj* copy_code(Obj* x) {
+  if(type(x) != T_CONS || car(x) == intern("quote")) {
+    return x;
+  }
+  Obj* res = cons(copy_code(car(x)), NilObj);
+  Obj* last = res;
+  Obj* p = cdr(x);
+  for(; type(p) == T_CONS; p = cdr(p)) {
+    cdr(last) = cons(copy_code(car(p)), NilObj);
+    last = cdr(last);
+  }
+  cdr(last) = p;
+  return res;
+}
+
+DEFINE_BUILTIN(eval) {
+  if(type(argv[0]) == T_STRING) {
+    return run_string(env, string_chars(argv[0]), argv[0]->v_string.length);
+  }
+  return eval(env, copy_code(argv[0]));
+}
+
+// globals live in the value cell of the symbol itself,
+// other environments keep their dynamically added variables in an alist.
+void add_var(Obj* env, Obj* symbol, Obj* obj) {
+  if(env == TheInterp->global_env) {
+    symbol->v_global = obj;
+    return;
+  }
+  env->v_env.vars = acons(symbol, obj, env->v_env.vars);
+}
+
+static inline Obj** find_local_var(Obj* env, Obj* symbol) {
+  for(Obj* p = env->v_env.vars; p != NilObj; p = cdr(p)) {
+    if(car(car(p)) == symbol) {
+      return &cdr(car(p));
+    }
+  }
+  return NULL;
+}
+
+Obj** find_var(Obj* env, Obj* symbol) {
+  STAT(TheInterp->stats.lookups++);
+  for(Obj* e = env; e != TheInterp->global_env && e != NilObj; e = e->v_env.up) {
+    STAT(TheInterp->stats.lookup_depth++);
+    Obj** var = find_local_var(e, symbol);
+    if(var != NULL) {
+      return var;
+    }
+    int i = 0;
+    for(Obj* p = e->v_env.names; p != NilObj; p = cdr(p), ++i) {
+      if(car(p) == symbol) {
+        return &e->v_env.slots[i];
+      }
+    }
+  }
+  if(symbol->v_global == NULL) {
+    STAT(TheInterp->stats.lookup_misses++);
+    return NULL;
+  }
+  return &symbol->v_global;
+}
+
+// a ref with slot >= 0 addresses a parameter depth levels up.
+// a free ref (slot -1) is known not to name a parameter in its first depth levels,
+// only the variables added there by set have to be checked before searching by name.
+Obj** find_ref(Obj* env, Obj* ref) {
+  int depth = ref->v_ref.depth;
+  if(ref->v_ref.slot >= 0) {
+    while(depth-- > 0) {
+      env = env->v_env.up;
+    }
+    return &env->v_env.slots[ref->v_ref.slot];
+  }
+  Obj* symbol = ref->v_ref.symbol;
+  while(depth-- > 0) {
+    if(env->v_env.vars != NilObj) {
+      Obj** var = find_local_var(env, symbol);
+      if(var != NULL) {
+        return var;
+      }
+    }
+    env = env->v_env.up;
+  }
+  return find_var(env, symbol);
+}
+
+static inline __attribute__((always_inline)) int is_builtin(Obj* obj, Builtin ptr) {
+  return type(obj) == T_BUILTIN && obj->v_builtin.ep && obj->v_builtin.ptr == ptr;
+}
+
+static inline __attribute__((always_inline)) int is_special(Obj* obj, Special special) {
+  return type(obj) == T_BUILTIN && !obj->v_builtin.ep && obj->v_builtin.special == special;
+}
+
+// the head of a form names a builtin or macro only if it isn't a parameter,
+// the optimizer puts a builtin it bound in place of the head
+Obj* compile_time_binding(Obj* head) {
+  if(type(head) == T_BUILTIN) {
+    return head;
+  }
+  if(type(head) == T_REF && head->v_ref.slot < 0) {
+    head = head->v_ref.symbol;
+  }
+  if(type(head) == T_SYMBOL && head->v_global != NULL) {
+    return head->v_global;
+  }
+  return NULL;
+}
+
+// whether evaluating the resolved form x may add a variable to the env it runs in.
+// nested lambdas and progns with a level of their own add to their own envs.
+int may_define(Obj* x) {
+  if(type(x) != T_CONS) {
+    return 0;
+  }
+  Obj* head = car(x);
+  if(type(head) == T_EXPANSION) {
+    return may_define(head->v_expansion.expansion);
+  }
+  if(head == TheInterp->closure_builtin) {
+    return 0;
+  }
+  Obj* fn = compile_time_binding(head);
+  if(fn != NULL && type(fn) == T_MACRO) {
+    return 1;
+  }
+  if(fn != NULL && type(fn) == T_BUILTIN) {
+    if(is_special(fn, builtin_quote) || is_special(fn, builtin_progn)) {
+      return 0;
+    }
+    if(is_special(fn, builtin_defmacro) || is_builtin(fn, builtin_eval)) {
+      return 1;
+    }
+    if(is_special(fn, builtin_set)) {
+      for(Obj* p = cdr(x); type(p) == T_CONS; p = cdr(p)) {
+        if(type(car(p)) != T_REF || car(p)->v_ref.slot < 0) {
+          return 1;
+        }
+        p = cdr(p);
+        if(type(p) != T_CONS) {
+          break;
+        }
+        if(may_define(car(p))) {
+          return 1;
+        }
+      }
+      return 0;
+    }
+  }
+  for(Obj* p = x; type(p) == T_CONS; p = cdr(p)) {
+    if(may_define(car(p))) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// whether evaluating the resolved form x may close over the env it runs in:
+// it makes a lambda or evaluates code it is given. a macro expanded at run time
+// may still do either, see frames_capture().
+int may_capture(Obj* x) {
+  if(type(x) != T_CONS) {
+    return 0;
+  }
+  Obj* head = car(x);
+  if(type(head) == T_EXPANSION) {
+    return may_capture(head->v_expansion.expansion);
+  }
+  if(head == TheInterp->closure_builtin) {
+    return 1;
+  }
+  Obj* fn = compile_time_binding(head);
+  if(fn != NULL && type(fn) == T_BUILTIN) {
+    if(is_special(fn, builtin_quote)) {
+      return 0;
+    }
+    if(is_special(fn, builtin_lambda) || is_special(fn, builtin_defun) || is_builtin(fn, builtin_eval)) {
+      return 1;
+    }
+  }
+  for(Obj* p = x; type(p) == T_CONS; p = cdr(p)) {
+    if(may_capture(car(p))) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// x was resolved inside a progn level that is dropped afterwards, k counts the
+// levels entered since. refs reaching past the dropped level get one level shorter.
+void unnest_refs(Obj* x, int k) {
+  if(type(x) == T_REF) {
+    if(x->v_ref.depth > k) {
+      x->v_ref.depth--;
+    }
+    return;
+  }
+  if(type(x) != T_CONS) {
+    return;
+  }
+  Obj* head = car(x);
+  if(type(head) == T_EXPANSION) {
+    unnest_refs(head->v_expansion.expansion, k);
+    return;
+  }
+  if(head == TheInterp->closure_builtin) {
+    unnest_refs(car(cdr(x))->v_lambda.code->v_code.body, k + 1);
+    return;
+  }
+  Obj* fn = compile_time_binding(head);
+  if(fn != NULL && is_special(fn, builtin_progn)) {
+    unnest_refs(head, k);
+    k++;
+    x = cdr(x);
+  }
+  for(Obj* p = x; type(p) == T_CONS; p = cdr(p)) {
+    unnest_refs(car(p), k);
+  }
+}
+
+Obj* resolve_list(Scope* scope, Obj* x) {
+  if(type(x) != T_CONS) {
+    return x;
+  }
+  return cons(resolve(scope, car(x)), resolve_list(scope, cdr(x)));
+}
+
+Obj* resolve_symbol(Scope* scope, Obj* symbol) {
+  int depth = 0;
+  for(Scope* s = scope; s != NULL; s = s->up, ++depth) {
+    int slot = 0;
+    for(Obj* p = s->names; p != NilObj; p = cdr(p), ++slot) {
+      if(car(p) == symbol) {
+        return new_ref(symbol, depth, slot);
+      }
+    }
+  }
+  return new_ref(symbol, depth, -1);
+}
+
+// rewrites the variable references of a lambda body into (depth, slot) addresses.
+// macros are expanded with their current definition, special forms are
+// resolved by their own rules and unknown special forms are left untouched.
+Obj* resolve(Scope* scope, Obj* x) {
+  if(type(x) == T_SYMBOL) {
+    return resolve_symbol(scope, x);
+  }
+  if(type(x) != T_CONS) {
+    return x;
+  }
+  Obj* head = car(x);
+  Obj* fn = NULL;
+  if(type(head) == T_SYMBOL && head->v_global != NULL) {
+    Obj* ref = resolve_symbol(scope, head);
+    if(ref->v_ref.slot < 0) {
+      fn = head->v_global;
+    }
+  }
+  if(fn == NULL || list_length(x) < 0) {
+    return resolve_list(scope, x);
+  }
+  if(type(fn) == T_MACRO) {
+    if(fn->v_macro.paramc != list_length(cdr(x))) {
+      return x;
+    }
+    Obj* expansion = resolve(scope, macroexpand(TheInterp->global_env, fn, cdr(x)));
+    TheInterp->macro_cache.misses++;
+    return cons(new_expansion(head, fn, expansion), cdr(x));
+  }
+  if(type(fn) != T_BUILTIN || fn->v_builtin.ep) {
+    return resolve_list(scope, x);
+  }
+  if(is_special(fn, builtin_lambda)) {
+    if(list_length(x) < 2) {
+      return x;
+    }
+    Obj* lambda = resolve_lambda(scope, make_lambda(NilObj, cdr(x)));
+    return cons(TheInterp->closure_builtin, cons(lambda, NilObj));
+  }
+  if(is_special(fn, builtin_progn)) {
+    Scope inner = { scope, NilObj };
+    Obj* body = resolve_list(&inner, cdr(x));
+    if(may_define(body)) {
+      return cons(resolve_symbol(scope, head), body);
+    }
+    unnest_refs(body, 0);
+    return cons(TheInterp->seq_builtin, body);
+  }
+  if(is_special(fn, builtin_cond)) {
+    Obj* clauses = NilObj;
+    for(Obj* p = cdr(x); p != NilObj; p = cdr(p)) {
+      clauses = cons(resolve_list(scope, car(p)), clauses);
+    }
+    Obj* res = NilObj;
+    for(Obj* p = clauses; p != NilObj; p = cdr(p)) {
+      res = cons(car(p), res);
+    }
+    return cons(resolve_symbol(scope, head), res);
+  }
+  if(is_special(fn, builtin_set) || is_special(fn, builtin_while) || is_special(fn, builtin_if)
+    || is_special(fn, builtin_and) || is_special(fn, builtin_or) || is_special(fn, builtin_inc)
+    || is_special(fn, builtin_dec) || is_special(fn, builtin_swap)) {
+    return resolve_list(scope, x);
+  }
+  // for and defun are resolved as the forms they stand for,
+  // (progn init (while test (progn body step))) and (set name (lambda params body))
+  if(is_special(fn, builtin_for) && list_length(x) == 5) {
+    Obj* args = cdr(x);
+    Obj* step = cons(intern("progn"), cons(car(cdr(cdr(cdr(args)))), cons(car(cdr(cdr(args))), NilObj)));
+    Obj* loop = cons(intern("while"), cons(car(cdr(args)), cons(step, NilObj)));
+    return resolve(scope, cons(intern("progn"), cons(car(args), cons(loop, NilObj))));
+  }
+  if(is_special(fn, builtin_defun) && list_length(x) == 4) {
+    Obj* lambda = cons(intern("lambda"), cdr(cdr(x)));
+    return resolve(scope, cons(intern("set"), cons(car(cdr(x)), cons(lambda, NilObj))));
+  }
+  return x;
+}
+
+// the optimizer rewrites resolved code once its macros are expanded: calls of
+// builtins get the builtin itself as head, arithmetic and comparisons of
+// constant numbers are folded, cond clauses that can't be reached are
+// dropped and nested progns without a level of their own are flattened.
+// a rewrite that relies on the global value of a builtin, NIL or T displaces
+// the form like a macro call with macro NIL, so once builtin_set changes one
+// of them the form falls back to its original.
+
+static int opt_shadowed(Optimizer* o, Obj* symbol) {
+  for(Obj* p = o->shadowed; p != NilObj; p = cdr(p)) {
+    if(car(p) == symbol) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// finds the symbols the unit x may set as locals and whether it calls eval or defmacro
+void opt_scan(Optimizer* o, Obj* x) {
+  if(type(x) != T_CONS) {
+    return;
+  }
+  Obj* head = car(x);
+  if(type(head) == T_EXPANSION) {
+    opt_scan(o, head->v_expansion.expansion);
+    return;
+  }
+  if(head == TheInterp->closure_builtin) {
+    opt_scan(o, car(cdr(x))->v_lambda.code->v_code.body);
+    return;
+  }
+  Obj* fn = compile_time_binding(head);
+  if(fn != NULL && is_special(fn, builtin_quote)) {
+    return;
+  }
+  if(fn != NULL && (is_special(fn, builtin_defmacro) || is_builtin(fn, builtin_eval))) {
+    o->bind = 0;
+    return;
+  }
+  if(fn != NULL && is_special(fn, builtin_set)) {
+    for(Obj* p = cdr(x); type(p) == T_CONS; p = cdr(p)) {
+      Obj* target = car(p);
+      if(type(target) == T_REF && target->v_ref.slot < 0) {
+        o->shadowed = cons(target->v_ref.symbol, o->shadowed);
+      } else if(type(target) == T_SYMBOL) {
+        o->shadowed = cons(target, o->shadowed);
+      }
+      p = cdr(p);
+      if(type(p) != T_CONS) {
+        break;
+      }
+    }
+  }
+  for(Obj* p = x; type(p) == T_CONS; p = cdr(p)) {
+    opt_scan(o, car(p));
+  }
+}
+
+// the builtin the head of a call names, if the unit may rely on it
+static Obj* opt_binding(Optimizer* o, Obj* head) {
+  Obj* fn = compile_time_binding(head);
+  if(fn == NULL || type(fn) != T_BUILTIN || type(head) == T_BUILTIN) {
+    return fn;
+  }
+  Obj* symbol = type(head) == T_REF ? head->v_ref.symbol : head;
+  if(!o->bind || fn->v_builtin.name != symbol || opt_shadowed(o, symbol)) {
+    return NULL;
+  }
+  return fn;
+}
+
+// the value x always evaluates to as long as its rewrites hold, NULL if unknown
+static Obj* opt_constant(Optimizer* o, Obj* x) {
+  switch(type(x)) {
+    case T_NULL:
+    case T_BOOL:
+    case T_INT:
+    case T_FLOAT:
+    case T_STRING:
+      return x;
+    case T_REF:
+    case T_SYMBOL: {
+      Obj* symbol = type(x) == T_REF ? x->v_ref.symbol : x;
+      if(type(x) == T_REF && x->v_ref.slot >= 0) {
+        return NULL;
+      }
+      if(!o->bind || opt_shadowed(o, symbol) || symbol->v_global == NULL) {
+        return NULL;
+      }
+      return symbol == TheInterp->nil_symbol || symbol == TheInterp->t_symbol ? symbol->v_global : NULL;
+    }
+    case T_CONS: {
+      Obj* head = car(x);
+      if(type(head) == T_EXPANSION && head->v_expansion.epoch == TheInterp->macro_epoch) {
+        return opt_constant(o, head->v_expansion.expansion);
+      }
+      return NULL;
+    }
+    default: return NULL;
+  }
+}
+
+static Obj* opt_reverse(Obj* list) {
+  Obj* res = NilObj;
+  for(Obj* p = list; p != NilObj; p = cdr(p)) {
+    res = cons(car(p), res);
+  }
+  return res;
+}
+
+static Obj* opt_rewrite(Obj* x, Obj* form) {
+  car(x) = new_expansion(car(x), NilObj, form);
+  return x;
+}
+
+// whether folding the arithmetic builtin fn over the numbers argv can't raise
+static int opt_foldable(Obj* fn, int argc, Obj** argv) {
+  int add = is_builtin(fn, builtin_add), sub = is_builtin(fn, builtin_sub);
+  int mul = is_builtin(fn, builtin_mul), div = is_builtin(fn, builtin_div);
+  if(!add && !sub && !mul && !div) {
+    // comparisons of numbers
+    return argc >= 1;
+  }
+  if(argc == 0) {
+    return add || mul;
+  }
+  int exact = 1;
+  int64_t acc = mul || div ? 1 : 0;
+  int i = 0;
+  if(argc > 1) {
+    exact = type(argv[0]) == T_INT;
+    acc = exact ? int_value(argv[0]) : 0;
+    i = 1;
+  }
+  for(; i < argc && exact; i++) {
+    if(type(argv[i]) != T_INT) {
+      break;
+    }
+    int64_t b = int_value(argv[i]);
+    if(div) {
+      if(b == 0 || (acc == INT64_MIN && b == -1)) {
+        return 0;
+      }
+      acc /= b;
+    } else if(add ? __builtin_add_overflow(acc, b, &acc) : sub ? __builtin_sub_overflow(acc, b, &acc) : __builtin_mul_overflow(acc, b, &acc)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// a call of the builtin fn: constant arguments are put in place, a leading
+// run of numbers is folded, (+ 1 2 x) into (+ 3 x), and if all of them are
+// numbers the call is replaced by its result
+static Obj* opt_call(Optimizer* o, Obj* x, Obj* fn) {
+  Obj* argv[16];
+  int argc = 0, numbers = 0, changed = 0;
+  for(Obj* p = cdr(x); p != NilObj; p = cdr(p)) {
+    Obj* c = opt_constant(o, car(p));
+    if(numbers == argc && c != NULL && (type(c) == T_INT || type(c) == T_FLOAT)) {
+      numbers++;
+    }
+    changed = changed || (c != NULL && c != car(p));
+    if(argc < 16) {
+      argv[argc] = c;
+    }
+    argc++;
+  }
+  int fold = is_builtin(fn, builtin_add) || is_builtin(fn, builtin_sub) || is_builtin(fn, builtin_mul) || is_builtin(fn, builtin_div);
+  int compare = is_builtin(fn, builtin_eq) || is_builtin(fn, builtin_neq) || is_builtin(fn, builtin_gt)
+    || is_builtin(fn, builtin_gte) || is_builtin(fn, builtin_lt) || is_builtin(fn, builtin_lte);
+  if((fold || compare) && numbers == argc && argc <= 16 && opt_foldable(fn, argc, argv)) {
+    return opt_rewrite(x, fn->v_builtin.ptr(TheInterp->global_env, argc, argv));
+  }
+  Obj* args = NilObj;
+  Obj* rest = cdr(x);
+  if(fold && numbers >= 2 && numbers <= 16 && opt_foldable(fn, numbers, argv)) {
+    args = cons(fn->v_builtin.ptr(TheInterp->global_env, numbers, argv), NilObj);
+    for(int i = 0; i < numbers; i++) {
+      rest = cdr(rest);
+    }
+  } else if(!changed) {
+    return opt_rewrite(x, cons(fn, cdr(x)));
+  }
+  for(Obj* p = rest; p != NilObj; p = cdr(p)) {
+    Obj* c = opt_constant(o, car(p));
+    args = cons(c != NULL ? c : car(p), args);
+  }
+  return opt_rewrite(x, cons(fn, opt_reverse(args)));
+}
+
+// a special form whose head is bound to the special itself
+static Obj* opt_special(Optimizer* o, Obj* x, Obj* head) {
+  Obj* fn = opt_binding(o, head);
+  return fn == NULL ? x : opt_rewrite(x, cons(fn, cdr(x)));
+}
+
+// clauses after one whose test is always true are dropped, as are the ones
+// whose test is always NIL
+static Obj* opt_cond(Optimizer* o, Obj* x, Obj* fn) {
+  Obj* clauses = NilObj;
+  for(Obj* p = cdr(x); p != NilObj; p = cdr(p)) {
+    Obj* clause = car(p);
+    Obj* c = opt_constant(o, car(clause));
+    if(c == NilObj) {
+      continue;
+    }
+    if(c != NULL) {
+      if(clauses == NilObj) {
+        return opt_rewrite(x, car(cdr(clause)));
+      }
+      clauses = cons(cons(c, cdr(clause)), clauses);
+      break;
+    }
+    clauses = cons(clause, clauses);
+  }
+  if(clauses == NilObj) {
+    return opt_rewrite(x, NilObj);
+  }
+  return opt_rewrite(x, cons(fn, opt_reverse(clauses)));
+}
+
+Obj* optimize(Optimizer* o, Obj* x);
+
+static void opt_list(Optimizer* o, Obj* x) {
+  for(Obj* p = x; type(p) == T_CONS; p = cdr(p)) {
+    car(p) = optimize(o, car(p));
+  }
+}
+
+// a body with the forms of the nested progns that have no level of their
+// own spliced in
+static Obj* opt_body(Optimizer* o, Obj* body) {
+  opt_list(o, body);
+  int nested = 0;
+  for(Obj* p = body; p != NilObj; p = cdr(p)) {
+    nested = nested || (type(car(p)) == T_CONS && car(car(p)) == TheInterp->seq_builtin);
+  }
+  if(!nested) {
+    return body;
+  }
+  Obj* res = NilObj;
+  for(Obj* p = body; p != NilObj; p = cdr(p)) {
+    Obj* form = car(p);
+    if(type(form) != T_CONS || car(form) != TheInterp->seq_builtin) {
+      res = cons(form, res);
+    } else if(cdr(form) == NilObj) {
+      // an empty progn is NIL, which only matters as the last form
+      if(cdr(p) == NilObj) {
+        res = cons(NilObj, res);
+      }
+    } else {
+      for(Obj* q = cdr(form); q != NilObj; q = cdr(q)) {
+        res = cons(car(q), res);
+      }
+    }
+  }
+  return opt_reverse(res);
+}
+
+// the rewrite of a form inside a valid expansion goes straight into the
+// expansion, they are invalidated together
+static Obj* opt_unwrap(Obj* x) {
+  if(type(x) == T_CONS && type(car(x)) == T_EXPANSION && car(x)->v_expansion.macro == NilObj) {
+    return car(x)->v_expansion.expansion;
+  }
+  return x;
+}
+
+// rewrites the resolved form x in place where its original stays correct,
+// returns x or what replaces it
+Obj* optimize(Optimizer* o, Obj* x) {
+  if(type(x) != T_CONS || list_length(x) < 0) {
+    return x;
+  }
+  Obj* head = car(x);
+  if(type(head) == T_EXPANSION) {
+    if(head->v_expansion.epoch == TheInterp->macro_epoch) {
+      head->v_expansion.expansion = opt_unwrap(optimize(o, head->v_expansion.expansion));
+    }
+    return x;
+  }
+  if(head == TheInterp->closure_builtin) {
+    Obj* code = car(cdr(x))->v_lambda.code;
+    code->v_code.body = opt_body(o, code->v_code.body);
+    return x;
+  }
+  if(head == TheInterp->seq_builtin) {
+    cdr(x) = opt_body(o, cdr(x));
+    return x;
+  }
+  Obj* fn = compile_time_binding(head);
+  if(fn == NULL || type(fn) != T_BUILTIN) {
+    // a call of a lambda or of something unknown, macro calls left unexpanded hold data
+    if(fn == NULL || type(fn) != T_MACRO) {
+      opt_list(o, cdr(x));
+    }
+    return x;
+  }
+  if(fn->v_builtin.ep) {
+    opt_list(o, cdr(x));
+    fn = opt_binding(o, head);
+    return fn == NULL ? x : opt_call(o, x, fn);
+  }
+  if(is_special(fn, builtin_progn)) {
+    cdr(x) = opt_body(o, cdr(x));
+    return opt_special(o, x, head);
+  }
+  if(is_special(fn, builtin_set) || is_special(fn, builtin_while) || is_special(fn, builtin_inc)
+    || is_special(fn, builtin_dec) || is_special(fn, builtin_swap)) {
+    opt_list(o, cdr(x));
+    return opt_special(o, x, head);
+  }
+  if(is_special(fn, builtin_if) && list_length(x) == 4) {
+    opt_list(o, cdr(x));
+    Obj* c = opt_constant(o, param2);
+    if(c != NULL && opt_binding(o, head) != NULL) {
+      return opt_rewrite(x, c != NilObj ? car(cdr(cdr(x))) : car(cdr(cdr(cdr(x)))));
+    }
+    return opt_special(o, x, head);
+  }
+  if(is_special(fn, builtin_and) || is_special(fn, builtin_or)) {
+    opt_list(o, cdr(x));
+    int and = is_special(fn, builtin_and);
+    for(Obj* p = cdr(x); p != NilObj; p = cdr(p)) {
+      Obj* c = opt_constant(o, car(p));
+      if(c == NULL) {
+        return opt_special(o, x, head);
+      }
+      if((c == NilObj) == and) {
+        break;
+      }
+    }
+    // the arguments up to the one that decides are constants
+    if(opt_binding(o, head) == NULL) {
+      return x;
+    }
+    for(Obj* p = cdr(x); p != NilObj; p = cdr(p)) {
+      if((opt_constant(o, car(p)) == NilObj) == and) {
+        return opt_rewrite(x, and ? NilObj : TrueObj);
+      }
+    }
+    return opt_rewrite(x, and ? TrueObj : NilObj);
+  }
+  if(is_special(fn, builtin_cond)) {
+    for(Obj* p = cdr(x); p != NilObj; p = cdr(p)) {
+      if(list_length(car(p)) < 2) {
+        return x;
+      }
+    }
+    for(Obj* p = cdr(x); p != NilObj; p = cdr(p)) {
+      opt_list(o, car(p));
+    }
+    fn = opt_binding(o, head);
+    return fn == NULL ? x : opt_cond(o, x, fn);
+  }
+  return x;
+}
+
+// a top-level form run in the global env, resolved first
+Obj* optimize_toplevel(Obj* x) {
+  x = resolve(NULL, x);
+  Optimizer o = { NilObj, 1 };
+  opt_scan(&o, x);
+  return optimize(&o, x);
+}
+
+// a lambda made at runtime from raw code
+void optimize_lambda(Obj* lambda) {
+  Obj* code = lambda->v_lambda.code;
+  Optimizer o = { NilObj, lambda->v_lambda.env == TheInterp->global_env };
+  opt_scan(&o, code->v_code.body);
+  code->v_code.body = opt_body(&o, code->v_code.body);
+}
+
+Obj* disassemble(Obj* x);
+
+static Obj* disassemble_list(Obj* x) {
+  if(type(x) != T_CONS) {
+    return x;
+  }
+  return cons(disassemble(car(x)), disassemble_list(cdr(x)));
+}
+
+static Obj* disassemble_lambda(Obj* lambda) {
+  return cons(intern("LAMBDA"), cons(lambda->v_lambda.params, disassemble_list(lambda->v_lambda.code->v_code.body)));
+}
+
+// resolved code back as a form: valid expansions are replaced by what they
+// expand to, refs by their symbols and closures by lambdas, builtins the
+// optimizer bound stay in place
+Obj* disassemble(Obj* x) {
+  if(type(x) == T_REF) {
+    return x->v_ref.symbol;
+  }
+  if(type(x) != T_CONS) {
+    return x;
+  }
+  Obj* head = car(x);
+  if(type(head) == T_EXPANSION) {
+    if(head->v_expansion.epoch == TheInterp->macro_epoch) {
+      return disassemble(head->v_expansion.expansion);
+    }
+    return cons(disassemble(head->v_expansion.head), disassemble_list(cdr(x)));
+  }
+  if(head == TheInterp->closure_builtin && type(cdr(x)) == T_CONS) {
+    return disassemble_lambda(car(cdr(x)));
+  }
+  return disassemble_list(x);
+}
+
+// (disassemble-form f) shows the code the lambda f runs,
+// (disassemble-form 'form) the code form would run as a top-level form
+DEFINE_BUILTIN(disassemble_form) {
+  if(type(argv[0]) == T_LAMBDA) {
+    return disassemble_lambda(argv[0]);
+  }
+  return disassemble(TheInterp->optimize ? optimize_toplevel(argv[0]) : resolve(NULL, argv[0]));
+}
+
+void init_global_vars() {
+  Interp* interp = TheInterp;
+  interp->global_env = new_env(NilObj, NilObj);
+  interp->closure_builtin = NULL;
+  interp->seq_builtin = NULL;
+  init_symbol_table(&interp->symbols, SYMBOL_TABLE_INIT_CAPACITY);
+  interp->nil_symbol = intern("NIL");
+  interp->t_symbol = intern("T");
+  add_var(interp->global_env, interp->nil_symbol, NilObj);
+  add_var(interp->global_env, interp->t_symbol, TrueObj);
+}
+
+Obj* new_special(const char* name, Special special, int paramc) {
+  Obj* obj = new_obj(T_BUILTIN);
+  obj->v_builtin.name = intern(name);
+  obj->v_builtin.paramc = paramc;
+  obj->v_builtin.special = special;
+  obj->v_builtin.ep = 0;
+  return obj;
+}
+
+// the frame is written before depth so the profiler never samples a
+// half-written one
+static inline void call_stack_push(Obj* fn, Obj* form) {
+  int depth = TheInterp->calls.depth;
+  if(depth < CALL_STACK_MAX) {
+    TheInterp->calls.frames[depth].fn = fn;
+    TheInterp->calls.frames[depth].form = form;
+  }
+  __atomic_signal_fence(__ATOMIC_SEQ_CST);
+  TheInterp->calls.depth = depth + 1;
+}
+
+static inline void call_stack_replace(Obj* fn, Obj* form) {
+  int top = TheInterp->calls.depth - 1;
+  if(top < CALL_STACK_MAX) {
+    TheInterp->calls.frames[top].fn = fn;
+    TheInterp->calls.frames[top].form = form;
+  }
+}
+
+static inline Obj* call_frame_name(Obj* fn) {
+  if(type(fn) == T_BUILTIN) return fn->v_builtin.name;
+  return fn->v_lambda.name;
+}
+
+// innermost frame last, like a python traceback
+void print_stack_trace(Obj* env) {
+  int depth = TheInterp->calls.depth;
+  if(depth == 0) {
+    return;
+  }
+  int recorded = depth < CALL_STACK_MAX ? depth : CALL_STACK_MAX;
+  int first = recorded > STACK_TRACE_MAX ? recorded - STACK_TRACE_MAX : 0;
+  StrBuf buf = { NULL, 0, 0 };
+  Printer printer = { NULL, &buf, 1 };
+  printf("Traceback (most recent call last):\n");
+  if(first + depth - recorded > 0) {
+    printf("  ... %d more frames\n", first + depth - recorded);
+  }
+  for(int i = first; i < recorded; i++) {
+    CallFrame* frame = &TheInterp->calls.frames[i];
+    Obj* name = call_frame_name(frame->fn);
+    printf("  in %s", name == NilObj ? "LAMBDA" : name->v_symbol);
+    if(frame->form != NULL) {
+      buf.length = 0;
+      print_obj(&printer, frame->form);
+      if(buf.length > STACK_TRACE_FORM_MAX) {
+        printf(": %.*s...", STACK_TRACE_FORM_MAX, buf.data);
+      } else {
+        printf(": %.*s", (int)buf.length, buf.data);
+      }
+    }
+    printf("\n");
+  }
+  free(buf.data);
+}
+
+// samples the interpreter running on the interrupted thread, if it is profiling
+void profile_signal(int sig) {
+  (void)sig;
+  Interp* interp = TheInterp;
+  if(interp == NULL || !interp->prof.running) {
+    return;
+  }
+  Profiler* prof = &interp->prof;
+  size_t depth = (size_t)interp->calls.depth;
+  size_t recorded = depth < CALL_STACK_MAX ? depth : CALL_STACK_MAX;
+  size_t n = recorded < PROFILE_MAX_DEPTH ? recorded : PROFILE_MAX_DEPTH;
+  if(prof->count + n + 1 > PROFILE_BUFFER_WORDS) {
+    prof->dropped++;
+    return;
+  }
+  uintptr_t* out = prof->samples + prof->count;
+  *out++ = depth;
+  for(size_t i = recorded - n; i < recorded; i++) {
+    *out++ = (uintptr_t)call_frame_name(interp->calls.frames[i].fn);
+  }
+  prof->count += n + 1;
+}
+
+ProfileStack* profile_stack(const char* key, size_t len) {
+  Profiler* prof = &TheInterp->prof;
+  if((prof->stack_count + 1) * 2 > prof->stack_capacity) {
+    size_t capacity = prof->stack_capacity ? prof->stack_capacity * 2 : 64;
+    ProfileStack* stacks = (ProfileStack*)calloc(capacity, sizeof(ProfileStack));
+    for(size_t i = 0; i < prof->stack_capacity; i++) {
+      ProfileStack* e = &prof->stacks[i];
+      if(e->key == NULL) continue;
+      size_t j = e->hash & (capacity - 1);
+      while(stacks[j].key != NULL) j = (j + 1) & (capacity - 1);
+      stacks[j] = *e;
+    }
+    free(prof->stacks);
+    prof->stacks = stacks;
+    prof->stack_capacity = capacity;
+  }
+  uint32_t hash = string_hash(key, len);
+  size_t mask = prof->stack_capacity - 1;
+  for(size_t i = hash & mask;; i = (i + 1) & mask) {
+    ProfileStack* e = &prof->stacks[i];
+    if(e->key == NULL) {
+      e->key = (char*)malloc(len + 1);
+      memcpy(e->key, key, len);
+      e->key[len] = '\0';
+      e->length = len;
+      e->hash = hash;
+      prof->stack_count++;
+      return e;
+    }
+    if(e->hash == hash && e->length == len && memcmp(e->key, key, len) == 0) return e;
+  }
+}
+
+ProfileCount* profile_count(Obj* name) {
+  Profiler* prof = &TheInterp->prof;
+  if((prof->func_count + 1) * 2 > prof->func_capacity) {
+    size_t capacity = prof->func_capacity ? prof->func_capacity * 2 : 64;
+    ProfileCount* funcs = (ProfileCount*)calloc(capacity, sizeof(ProfileCount));
+    for(size_t i = 0; i < prof->func_capacity; i++) {
+      ProfileCount* e = &prof->funcs[i];
+      if(e->name == NULL) continue;
+      size_t j = e->name->v_symbol_hash & (capacity - 1);
+      while(funcs[j].name != NULL) j = (j + 1) & (capacity - 1);
+      funcs[j] = *e;
+    }
+    free(prof->funcs);
+    prof->funcs = funcs;
+    prof->func_capacity = capacity;
+  }
+  size_t mask = prof->func_capacity - 1;
+  for(size_t i = name->v_symbol_hash & mask;; i = (i + 1) & mask) {
+    ProfileCount* e = &prof->funcs[i];
+    if(e->name == NULL) {
+      e->name = name;
+      prof->func_count++;
+      return e;
+    }
+    if(e->name == name) return e;
+  }
+}
+
+void profile_frame(StrBuf* key, Obj* name) {
+  Profiler* prof = &TheInterp->prof;
+  if(key->length > 0) {
+    strbuf_push(key, ';');
+  }
+  strbuf_append(key, name->v_symbol, strlen(name->v_symbol));
+  if(name == TheInterp->profile_elided) {
+    return;
+  }
+  ProfileCount* count = profile_count(name);
+  if(count->stamp != prof->sample_count) {
+    count->stamp = prof->sample_count;
+    count->total++;
+  }
+}
+
+// runs with SIGPROF blocked, also from the collector so the buffer never fills
+// up while lots of garbage is made
+void profile_drain() {
+  Interp* interp = TheInterp;
+  Profiler* prof = &interp->prof;
+  if(prof->count == 0) {
+    return;
+  }
+  sigset_t set, old;
+  sigemptyset(&set);
+  sigaddset(&set, SIGPROF);
+  pthread_sigmask(SIG_BLOCK, &set, &old);
+  StrBuf key = { NULL, 0, 0 };
+  for(size_t i = 0; i < prof->count;) {
+    size_t depth = prof->samples[i++];
+    size_t n = depth < PROFILE_MAX_DEPTH ? depth : PROFILE_MAX_DEPTH;
+    prof->sample_count++;
+    key.length = 0;
+    profile_frame(&key, interp->profile_root);
+    if(depth > n) {
+      profile_frame(&key, interp->profile_elided);
+    }
+    Obj* name = interp->profile_root;
+    for(size_t j = 0; j < n; j++) {
+      name = (Obj*)prof->samples[i++];
+      if(name == NilObj) {
+        name = interp->profile_lambda;
+      }
+      profile_frame(&key, name);
+    }
+    profile_count(name)->self++;
+    profile_stack(key.data, key.length)->count++;
+  }
+  prof->count = 0;
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  free(key.data);
+}
+
+void profile_reset() {
+  Profiler* prof = &TheInterp->prof;
+  sigset_t set, old;
+  sigemptyset(&set);
+  sigaddset(&set, SIGPROF);
+  pthread_sigmask(SIG_BLOCK, &set, &old);
+  for(size_t i = 0; i < prof->stack_capacity; i++) {
+    free(prof->stacks[i].key);
+  }
+  free(prof->stacks);
+  free(prof->funcs);
+  prof->stacks = NULL;
+  prof->funcs = NULL;
+  prof->stack_count = prof->stack_capacity = 0;
+  prof->func_count = prof->func_capacity = 0;
+  prof->count = 0;
+  prof->sample_count = 0;
+  prof->dropped = 0;
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+// the interval timer and the handler are process-wide,
+// the timer runs while any interpreter is profiling.
+static int ProfilersRunning;
+static pthread_mutex_t ProfileLock = PTHREAD_MUTEX_INITIALIZER;
+
+// a restart drops what was sampled so far
+void profile_start() {
+  Profiler* prof = &TheInterp->prof;
+  profile_reset();
+  if(prof->samples == NULL) {
+    prof->samples = (uintptr_t*)malloc(sizeof(uintptr_t) * PROFILE_BUFFER_WORDS);
+    TheInterp->profile_root = intern("<toplevel>");
+    TheInterp->profile_lambda = intern("lambda");
+    TheInterp->profile_elided = intern("...");
+  }
+  if(prof->running) {
+    return;
+  }
+  pthread_mutex_lock(&ProfileLock);
+  if(ProfilersRunning++ == 0) {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = profile_signal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, NULL);
+    struct itimerval timer = { { 0, PROFILE_INTERVAL_US }, { 0, PROFILE_INTERVAL_US } };
+    setitimer(ITIMER_PROF, &timer, NULL);
+  }
+  pthread_mutex_unlock(&ProfileLock);
+  prof->running = 1;
+}
+
+void profile_stop() {
+  Profiler* prof = &TheInterp->prof;
+  if(!prof->running) {
+    return;
+  }
+  prof->running = 0;
+  pthread_mutex_lock(&ProfileLock);
+  if(--ProfilersRunning == 0) {
+    struct itimerval off = { { 0, 0 }, { 0, 0 } };
+    setitimer(ITIMER_PROF, &off, NULL);
+  }
+  pthread_mutex_unlock(&ProfileLock);
+  profile_drain();
+}
+
+int profile_compare_stacks(const void* a, const void* b) {
+  return strcmp(((const ProfileStack*)a)->key, ((const ProfileStack*)b)->key);
+}
+
+// most self samples first, then most total
+int profile_compare_counts(const void* a, const void* b) {
+  const ProfileCount *x = (const ProfileCount*)a, *y = (const ProfileCount*)b;
+  if(x->self != y->self) return x->self < y->self ? 1 : -1;
+  if(x->total != y->total) return x->total < y->total ? 1 : -1;
+  return strcmp(x->name->v_symbol, y->name->v_symbol);
+}
+
+// one "root;caller;callee count" line per stack, the input format of
+// flamegraph.pl and most other flame graph tools
+int profile_write(const char* filename) {
+  Profiler* prof = &TheInterp->prof;
+  FILE* fp = fopen(filename, "w");
+  if(fp == NULL) {
+    return 0;
+  }
+  ProfileStack* stacks = (ProfileStack*)malloc(sizeof(ProfileStack) * (prof->stack_count + 1));
+  size_t n = 0;
+  for(size_t i = 0; i < prof->stack_capacity; i++) {
+    if(prof->stacks[i].key != NULL) stacks[n++] = prof->stacks[i];
+  }
+  qsort(stacks, n, sizeof(ProfileStack), profile_compare_stacks);
+  for(size_t i = 0; i < n; i++) {
+    fprintf(fp, "%s %" PRIu64 "\n", stacks[i].key, stacks[i].count);
+  }
+  free(stacks);
+  fclose(fp);
+  return 1;
+}
+
+// the functions sorted by profile_compare_counts, count is set to their number
+ProfileCount* profile_counts(size_t* count) {
+  Profiler* prof = &TheInterp->prof;
+  ProfileCount* funcs = (ProfileCount*)malloc(sizeof(ProfileCount) * (prof->func_count + 1));
+  size_t n = 0;
+  for(size_t i = 0; i < prof->func_capacity; i++) {
+    if(prof->funcs[i].name != NULL) funcs[n++] = prof->funcs[i];
+  }
+  qsort(funcs, n, sizeof(ProfileCount), profile_compare_counts);
+  *count = n;
+  return funcs;
+}
+
+void print_profile_summary(FILE* fp) {
+  Profiler* prof = &TheInterp->prof;
+  size_t n;
+  ProfileCount* funcs = profile_counts(&n);
+  fprintf(fp, "profile: %" PRIu64 " samples every %dus, %" PRIu64 " dropped\n", prof->sample_count, PROFILE_INTERVAL_US, prof->dropped);
+  fprintf(fp, "%10s %10s  %s\n", "self", "total", "function");
+  for(size_t i = 0; i < n; i++) {
+    fprintf(fp, "%10" PRIu64 " %10" PRIu64 "  %s\n", funcs[i].self, funcs[i].total, funcs[i].name->v_symbol);
+  }
+  free(funcs);
+}
+
+DEFINE_BUILTIN(profile_start) {
+  profile_start();
+  return TrueObj;
+}
+
+// (profile-stop) or (profile-stop "out.folded") to also write the folded stacks,
+// returns ((name self total) ...) with the most self samples first
+DEFINE_BUILTIN(profile_stop) {
+  throw_error_assert(argc <= 1, env, "profile-stop() takes 0 or 1 arguments but %d were given", argc);
+  profile_stop();
+  if(argc == 1) {
+    check_string(env, "profile-stop", argv[0]);
+    throw_error_assert(profile_write(string_chars(argv[0])), env, "IOError: can't write %s", string_chars(argv[0]));
+  }
+  size_t n;
+  ProfileCount* funcs = profile_counts(&n);
+  Obj* res = NilObj;
+  for(size_t i = n; i > 0; i--) {
+    ProfileCount* c = &funcs[i - 1];
+    res = cons(cons(c->name, cons(new_int((int64_t)c->self), cons(new_int((int64_t)c->total), NilObj))), res);
+  }
+  free(funcs);
+  return res;
+}
+
+Obj* apply(Obj* env, Obj* callable, int argc, Obj** argv);
+static Interp* interp_enter(Interp* interp, char* frame);
+static void interp_leave(Interp* interp, Interp* prev);
+
+void check_callable(Obj* env, const char* name, Obj* x) {
+  throw_error_assert((type(x) == T_BUILTIN && x->v_builtin.ep) || type(x) == T_LAMBDA, env,
+  "TypeError: %s() expects a function, got type(%s)", name, obj_type_to_str(type(x)));
+}
+
+// (fn item) for each item of list, in order
+Obj* map_list(Obj* env, const char* name, Obj* fn, Obj* list) {
+  check_callable(env, name, fn);
+  throw_error_assert(list_length(list) >= 0, env, "TypeError: %s() expects a list, got type(%s)", name, obj_type_to_str(type(list)));
+  Obj *head, *tail;
+  head = tail = NilObj;
+  for(Obj* p = list; p != NilObj; p = cdr(p)) {
+    Obj* item = car(p);
+    Obj* cell = cons(apply(env, fn, 1, &item), NilObj);
+    if(head == NilObj) {
+      head = tail = cell;
+    } else {
+      tail->v_cons.tail = cell;
+      tail = cell;
+    }
+  }
+  return head;
+}
+
+DEFINE_BUILTIN(map) {
+  return map_list(env, "map", argv[0], argv[1]);
+}
+
+static inline size_t ptr_table_index(Obj* key, size_t capacity) {
+  return (size_t)(((uintptr_t)key >> 4) * 11400714819323198485ull) & (capacity - 1);
+}
+
+// the slot of key, added is set if it had to be inserted
+size_t ptr_table_put(PtrTable* table, Obj* key, int* added) {
+  if((table->count + 1) * 2 > table->capacity) {
+    size_t capacity = table->capacity ? table->capacity * 2 : 64;
+    Obj** keys = (Obj**)calloc(capacity, sizeof(Obj*));
+    uint32_t* values = (uint32_t*)calloc(capacity, sizeof(uint32_t));
+    for(size_t i = 0; i < table->capacity; i++) {
+      if(table->keys[i] == NULL) continue;
+      size_t index = ptr_table_index(table->keys[i], capacity);
+      while(keys[index] != NULL) {
+        index = (index + 1) & (capacity - 1);
+      }
+      keys[index] = table->keys[i];
+      values[index] = table->values[i];
+    }
+    free(table->keys);
+    free(table->values);
+    table->keys = keys;
+    table->values = values;
+    table->order = (Obj**)realloc(table->order, sizeof(Obj*) * capacity / 2);
+    table->capacity = capacity;
+  }
+  size_t index = ptr_table_index(key, table->capacity);
+  while(table->keys[index] != NULL) {
+    if(table->keys[index] == key) {
+      *added = 0;
+      return index;
+    }
+    index = (index + 1) & (table->capacity - 1);
+  }
+  table->keys[index] = key;
+  table->values[index] = 0;
+  table->order[table->count++] = key;
+  *added = 1;
+  return index;
+}
+
+void ptr_table_free(PtrTable* table) {
+  free(table->keys);
+  free(table->values);
+  free(table->order);
+  memset(table, 0, sizeof(PtrTable));
+}
+
+// the wire format is a tag byte per value followed by its payload in host
+// byte order, lengths are uint32:
+//   N nil, T true, i int64, f double, s string, y symbol
+//   l count items... tail, a list of count conses ending in tail
+//   v count items..., F count doubles, I count int64s, the vectors
+// and where a value is evaluated on arrival (globals, captured variables,
+// the function of a job):
+//   Q value, quoted data
+//   B name, the builtin of that name
+//   L params body count (name value)..., a lambda and the captured variables
+//     its body refers to, rebuilt as ((lambda (names) (lambda params body)) values)
+static inline void wire_tag(Wire* w, char tag) {
+  strbuf_push(w->out, tag);
+}
+
+static inline void wire_u32(Wire* w, uint32_t n) {
+  strbuf_append(w->out, (const char*)&n, sizeof(n));
+}
+
+static inline void wire_name(Wire* w, Obj* symbol) {
+  size_t len = strlen(symbol->v_symbol);
+  wire_u32(w, (uint32_t)len);
+  strbuf_append(w->out, symbol->v_symbol, len);
+}
+
+// code sends its globals along, the builtins of the same name are already
+// there and so are NIL and T
+void wire_note_global(Wire* w, Obj* symbol) {
+  Obj* value = symbol->v_global;
+  if(value == NULL || strcmp(symbol->v_symbol, "NIL") == 0 || strcmp(symbol->v_symbol, "T") == 0) return;
+  if(type(value) == T_BUILTIN && value->v_builtin.name == symbol) return;
+  int added;
+  ptr_table_put(&w->globals, symbol, &added);
+}
+
+// data, or code if w->symbols is set. 0 if x holds something that can't be sent,
+// a circular list or one nested deeper than WIRE_MAX_DEPTH included
+int wire_write(Wire* w, Obj* x, int depth) {
+  if(depth > WIRE_MAX_DEPTH) return 0;
+  switch(type(x)) {
+    case T_NULL: wire_tag(w, 'N'); return 1;
+    case T_BOOL: wire_tag(w, 'T'); return 1;
+    case T_INT: {
+      int64_t val = int_value(x);
+      wire_tag(w, 'i');
+      strbuf_append(w->out, (const char*)&val, sizeof(val));
+      return 1;
+    }
+    case T_FLOAT: {
+      double val = float_value(x);
+      wire_tag(w, 'f');
+      strbuf_append(w->out, (const char*)&val, sizeof(val));
+      return 1;
+    }
+    case T_STRING: {
+      const char* chars = string_chars(x);
+      wire_tag(w, 's');
+      wire_u32(w, (uint32_t)x->v_string.length);
+      strbuf_append(w->out, chars, x->v_string.length);
+      return 1;
+    }
+    case T_REF:
+    case T_EXPANSION:
+    case T_BUILTIN: {
+      if(w->symbols == NULL) return 0;
+      Obj* symbol = type(x) == T_REF ? x->v_ref.symbol : type(x) == T_EXPANSION ? x->v_expansion.head : x->v_builtin.name;
+      return wire_write(w, symbol, depth);
+    }
+    case T_SYMBOL: {
+      if(w->symbols != NULL) {
+        int added;
+        ptr_table_put(w->symbols, x, &added);
+      }
+      wire_tag(w, 'y');
+      wire_name(w, x);
+      return 1;
+    }
+    case T_CONS: {
+      // slow walks the list at half the pace, it meets p again on a circular one
+      uint32_t count = 0;
+      Obj* p = x;
+      Obj* slow = x;
+      for(; type(p) == T_CONS; p = cdr(p)) {
+        if(++count % 2 == 0) {
+          slow = cdr(slow);
+          if(slow == cdr(p)) return 0;
+        }
+      }
+      wire_tag(w, 'l');
+      wire_u32(w, count);
+      for(p = x; type(p) == T_CONS; p = cdr(p)) {
+        if(!wire_write(w, car(p), depth + 1)) return 0;
+      }
+      return wire_write(w, p, depth + 1);
+    }
+    case T_VECTOR: {
+      wire_tag(w, 'v');
+      wire_u32(w, (uint32_t)x->v_vector.length);
+      for(size_t i = 0; i < x->v_vector.length; i++) {
+        if(!wire_write(w, x->v_vector.items[i], depth + 1)) return 0;
+      }
+      return 1;
+    }
+    case T_F64VECTOR:
+    case T_I64VECTOR: {
+      wire_tag(w, type(x) == T_F64VECTOR ? 'F' : 'I');
+      wire_u32(w, (uint32_t)x->v_vector.length);
+      strbuf_append(w->out, (const char*)x->v_vector.f64, sizeof(double) * x->v_vector.length);
+      return 1;
+    }
+    default: return 0;
+  }
+}
+
+// the variable symbol is bound to between env and the globals, if any
+Obj** wire_captured(Obj* env, Obj* symbol) {
+  for(Obj* e = env; e != TheInterp->global_env && e != NilObj; e = e->v_env.up) {
+    for(Obj* p = e->v_env.vars; p != NilObj; p = cdr(p)) {
+      if(car(car(p)) == symbol) return &cdr(car(p));
+    }
+    int i = 0;
+    for(Obj* p = e->v_env.names; p != NilObj; p = cdr(p), ++i) {
+      if(car(p) == symbol) return &e->v_env.slots[i];
+    }
+  }
+  return NULL;
+}
+
+static inline int is_member(Obj* x, Obj* list) {
+  for(Obj* p = list; p != NilObj; p = cdr(p)) {
+    if(car(p) == x) return 1;
+  }
+  return 0;
+}
+
+int wire_write_value(Wire* w, Obj* x);
+
+// captured variables that can't be sent, a lambda that closes over itself
+// included, are left out and unbound on arrival
+int wire_write_lambda(Wire* w, Obj* lambda) {
+  for(int i = 0; i < w->open_count; i++) {
+    if(w->open[i] == lambda) return 0;
+  }
+  if(w->open_count == WIRE_MAX_LAMBDAS) return 0;
+  w->open[w->open_count++] = lambda;
+  PtrTable symbols = { 0 };
+  PtrTable* outer = w->symbols;
+  w->symbols = &symbols;
+  Obj* params = lambda->v_lambda.params;
+  Obj* rest = lambda->v_lambda.rest;
+  wire_tag(w, 'L');
+  wire_tag(w, 'l');
+  wire_u32(w, (uint32_t)(lambda->v_lambda.paramc + (rest != NilObj)));
+  for(Obj* p = params; p != NilObj; p = cdr(p)) {
+    if(rest != NilObj && cdr(p) == NilObj) {
+      wire_write(w, intern("&rest"), 0);
+    }
+    wire_write(w, car(p), 0);
+  }
+  wire_tag(w, 'N');
+  int ok = wire_write(w, lambda->v_lambda.body, 0);
+  w->symbols = NULL;
+  size_t count_at = w->out->length;
+  uint32_t count = 0;
+  wire_u32(w, 0);
+  for(size_t i = 0; ok && i < symbols.count; i++) {
+    Obj* symbol = symbols.order[i];
+    if(is_member(symbol, params)) continue;
+    Obj** var = wire_captured(lambda->v_lambda.env, symbol);
+    if(var == NULL) {
+      wire_note_global(w, symbol);
+      continue;
+    }
+    size_t mark = w->out->length;
+    wire_name(w, symbol);
+    if(wire_write_value(w, *var)) {
+      count++;
+    } else {
+      w->out->length = mark;
+    }
+  }
+  memcpy(w->out->data + count_at, &count, sizeof(count));
+  ptr_table_free(&symbols);
+  w->symbols = outer;
+  w->open_count--;
+  return ok;
+}
+
+int wire_write_value(Wire* w, Obj* x) {
+  if(type(x) == T_LAMBDA) {
+    return wire_write_lambda(w, x);
+  }
+  if(type(x) == T_BUILTIN) {
+    wire_tag(w, 'B');
+    wire_name(w, x->v_builtin.name);
+    return 1;
+  }
+  PtrTable* outer = w->symbols;
+  w->symbols = NULL;
+  wire_tag(w, 'Q');
+  int ok = wire_write(w, x, 0);
+  w->symbols = outer;
+  return ok;
+}
+
+// a macro expands in the global environment, every free symbol of its body is a global
+int wire_write_macro(Wire* w, Obj* symbol, Obj* macro) {
+  PtrTable symbols = { 0 };
+  w->symbols = &symbols;
+  wire_tag(w, 'M');
+  wire_name(w, symbol);
+  int ok = wire_write(w, macro->v_macro.params, 0) && wire_write(w, macro->v_macro.body, 0);
+  for(size_t i = 0; ok && i < symbols.count; i++) {
+    if(!is_member(symbols.order[i], macro->v_macro.params)) {
+      wire_note_global(w, symbols.order[i]);
+    }
+  }
+  ptr_table_free(&symbols);
+  w->symbols = NULL;
+  return ok;
+}
+
+static inline uint32_t wire_read_u32(WireReader* r) {
+  uint32_t n;
+  memcpy(&n, r->p, sizeof(n));
+  r->p += sizeof(n);
+  return n;
+}
+
+static inline Obj* wire_read_name(WireReader* r) {
+  uint32_t len = wire_read_u32(r);
+  Obj* symbol = intern_n(r->p, len);
+  r->p += len;
+  return symbol;
+}
+
+// rebuilds a value in the current interpreter, see wire_write
+Obj* wire_read(WireReader* r) {
+  char tag = *r->p++;
+  switch(tag) {
+    case 'N': return NilObj;
+    case 'T': return TrueObj;
+    case 'i': {
+      int64_t val;
+      memcpy(&val, r->p, sizeof(val));
+      r->p += sizeof(val);
+      return new_int(val);
+    }
+    case 'f': {
+      double val;
+      memcpy(&val, r->p, sizeof(val));
+      r->p += sizeof(val);
+      return new_float(val);
+    }
+    case 's': {
+      uint32_t len = wire_read_u32(r);
+      Obj* str = new_string_n(r->p, len);
+      r->p += len;
+      return str;
+    }
+    case 'y':
+    case 'B': return wire_read_name(r);
+    case 'l': {
+      uint32_t count = wire_read_u32(r);
+      Obj *head, *tail;
+      head = tail = NilObj;
+      for(uint32_t i = 0; i < count; i++) {
+        Obj* cell = cons(wire_read(r), NilObj);
+        if(head == NilObj) {
+          head = tail = cell;
+        } else {
+          tail->v_cons.tail = cell;
+          tail = cell;
+        }
+      }
+      Obj* end = wire_read(r);
+      if(tail == NilObj) {
+        return end;
+      }
+      tail->v_cons.tail = end;
+      return head;
+    }
+    case 'v': {
+      uint32_t count = wire_read_u32(r);
+      Obj* vec = new_vector(T_VECTOR, count);
+      for(uint32_t i = 0; i < count; i++) {
+        Obj* item = wire_read(r);
+        vec->v_vector.items[i] = item;
+      }
+      return vec;
+    }
+    case 'F':
+    case 'I': {
+      uint32_t count = wire_read_u32(r);
+      Obj* vec = new_vector(tag == 'F' ? T_F64VECTOR : T_I64VECTOR, count);
+      memcpy(vec->v_vector.f64, r->p, sizeof(double) * count);
+      r->p += sizeof(double) * count;
+      return vec;
+    }
+    case 'Q': return cons(intern("quote"), cons(wire_read(r), NilObj));
+    case 'L': {
+      Obj* params = wire_read(r);
+      Obj* body = wire_read(r);
+      Obj* lambda = cons(intern("lambda"), cons(params, body));
+      uint32_t count = wire_read_u32(r);
+      if(count == 0) {
+        return lambda;
+      }
+      Obj *names, *values;
+      names = values = NilObj;
+      for(uint32_t i = 0; i < count; i++) {
+        names = cons(wire_read_name(r), names);
+        values = cons(wire_read(r), values);
+      }
+      return cons(cons(intern("lambda"), cons(names, cons(lambda, NilObj))), values);
+    }
+    default: break;
+  }
+  throw_error(TheInterp->global_env, "ValueError: corrupt wire data, tag %d", tag);
+  return NilObj;
+}
+
+// NULL if fn or one of the globals it refers to can't be sent.
+// globals that are plain data and can't be sent are left out.
+Job* job_new(Obj* fn) {
+  Wire w;
+  memset(&w, 0, sizeof(w));
+  StrBuf value = { 0 }, macros = { 0 }, globals = { 0 };
+  w.out = &value;
+  int ok = wire_write_value(&w, fn);
+  for(size_t i = 0; ok && i < w.globals.count; i++) {
+    Obj* symbol = w.globals.order[i];
+    Obj* global = symbol->v_global;
+    if(type(global) == T_MACRO) {
+      w.out = &macros;
+      ok = wire_write_macro(&w, symbol, global);
+      continue;
+    }
+    w.out = &globals;
+    size_t mark = globals.length;
+    wire_tag(&w, 'G');
+    wire_name(&w, symbol);
+    if(!wire_write_value(&w, global)) {
+      globals.length = mark;
+    }
+  }
+  ptr_table_free(&w.globals);
+  Job* job = ok ? (Job*)calloc(1, sizeof(Job)) : NULL;
+  if(job != NULL) {
+    // macros first, the lambdas expand them as they are installed
+    if(macros.length > 0) {
+      strbuf_append(&job->program, macros.data, macros.length);
+    }
+    if(globals.length > 0) {
+      strbuf_append(&job->program, globals.data, globals.length);
+    }
+    strbuf_append(&job->program, "E", 1);
+    strbuf_append(&job->program, value.data, value.length);
+    job->engine = TheInterp->engine;
+    job->jit_threshold = TheInterp->jit_threshold;
+    job->optimize = TheInterp->optimize;
+    job->refs = 1;
+  }
+  free(value.data);
+  free(macros.data);
+  free(globals.data);
+  return job;
+}
+
+void job_release(Job* job) {
+  if(__atomic_sub_fetch(&job->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+    free(job->program.data);
+    free(job);
+  }
+}
+
+// evaluates the globals of a job's program in the worker's interpreter and
+// returns its function. a macro or lambda whose bytes are the same as when the
+// worker last installed it is skipped, so a pmap's chunks don't redefine its
+// macros over and over and flush the expansion caches. data is set again by
+// every job, so a set by an earlier job on this worker isn't seen.
+Obj* job_install(Job* job, PtrTable* installed) {
+  Obj* env = TheInterp->global_env;
+  WireReader r = { job->program.data, job->program.data + job->program.length };
+  while(*r.p != 'E') {
+    const char* start = r.p;
+    char tag = *r.p++;
+    Obj* name = wire_read_name(&r);
+    int code = tag == 'M' || *r.p == 'L';
+    Obj* form;
+    if(tag == 'M') {
+      Obj* params = wire_read(&r);
+      form = cons(intern("defmacro"), cons(name, cons(params, wire_read(&r))));
+    } else {
+      form = cons(intern("set"), cons(name, cons(wire_read(&r), NilObj)));
+    }
+    uint32_t hash = string_hash(start, r.p - start);
+    int added;
+    size_t slot = ptr_table_put(installed, name, &added);
+    if(code && !added && installed->values[slot] == hash) continue;
+    installed->values[slot] = 0;
+    eval(env, form);
+    installed->values[slot] = code ? hash : 0;
+  }
+  r.p++;
+  return eval(env, wire_read(&r));
+}
+
+Task* task_new(Job* job) {
+  Task* task = (Task*)calloc(1, sizeof(Task));
+  __atomic_add_fetch(&job->refs, 1, __ATOMIC_ACQ_REL);
+  task->job = job;
+  task->state = TASK_PENDING;
+  task->refs = 1;
+  return task;
+}
+
+void task_release(Task* task) {
+  if(__atomic_sub_fetch(&task->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+    job_release(task->job);
+    free(task->items.data);
+    free(task->result.data);
+    free(task);
+  }
+}
+
+void deque_push(Deque* deque, Task* task) {
+  pthread_mutex_lock(&deque->lock);
+  if(deque->count == deque->capacity) {
+    size_t capacity = deque->capacity ? deque->capacity * 2 : 64;
+    Task** tasks = (Task**)malloc(sizeof(Task*) * capacity);
+    for(size_t i = 0; i < deque->count; i++) {
+      tasks[i] = deque->tasks[(deque->head + i) % deque->capacity];
+    }
+    free(deque->tasks);
+    deque->tasks = tasks;
+    deque->head = 0;
+    deque->capacity = capacity;
+  }
+  deque->tasks[(deque->head + deque->count++) % deque->capacity] = task;
+  pthread_mutex_unlock(&deque->lock);
+}
+
+// the newest task for the owner, the oldest for a thief
+Task* deque_take(Deque* deque, int steal) {
+  Task* task = NULL;
+  pthread_mutex_lock(&deque->lock);
+  if(deque->count > 0) {
+    deque->count--;
+    if(steal) {
+      task = deque->tasks[deque->head];
+      deque->head = (deque->head + 1) % deque->capacity;
+    } else {
+      task = deque->tasks[(deque->head + deque->count) % deque->capacity];
+    }
+  }
+  pthread_mutex_unlock(&deque->lock);
+  return task;
+}
+
+// workers are started by the first pmap or future, WorkerCount of them or
+// one per online cpu if it's 0
+static int WorkerCount;
+// the heap image main started from instead of lib.lisp, the workers do the same
+static const char* ImageFile;
+static Scheduler Sched = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, 0, 0, 0, 0 };
+static __thread Worker* CurrentWorker;
+
+// a task from the worker's own deque or else stolen from another one,
+// starting at a random victim
+Task* sched_take(Worker* worker) {
+  Task* task = deque_take(&worker->deque, 0);
+  for(int i = 0; task == NULL && i < Sched.count; i++) {
+    Worker* victim = &Sched.workers[(rand_r(&worker->seed) + i) % Sched.count];
+    if(victim != worker) {
+      task = deque_take(&victim->deque, 1);
+    }
+  }
+  if(task != NULL) {
+    pthread_mutex_lock(&Sched.lock);
+    Sched.pending--;
+    pthread_mutex_unlock(&Sched.lock);
+  }
+  return task;
+}
+
+// a worker queues on its own deque, other threads round robin over the workers
+void sched_submit(Task* task) {
+  __atomic_add_fetch(&task->refs, 1, __ATOMIC_ACQ_REL);
+  pthread_mutex_lock(&Sched.lock);
+  Worker* worker = CurrentWorker != NULL ? CurrentWorker : &Sched.workers[Sched.next++ % Sched.count];
+  deque_push(&worker->deque, task);
+  Sched.pending++;
+  pthread_cond_broadcast(&Sched.cond);
+  pthread_mutex_unlock(&Sched.lock);
+}
+
+// runs the task in the worker's interpreter, like run_forms an error
+// unwinds to here and fails the task
+int task_eval(Task* task) {
+  Interp* interp = TheInterp;
+  int vm_sp = interp->vm.sp, vm_fp = interp->vm.fp, depth = interp->calls.depth, frames = interp->frames.top;
+  enum Engine engine = interp->engine;
+  int jit_threshold = interp->jit_threshold;
+  int optimize = interp->optimize;
+  jmp_buf* outer = interp->handler;
+  jmp_buf handler;
+  interp->handler = &handler;
+  if(setjmp(handler) != 0) {
+    interp->vm.sp = vm_sp;
+    interp->vm.fp = vm_fp;
+    interp->calls.depth = depth;
+    frames_pop(frames);
+    interp->engine = engine;
+    interp->jit_threshold = jit_threshold;
+    interp->optimize = optimize;
+    interp->handler = outer;
+    return -1;
+  }
+  interp->engine = task->job->engine;
+  interp->jit_threshold = task->job->jit_threshold;
+  interp->optimize = task->job->optimize;
+  Obj* env = interp->global_env;
+  Obj* fn = job_install(task->job, &CurrentWorker->installed);
+  Obj* res;
+  if(task->items.data != NULL) {
+    WireReader r = { task->items.data, task->items.data + task->items.length };
+    res = map_list(env, "pmap", fn, wire_read(&r));
+  } else {
+    check_callable(env, "future", fn);
+    res = apply(env, fn, 0, interp->vm.stack + interp->vm.sp);
+  }
+  Wire w;
+  memset(&w, 0, sizeof(w));
+  w.out = &task->result;
+  task->result.length = 0;
+  throw_error_assert(wire_write(&w, res, 0), env, "ValueError: can't send %s back from a worker", obj_repr(res));
+  interp->engine = engine;
+  interp->jit_threshold = jit_threshold;
+  interp->optimize = optimize;
+  interp->handler = outer;
+  return 0;
+}
+
+void task_run(Task* task) {
+  int status = task_eval(task);
+  pthread_mutex_lock(&Sched.lock);
+  task->state = status == 0 ? TASK_DONE : TASK_FAILED;
+  pthread_cond_broadcast(&Sched.cond);
+  pthread_mutex_unlock(&Sched.lock);
+  task_release(task);
+}
+
+// a worker waiting on a task runs queued ones meanwhile,
+// so a pmap or touch inside a task can't starve the pool
+void task_wait(Task* task) {
+  Worker* worker = CurrentWorker;
+  pthread_mutex_lock(&Sched.lock);
+  while(task->state == TASK_PENDING) {
+    if(worker != NULL && Sched.pending > 0) {
+      pthread_mutex_unlock(&Sched.lock);
+      Task* other = sched_take(worker);
+      if(other != NULL) {
+        task_run(other);
+      }
+      pthread_mutex_lock(&Sched.lock);
+      continue;
+    }
+    pthread_cond_wait(&Sched.cond, &Sched.lock);
+  }
+  pthread_mutex_unlock(&Sched.lock);
+}
+
+void* worker_main(void* arg) {
+  Worker* worker = (Worker*)arg;
+  CurrentWorker = worker;
+  worker->interp = interp_new();
+  interp_enter(worker->interp, (char*)__builtin_frame_address(0));
+  if(ImageFile == NULL || interp_load_image(worker->interp, ImageFile) != 0) {
+    interp_load_file(worker->interp, "./lib.lisp");
+  }
+  for(;;) {
+    pthread_mutex_lock(&Sched.lock);
+    while(Sched.pending == 0 && !Sched.stopping) {
+      pthread_cond_wait(&Sched.cond, &Sched.lock);
+    }
+    int stopping = Sched.stopping;
+    pthread_mutex_unlock(&Sched.lock);
+    if(stopping) break;
+    Task* task = sched_take(worker);
+    if(task != NULL) {
+      task_run(task);
+    }
+  }
+  interp_leave(worker->interp, NULL);
+  interp_free(worker->interp);
+  return NULL;
+}
+
+// the workers run until sched_stop, 0 if none could be started
+int sched_start() {
+  pthread_mutex_lock(&Sched.lock);
+  if(Sched.workers == NULL) {
+    int count = WorkerCount > 0 ? WorkerCount : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    count = count > 0 ? count : 1;
+    Sched.workers = (Worker*)calloc(count, sizeof(Worker));
+    for(int i = 0; i < count; i++) {
+      Worker* worker = &Sched.workers[i];
+      pthread_mutex_init(&worker->deque.lock, NULL);
+      worker->seed = (unsigned)i * 2654435761u + 1;
+    }
+    // the workers first take the lock, so they see count set
+    int started = 0;
+    for(int i = 0; i < count; i++) {
+      if(pthread_create(&Sched.workers[i].thread, NULL, worker_main, &Sched.workers[i]) != 0) break;
+      started++;
+    }
+    Sched.count = started;
+  }
+  int count = Sched.count;
+  pthread_mutex_unlock(&Sched.lock);
+  return count;
+}
+
+// joins the workers once their current tasks are done, tasks still queued
+// are dropped. the caller must be done with pmap and touch
+void sched_stop() {
+  pthread_mutex_lock(&Sched.lock);
+  Sched.stopping = 1;
+  pthread_cond_broadcast(&Sched.cond);
+  pthread_mutex_unlock(&Sched.lock);
+  for(int i = 0; i < Sched.count; i++) {
+    pthread_join(Sched.workers[i].thread, NULL);
+  }
+  for(int i = 0; i < Sched.count; i++) {
+    Deque* deque = &Sched.workers[i].deque;
+    for(Task* task; (task = deque_take(deque, 0)) != NULL;) {
+      task_release(task);
+    }
+    free(deque->tasks);
+    pthread_mutex_destroy(&deque->lock);
+    ptr_table_free(&Sched.workers[i].installed);
+  }
+  free(Sched.workers);
+  Sched.workers = NULL;
+  Sched.count = 0;
+  Sched.pending = 0;
+  Sched.stopping = 0;
+}
+
+// (pmap f list) is (map f list) with the items split into chunks run by the
+// workers, CHUNKS_PER_WORKER per worker so stealing can even out uneven items.
+// f runs in the workers' interpreters on copies of the items, of the globals it
+// refers to and of the variables it closes over, sets there aren't seen here.
+DEFINE_BUILTIN(pmap) {
+  Obj* fn = argv[0];
+  Obj* list = argv[1];
+  check_callable(env, "pmap", fn);
+  int n = list_length(list);
+  throw_error_assert(n >= 0, env, "TypeError: pmap() expects a list, got type(%s)", obj_type_to_str(type(list)));
+  if(n == 0) {
+    return NilObj;
+  }
+  int workers = sched_start();
+  throw_error_assert(workers > 0, env, "RuntimeError: pmap() can't start a worker thread");
+  Job* job = job_new(fn);
+  throw_error_assert(job != NULL, env, "ValueError: pmap() can't send %s to a worker", obj_repr(fn));
+  int chunk = (n + workers * CHUNKS_PER_WORKER - 1) / (workers * CHUNKS_PER_WORKER);
+  int task_count = (n + chunk - 1) / chunk;
+  Task** tasks = (Task**)malloc(sizeof(Task*) * task_count);
+  Obj* p = list;
+  Obj* unsent = NULL;
+  for(int i = 0; i < task_count; i++) {
+    tasks[i] = task_new(job);
+    Wire w;
+    memset(&w, 0, sizeof(w));
+    w.out = &tasks[i]->items;
+    int size = n - i * chunk < chunk ? n - i * chunk : chunk;
+    wire_tag(&w, 'l');
+    wire_u32(&w, (uint32_t)size);
+    for(int j = 0; j < size; j++, p = cdr(p)) {
+      if(unsent == NULL && !wire_write(&w, car(p), 0)) {
+        unsent = car(p);
+      }
+    }
+    wire_tag(&w, 'N');
+  }
+  job_release(job);
+  if(unsent == NULL) {
+    for(int i = 0; i < task_count; i++) {
+      sched_submit(tasks[i]);
+    }
+  }
+  Obj *head, *tail;
+  head = tail = NilObj;
+  int failed = 0;
+  for(int i = 0; unsent == NULL && i < task_count; i++) {
+    task_wait(tasks[i]);
+    if(tasks[i]->state == TASK_FAILED) {
+      failed = 1;
+    }
+    if(failed) continue;
+    WireReader r = { tasks[i]->result.data, tasks[i]->result.data + tasks[i]->result.length };
+    Obj* res = wire_read(&r);
+    if(head == NilObj) {
+      head = res;
+    } else {
+      tail->v_cons.tail = res;
+    }
+    for(tail = res; cdr(tail) != NilObj; tail = cdr(tail));
+  }
+  for(int i = 0; i < task_count; i++) {
+    task_release(tasks[i]);
+  }
+  free(tasks);
+  throw_error_assert(unsent == NULL, env, "ValueError: pmap() can't send %s to a worker", unsent != NULL ? obj_repr(unsent) : "");
+  throw_error_assert(!failed, env, "RuntimeError: pmap() failed in a worker");
+  return head;
+}
+
+// (future expr) starts evaluating expr on a worker and returns a future for
+// its value, expr sees copies of the variables and globals it refers to
+DEFINE_SPECIAL(future) {
+  Obj* thunk = make_lambda(env, cons(NilObj, x));
+  throw_error_assert(sched_start() > 0, env, "RuntimeError: future() can't start a worker thread");
+  Job* job = job_new(thunk);
+  throw_error_assert(job != NULL, env, "ValueError: future() can't send %s to a worker", obj_repr(param1));
+  Obj* future = new_obj(T_FUTURE);
+  future->v_future.task = task_new(job);
+  future->v_future.value = NilObj;
+  job_release(job);
+  sched_submit(future->v_future.task);
+  return future;
+}
+
+// (touch future) waits for the value of a future, anything else is its own value
+DEFINE_BUILTIN(touch) {
+  Obj* future = argv[0];
+  if(type(future) != T_FUTURE || future->v_future.task == NULL) {
+    return type(future) == T_FUTURE ? future->v_future.value : future;
+  }
+  Task* task = future->v_future.task;
+  task_wait(task);
+  throw_error_assert(task->state == TASK_DONE, env, "RuntimeError: future failed in a worker");
+  WireReader r = { task->result.data, task->result.data + task->result.length };
+  future->v_future.value = wire_read(&r);
+  future->v_future.task = NULL;
+  task_release(task);
+  return future->v_future.value;
+}
+
+void add_builtin(Obj* env, const char* name, Builtin builtin, int paramc) {
+  Obj* obj = new_obj(T_BUILTIN);
+  obj->v_builtin.name = intern(name);
+  obj->v_builtin.paramc = paramc;
+  obj->v_builtin.ptr = builtin;
+  obj->v_builtin.ep = 1;
+  add_var(env, obj->v_builtin.name, obj);
+}
+
+void add_special(Obj* env, const char* name, Special special, int paramc) {
+  Obj* obj = new_special(name, special, paramc);
+  add_var(env, obj->v_builtin.name, obj);
+}
+
+void init_builtins(Obj* env) {
+  add_builtin(env, "print", builtin_print, -1);
+  add_builtin(env, "println", builtin_println, -1);
+  add_builtin(env, "car", builtin_car, 1);
+  add_builtin(env, "cdr", builtin_cdr, 1);
+  add_builtin(env, "cons", builtin_cons, 2);
+  add_special(env, "progn", builtin_progn, -1);
+  add_special(env, "set", builtin_set, -1);
+  add_special(env, "lambda", builtin_lambda, 2);
+  add_special(env, "defmacro", builtin_defmacro, 3);
+  add_builtin(env, "macroexpand", builtin_macroexpand, 1);
+  add_special(env, "quote", builtin_quote, 1);
+  add_builtin(env, "typeof", builtin_typeof, 1);
+  add_builtin(env, "+", builtin_add, -1);
+  add_builtin(env, "-", builtin_sub, -1);
+  add_builtin(env, "*", builtin_mul, -1);
+  add_builtin(env, "/", builtin_div, -1);
+  add_builtin(env, "==", builtin_eq, -1);
+  add_builtin(env, "!=", builtin_neq, -1);
+  add_builtin(env, ">", builtin_gt, -1);
+  add_builtin(env, ">=", builtin_gte, -1);
+  add_builtin(env, "<", builtin_lt, -1);
+  add_builtin(env, "<=", builtin_lte, -1);
+  add_special(env, "cond", builtin_cond, -1);
+  add_special(env, "while", builtin_while, 2);
+#ifndef TOYLISP_NO_NATIVE_FORMS
+  add_special(env, "if", builtin_if, 3);
+  add_special(env, "and", builtin_and, -1);
+  add_special(env, "or", builtin_or, -1);
+  add_special(env, "++", builtin_inc, 1);
+  add_special(env, "--", builtin_dec, 1);
+  add_special(env, "for", builtin_for, 4);
+  add_special(env, "swap", builtin_swap, 2);
+  add_special(env, "defun", builtin_defun, 3);
+#endif
+  add_builtin(env, "isbound", builtin_isbound, 1);
+  add_builtin(env, "eval", builtin_eval, 1);
+  add_builtin(env, "disassemble-form", builtin_disassemble_form, 1);
+  add_builtin(env, "vector", builtin_vector, -1);
+  add_builtin(env, "f64vector", builtin_f64vector, -1);
+  add_builtin(env, "i64vector", builtin_i64vector, -1);
+  add_builtin(env, "make-vector", builtin_make_vector, -1);
+  add_builtin(env, "make-f64vector", builtin_make_f64vector, -1);
+  add_builtin(env, "make-i64vector", builtin_make_i64vector, -1);
+  add_builtin(env, "vector-length", builtin_vector_length, 1);
+  add_builtin(env, "vector-ref", builtin_vector_ref, 2);
+  add_builtin(env, "vector-set!", builtin_vector_set, 3);
+  add_builtin(env, "vector->list", builtin_vector_to_list, 1);
+  add_builtin(env, "list->vector", builtin_list_to_vector, 1);
+  add_builtin(env, "vsum", builtin_vsum, 1);
+  add_builtin(env, "vdot", builtin_vdot, 2);
+  add_builtin(env, "vmap+", builtin_vmap_add, 2);
+  add_builtin(env, "vscale", builtin_vscale, 2);
+  add_builtin(env, "vmin", builtin_vmin, 1);
+  add_builtin(env, "vmax", builtin_vmax, 1);
+  add_builtin(env, "profile-start", builtin_profile_start, 0);
+  add_builtin(env, "profile-stop", builtin_profile_stop, -1);
+  add_builtin(env, "make-hash", builtin_make_hash, -1);
+  add_builtin(env, "hash-get", builtin_hash_get, -1);
+  add_builtin(env, "hash-set!", builtin_hash_set, 3);
+  add_builtin(env, "hash-del!", builtin_hash_del, 2);
+  add_builtin(env, "hash-keys", builtin_hash_keys, 1);
+  add_builtin(env, "hash-count", builtin_hash_count, 1);
+  add_builtin(env, "string-length", builtin_string_length, 1);
+  add_builtin(env, "substring", builtin_substring, -1);
+  add_builtin(env, "string-join", builtin_string_join, -1);
+  add_builtin(env, "pool-stats", builtin_pool_stats, 0);
+  add_builtin(env, "gc", builtin_gc, 0);
+  add_builtin(env, "gc-stats", builtin_gc_stats, 0);
+  add_builtin(env, "runtime-stats", builtin_runtime_stats, 0);
+  add_builtin(env, "map", builtin_map, 2);
+  add_builtin(env, "pmap", builtin_pmap, 2);
+  add_special(env, "future", builtin_future, 1);
+  add_builtin(env, "touch", builtin_touch, 1);
+  TheInterp->closure_builtin = new_special("lambda", builtin_closure, 1);
+  TheInterp->seq_builtin = new_special("progn", builtin_seq, -1);
+}
+
+void check_args(Obj* env, Obj* callable, int argc) {
+  int paramc = -1;
+  Obj* name = NilObj;
+  int is_rest = 0;
+  if(type(callable) == T_BUILTIN) {
+    paramc = callable->v_builtin.paramc;
+    name = callable->v_builtin.name;
+  }
+  if(type(callable) == T_LAMBDA) {
+    paramc = callable->v_lambda.paramc;
+    name = callable->v_lambda.name == NilObj ? intern("lambda") : callable->v_lambda.name;
+    is_rest = callable->v_lambda.rest != NilObj;
+  }
+  if(is_rest) {
+    throw_error_assert(argc >= paramc - 1, env, 
+    "%s() the number of arguments is less than %d", 
+    name->v_symbol, paramc - 1);
+  } else {
+    throw_error_assert(paramc == -1 || argc == paramc, env, 
+    "%s() takes %d positional arguments but %d were given", 
+    name->v_symbol, paramc, argc);
+  }
+}
+
+// binds argv to the parameters of lambda in a new frame, the body runs right in it.
+// the frame goes on the frame stack for owner (see FrameStack) unless the body may
+// capture it or owner is FRAME_HEAP.
+Obj* bind_frame(Obj* env, Obj* lambda, int argc, Obj** argv, int owner) {
+  check_args(env, lambda, argc);
+  int paramc = lambda->v_lambda.paramc;
+  Obj* frame = NULL;
+  if(owner != FRAME_HEAP && !lambda->v_lambda.code->v_code.captures) {
+    frame = frames_push(lambda->v_lambda.env, lambda->v_lambda.params, paramc, owner);
+  }
+  if(frame != NULL) {
+    STAT(TheInterp->stats.stack_frames++);
+  } else {
+    STAT(TheInterp->stats.heap_frames++);
+    frame = new_env(lambda->v_lambda.env, NilObj);
+    env_init_slots(frame, lambda->v_lambda.params, paramc);
+  }
+  Obj** slots = frame->v_env.slots;
+  if(lambda->v_lambda.rest == NilObj) {
+    memcpy(slots, argv, sizeof(Obj*) * argc);
+    return frame;
+  }
+  for(int i = 0; i < paramc - 1; i++) {
+    slots[i] = argv[i];
+  }
+  slots[paramc - 1] = NilObj;
+  for(int i = argc - 1; i >= paramc - 1; i--) {
+    slots[paramc - 1] = cons(argv[i], slots[paramc - 1]);
+  }
+  return frame;
+}
+
+static Obj* eval_loop(Obj* env, Obj* x, int depth);
+
+// a lambda entered by eval_loop pushes a call frame, its tail calls replace it,
+// and its stack frame is released on the way out. forced inline into eval_args,
+// so recursing through the arguments of a call doesn't add a C frame of its own.
+static inline __attribute__((always_inline)) Obj* eval_inline(Obj* env, Obj* x) {
+  int depth = TheInterp->calls.depth;
+  Obj* res = eval_loop(env, x, depth);
+  TheInterp->calls.depth = depth;
+  return frames_release(depth, res);
+}
+
+// evaluates the arguments onto the value stack and returns their count,
+// they stay there (as gc roots) until the caller pops them.
+int eval_args(Obj* env, Obj* args) {
+  Vm* vm = &TheInterp->vm;
+  int argc = 0;
+  for(Obj* p = args; p != NilObj; p = cdr(p), ++argc) {
+    Obj* obj = eval_inline(env, car(p));
+    if(vm->sp == VM_STACK_SIZE) {
+      throw_error(env, "stack overflow");
+    }
+    vm->stack[vm->sp++] = obj;
+  }
+  return argc;
+}
+
+Obj* apply(Obj* env, Obj* callable, int argc, Obj** argv) {
+  if(type(callable) == T_BUILTIN) {
+    check_args(env, callable, argc);
+    return callable->v_builtin.ptr(env, argc, argv);
+  }
+  Obj* res;
+  if(TheInterp->jit_threshold > 0 && jit_call(callable, argc, argv, &res)) {
+    return res;
+  }
+  if(TheInterp->engine == ENGINE_VM) {
+    return vm_apply(callable, argc, argv);
+  }
+  int frames = TheInterp->frames.top;
+  Obj* frame = bind_frame(env, callable, argc, argv, FRAME_CALLER);
+  res = builtin_seq(frame, callable->v_lambda.code->v_code.body);
+  frames_pop(frames);
+  return res;
+}
+
+// x is the whole call form, it is recorded on the call stack
+Obj* call(Obj* env, Obj* callable, Obj* x) {
+  Obj* args = cdr(x);
+  if(type(callable) == T_BUILTIN && !callable->v_builtin.ep) {
+    STAT(TheInterp->stats.calls[CALL_SPECIAL]++);
+    check_args(env, callable, list_length(args));
+    return callable->v_builtin.special(env, args);
+  }
+  if(type(callable) != T_BUILTIN && type(callable) != T_LAMBDA) {
+    throw_error(env, "can't call type: %s(%s)", obj_type_to_str(type(callable)), obj_repr(callable));
+  }
+  STAT(TheInterp->stats.calls[type(callable) == T_LAMBDA ? CALL_LAMBDA : CALL_BUILTIN]++);
+  int base = TheInterp->vm.sp;
+  int argc = eval_args(env, args);
+  call_stack_push(callable, x);
+  Obj* res = apply(env, callable, argc, TheInterp->vm.stack + base);
+  TheInterp->calls.depth--;
+  TheInterp->vm.sp = base;
+  return res;
+}
+
+Obj* unresolve(Obj* x);
+
+// a fresh list of the items of list unresolved
+static Obj* unresolve_list(Obj* list) {
+  Obj* res = cons(NilObj, NilObj);
+  Obj* tail = res;
+  Obj* p = list;
+  for(; type(p) == T_CONS; p = cdr(p)) {
+    tail = cdr(tail) = cons(unresolve(car(p)), NilObj);
+  }
+  cdr(tail) = p;
+  return cdr(res);
+}
+
+// the source of resolved code: refs and the builtins the optimizer bound become
+// their symbols again, displaced forms get their original heads back and closures
+// the lambdas they were made from.
+Obj* unresolve(Obj* x) {
+  if(type(x) == T_REF) {
+    return x->v_ref.symbol;
+  }
+  if(type(x) == T_BUILTIN) {
+    return x->v_builtin.name;
+  }
+  if(type(x) != T_CONS) {
+    return x;
+  }
+  Obj* head = car(x);
+  while(type(head) == T_EXPANSION) {
+    head = head->v_expansion.head;
+  }
+  if(head == TheInterp->closure_builtin) {
+    Obj* proto = car(cdr(x));
+    Obj* params = cons(NilObj, NilObj);
+    Obj* tail = params;
+    for(Obj* p = proto->v_lambda.params; p != NilObj; p = cdr(p)) {
+      if(car(p) == proto->v_lambda.rest) {
+        tail = cdr(tail) = cons(intern("&rest"), NilObj);
+      }
+      tail = cdr(tail) = cons(car(p), NilObj);
+    }
+    return cons(intern("lambda"), cons(cdr(params), proto->v_lambda.body));
+  }
+  return cons(unresolve(head), unresolve_list(cdr(x)));
+}
+
+// expands the macro call x and displaces it, so the next evaluation
+// of the same form goes straight to the expansion. the arguments of x may
+// have been resolved against the scope of the call, the macro gets them as
+// source and the expansion runs unresolved, its variables looked up by name.
+Obj* expand_call_site(Obj* env, Obj* x, Obj* macro) {
+  int argc = list_length(cdr(x));
+  throw_error_assert(argc == macro->v_macro.paramc, env,
+  "%s() takes %d positional arguments but %d were given",
+  macro->v_macro.name->v_symbol, macro->v_macro.paramc, argc);
+  Obj* expansion = macroexpand(env, macro, unresolve_list(cdr(x)));
+  TheInterp->macro_cache.misses++;
+  car(x) = new_expansion(car(x), macro, expansion);
+  return expansion;
+}
+
+void print_macro_cache_stats() {
+  Interp* interp = TheInterp;
+  uint64_t total = interp->macro_cache.hits + interp->macro_cache.misses;
+  fprintf(stderr, "macro expansion cache: %" PRIu64 " hits, %" PRIu64 " misses, %" PRIu64 " invalidations, hit rate %.2f%%\n",
+    interp->macro_cache.hits, interp->macro_cache.misses, interp->macro_cache.invalidations,
+    total ? 100.0 * (double)interp->macro_cache.hits / (double)total : 0.0);
+}
+
+// the tail positions of lambda bodies, progn, cond clauses and macro expansions
+// loop here instead of recursing, so iterative recursion runs in constant C stack.
+// kept out of line, so a builtin call in tail position is a sibling call and
+// a level of recursion costs the C stack one eval_loop frame.
+static __attribute__((noinline)) Obj* eval_loop(Obj* env, Obj* x, int depth) {
+  char probe;
+  if(&probe < TheInterp->stack_limit) {
+    throw_error(env, "stack overflow");
+  }
+  for(;;) {
+    switch(type(x)) {
+      case T_NULL:
+      case T_BOOL:
+      case T_INT:
+      case T_FLOAT:
+      case T_STRING:
+        STAT(TheInterp->stats.evals[type(x)]++);
+        return x;
+      case T_SYMBOL: {
+        STAT(TheInterp->stats.evals[T_SYMBOL]++);
+        Obj** var = find_var(env, x);
+        if(var == NULL) {
+          throw_error(env, "can't find symbol: %s", x->v_symbol);
+        }
+        return *var;
+      }
+      case T_REF: {
+        STAT(TheInterp->stats.evals[T_REF]++);
+        Obj** var = find_ref(env, x);
+        if(var == NULL) {
+          throw_error(env, "can't find symbol: %s", x->v_ref.symbol->v_symbol);
+        }
+        return *var;
+      }
+      case T_CONS: {
+        STAT(TheInterp->stats.evals[T_CONS]++);
+        Obj* head = car(x);
+        if(type(head) == T_EXPANSION) {
+          if(head->v_expansion.epoch == TheInterp->macro_epoch) {
+            TheInterp->macro_cache.hits++;
+            x = head->v_expansion.expansion;
+            continue;
+          }
+          TheInterp->macro_cache.invalidations++;
+          car(x) = head = head->v_expansion.head;
+        }
+        Obj* callable = type(head) == T_BUILTIN ? head : eval(env, head);
+        if(type(callable) == T_MACRO) {
+          x = expand_call_site(env, x, callable);
+          continue;
+        }
+        if(type(callable) == T_LAMBDA && TheInterp->engine == ENGINE_TREE) {
+          STAT(TheInterp->stats.calls[CALL_LAMBDA]++);
+          int base = TheInterp->vm.sp;
+          int argc = eval_args(env, cdr(x));
+          Obj* res;
+          if(TheInterp->jit_threshold > 0 && jit_call(callable, argc, TheInterp->vm.stack + base, &res)) {
+            TheInterp->vm.sp = base;
+            return res;
+          }
+          frames_release(depth, NilObj);
+          env = bind_frame(env, callable, argc, TheInterp->vm.stack + base, depth);
+          TheInterp->vm.sp = base;
+          if(TheInterp->calls.depth > depth) {
+            call_stack_replace(callable, x);
+          } else {
+            call_stack_push(callable, x);
+          }
+          x = progn_init(env, callable->v_lambda.code->v_code.body);
+          continue;
+        }
+        if(callable == TheInterp->seq_builtin) {
+          STAT(TheInterp->stats.calls[CALL_SPECIAL]++);
+          x = progn_init(env, cdr(x));
+          continue;
+        }
+        if(is_special(callable, builtin_progn)) {
+          STAT(TheInterp->stats.calls[CALL_SPECIAL]++);
+          env = new_env(env, NilObj);
+          x = progn_init(env, cdr(x));
+          continue;
+        }
+        if(is_special(callable, builtin_cond)) {
+          STAT(TheInterp->stats.calls[CALL_SPECIAL]++);
+          Obj* clause = NULL;
+          for(Obj* p = cdr(x); p != NilObj; p = cdr(p)) {
+            if(eval(env, car(car(p))) != NilObj) {
+              clause = car(p);
+              break;
+            }
+          }
+          if(clause == NULL) {
+            return NilObj;
+          }
+          x = car(cdr(clause));
+          continue;
+        }
+        if(is_special(callable, builtin_if)) {
+          STAT(TheInterp->stats.calls[CALL_SPECIAL]++);
+          if(list_length(cdr(x)) != 3) {
+            check_args(env, callable, list_length(cdr(x)));
+          }
+          x = eval(env, param2) != NilObj ? car(cdr(cdr(x))) : car(cdr(cdr(cdr(x))));
+          continue;
+        }
+        if(is_special(callable, builtin_and) || is_special(callable, builtin_or)) {
+          STAT(TheInterp->stats.calls[CALL_SPECIAL]++);
+          // and stops at the first NIL, or at the first non NIL
+          int and = is_special(callable, builtin_and);
+          for(Obj* p = cdr(x); p != NilObj; p = cdr(p)) {
+            if((eval(env, car(p)) == NilObj) == and) {
+              return and ? NilObj : TrueObj;
+            }
+          }
+          return and ? TrueObj : NilObj;
+        }
+        return call(env, callable, x);
+      }
+      default: break;
+    }
+    return x;
+  }
+}
+
+Obj* eval(Obj* env, Obj* x) {
+  return eval_inline(env, x);
+}
+
+enum Opcode {
+  OP_CONST,
+  OP_LOAD_LOCAL,
+  OP_LOAD_FREE,
+  OP_LOAD_NAME,
+  OP_STORE_LOCAL,
+  OP_STORE_FREE,
+  OP_STORE_NAME,
+  OP_POP,
+  OP_JUMP,
+  OP_JUMP_IF_NIL,
+  OP_PUSH_ENV,
+  OP_POP_ENV,
+  OP_CLOSURE,
+  OP_CHECK_EXPANSION,
+  OP_CHECK_BUILTIN,
+  OP_CHECK_CALLABLE,
+  OP_EVAL_TREE,
+  OP_CALL,
+  OP_TAIL_CALL,
+  OP_RETURN,
+  OP_ADD,
+  OP_SUB,
+  OP_MUL,
+  OP_DIV,
+  OP_EQ,
+  OP_NEQ,
+  OP_GT,
+  OP_GTE,
+  OP_LT,
+  OP_LTE,
+  OP_COUNT
+};
+
+// builtins with a dedicated instruction, in the order of OP_ADD..OP_LTE
+static const Builtin VmArithBuiltins[] = {
+  builtin_add, builtin_sub, builtin_mul, builtin_div,
+  builtin_eq, builtin_neq, builtin_gt, builtin_gte, builtin_lt, builtin_lte
+};
+
+Bytecode* new_bytecode() {
+  Bytecode* bytecode = (Bytecode*)calloc(1, sizeof(Bytecode));
+  return bytecode;
+}
+
+int emit(Bytecode* bc, int32_t word) {
+  if(bc->count == bc->capacity) {
+    bc->capacity = bc->capacity ? bc->capacity * 2 : 64;
+    bc->ops = (int32_t*)realloc(bc->ops, sizeof(int32_t) * bc->capacity);
+  }
+  bc->ops[bc->count] = word;
+  return bc->count++;
+}
+
+int emit_op(Bytecode* bc, int op, int operand) {
+  emit(bc, op);
+  return emit(bc, operand);
+}
+
+int add_const(Bytecode* bc, Obj* obj) {
+  for(int i = 0; i < bc->const_count; i++) {
+    if(bc->consts[i] == obj) return i;
+  }
+  if(bc->const_count == bc->const_capacity) {
+    bc->const_capacity = bc->const_capacity ? bc->const_capacity * 2 : 16;
+    bc->consts = (Obj**)realloc(bc->consts, sizeof(Obj*) * bc->const_capacity);
+  }
+  bc->consts[bc->const_count] = obj;
+  return bc->const_count++;
+}
+
+static inline void patch(Bytecode* bc, int at) {
+  bc->ops[at] = bc->count;
+}
+
+void compile(Bytecode* bc, Obj* x, int tail);
+
+void compile_body(Bytecode* bc, Obj* body, int tail) {
+  if(body == NilObj) {
+    emit_op(bc, OP_CONST, add_const(bc, NilObj));
+    return;
+  }
+  for(Obj* p = body; p != NilObj; p = cdr(p)) {
+    compile(bc, car(p), tail && cdr(p) == NilObj);
+    if(cdr(p) != NilObj) {
+      emit(bc, OP_POP);
+    }
+  }
+}
+
+void compile_ref(Bytecode* bc, Obj* x, int store) {
+  if(type(x) == T_SYMBOL) {
+    emit_op(bc, store ? OP_STORE_NAME : OP_LOAD_NAME, add_const(bc, x));
+  } else if(x->v_ref.slot >= 0) {
+    emit(bc, store ? OP_STORE_LOCAL : OP_LOAD_LOCAL);
+    emit(bc, x->v_ref.depth);
+    emit(bc, x->v_ref.slot);
+  } else {
+    emit_op(bc, store ? OP_STORE_FREE : OP_LOAD_FREE, add_const(bc, x));
+  }
+}
+
+void compile_tree(Bytecode* bc, Obj* x) {
+  emit_op(bc, OP_EVAL_TREE, add_const(bc, x));
+}
+
+void compile_expansion(Bytecode* bc, Obj* x, int tail) {
+  Obj* node = car(x);
+  int fallback = emit_op(bc, OP_CHECK_EXPANSION, add_const(bc, node));
+  emit(bc, 0);
+  compile(bc, node->v_expansion.expansion, tail);
+  int end = emit_op(bc, OP_JUMP, 0);
+  patch(bc, fallback + 1);
+  compile_tree(bc, x);
+  patch(bc, end);
+}
+
+void compile_cond(Bytecode* bc, Obj* x, int tail) {
+  if(list_length(cdr(x)) > 256) {
+    compile_tree(bc, x);
+    return;
+  }
+  for(Obj* p = cdr(x); p != NilObj; p = cdr(p)) {
+    if(list_length(car(p)) < 2) {
+      compile_tree(bc, x);
+      return;
+    }
+  }
+  int ends[256];
+  int count = 0;
+  for(Obj* p = cdr(x); p != NilObj; p = cdr(p)) {
+    Obj* clause = car(p);
+    compile(bc, car(clause), 0);
+    int next = emit_op(bc, OP_JUMP_IF_NIL, 0);
+    compile(bc, car(cdr(clause)), tail);
+    ends[count++] = emit_op(bc, OP_JUMP, 0);
+    patch(bc, next);
+  }
+  emit_op(bc, OP_CONST, add_const(bc, NilObj));
+  for(int i = 0; i < count; i++) {
+    patch(bc, ends[i]);
+  }
+}
+
+// and jumps out to NIL at the first NIL argument, or out to T
+// at the first other one, like the special forms
+void compile_logic(Bytecode* bc, Obj* x, int and) {
+  if(list_length(cdr(x)) > 256) {
+    compile_tree(bc, x);
+    return;
+  }
+  int exits[256];
+  int count = 0;
+  for(Obj* p = cdr(x); p != NilObj; p = cdr(p)) {
+    compile(bc, car(p), 0);
+    int next = emit_op(bc, OP_JUMP_IF_NIL, 0);
+    if(and) {
+      exits[count++] = next;
+    } else {
+      exits[count++] = emit_op(bc, OP_JUMP, 0);
+      patch(bc, next);
+    }
+  }
+  emit_op(bc, OP_CONST, add_const(bc, and ? TrueObj : NilObj));
+  int end = emit_op(bc, OP_JUMP, 0);
+  for(int i = 0; i < count; i++) {
+    patch(bc, exits[i]);
+  }
+  emit_op(bc, OP_CONST, add_const(bc, and ? NilObj : TrueObj));
+  patch(bc, end);
+}
+
+void compile_call(Bytecode* bc, Obj* x, int tail) {
+  int argc = list_length(cdr(x));
+  Obj* fn = compile_time_binding(car(x));
+  if(fn != NULL && argc >= 2) {
+    for(int i = 0; i < OP_COUNT - OP_ADD; i++) {
+      if(!is_builtin(fn, VmArithBuiltins[i])) continue;
+      // (+ a b c) folds into a chain of OP_ADD, comparisons only take two operands
+      if(argc > 2 && OP_ADD + i >= OP_EQ) break;
+      if(car(x) == fn) {
+        // bound by the optimizer, under the guard of an expansion
+        compile(bc, car(cdr(x)), 0);
+        for(Obj* p = cdr(cdr(x)); p != NilObj; p = cdr(p)) {
+          compile(bc, car(p), 0);
+          emit(bc, OP_ADD + i);
+        }
+        return;
+      }
+      int slow = emit_op(bc, OP_CHECK_BUILTIN, add_const(bc, car(x)));
+      emit(bc, add_const(bc, fn));
+      emit(bc, 0);
+      compile(bc, car(cdr(x)), 0);
+      for(Obj* p = cdr(cdr(x)); p != NilObj; p = cdr(p)) {
+        compile(bc, car(p), 0);
+        emit(bc, OP_ADD + i);
+      }
+      int end = emit_op(bc, OP_JUMP, 0);
+      patch(bc, slow + 2);
+      compile_tree(bc, x);
+      patch(bc, end);
+      return;
+    }
+  }
+  compile(bc, car(x), 0);
+  int form = add_const(bc, x);
+  int special = emit_op(bc, OP_CHECK_CALLABLE, form);
+  emit(bc, 0);
+  for(Obj* p = cdr(x); p != NilObj; p = cdr(p)) {
+    compile(bc, car(p), 0);
+  }
+  // the form goes along for the call frame, tracebacks and the profiler show it
+  emit_op(bc, tail ? OP_TAIL_CALL : OP_CALL, argc);
+  emit(bc, form);
+  patch(bc, special + 1);
+}
+
+// compiles resolved lambda bodies as well as raw top-level forms.
+// special forms and macros are recognized by the global binding of the head
+// at compile time, anything the compiler doesn't cover runs on the tree-walker.
+void compile(Bytecode* bc, Obj* x, int tail) {
+  if(type(x) == T_SYMBOL || type(x) == T_REF) {
+    compile_ref(bc, x, 0);
+    return;
+  }
+  if(type(x) != T_CONS) {
+    emit_op(bc, OP_CONST, add_const(bc, x));
+    return;
+  }
+  int argc = list_length(cdr(x));
+  if(argc < 0) {
+    compile_tree(bc, x);
+    return;
+  }
+  if(type(car(x)) == T_EXPANSION) {
+    compile_expansion(bc, x, tail);
+    return;
+  }
+  if(car(x) == TheInterp->closure_builtin) {
+    emit_op(bc, OP_CLOSURE, add_const(bc, param2));
+    return;
+  }
+  if(car(x) == TheInterp->seq_builtin) {
+    compile_body(bc, cdr(x), tail);
+    return;
+  }
+  Obj* fn = compile_time_binding(car(x));
+  if(fn != NULL && type(fn) == T_MACRO) {
+    if(fn->v_macro.paramc != argc) {
+      compile_tree(bc, x);
+      return;
+    }
+    expand_call_site(TheInterp->global_env, x, fn);
+    compile_expansion(bc, x, tail);
+    return;
+  }
+  if(fn == NULL || type(fn) != T_BUILTIN || fn->v_builtin.ep) {
+    compile_call(bc, x, tail);
+    return;
+  }
+  Obj* args = cdr(x);
+  if(is_special(fn, builtin_quote) && argc == 1) {
+    emit_op(bc, OP_CONST, add_const(bc, car(args)));
+  } else if(is_special(fn, builtin_progn)) {
+    emit(bc, OP_PUSH_ENV);
+    compile_body(bc, args, tail);
+    if(!tail) {
+      emit(bc, OP_POP_ENV);
+    }
+  } else if(is_special(fn, builtin_cond)) {
+    compile_cond(bc, x, tail);
+  } else if(is_special(fn, builtin_if) && argc == 3) {
+    compile(bc, car(args), 0);
+    int other = emit_op(bc, OP_JUMP_IF_NIL, 0);
+    compile(bc, car(cdr(args)), tail);
+    int end = emit_op(bc, OP_JUMP, 0);
+    patch(bc, other);
+    compile(bc, car(cdr(cdr(args))), tail);
+    patch(bc, end);
+  } else if(is_special(fn, builtin_and) || is_special(fn, builtin_or)) {
+    compile_logic(bc, x, is_special(fn, builtin_and));
+  } else if((is_special(fn, builtin_inc) || is_special(fn, builtin_dec)) && argc == 1
+    && (type(car(args)) == T_SYMBOL || type(car(args)) == T_REF)) {
+    compile_ref(bc, car(args), 0);
+    emit_op(bc, OP_CONST, add_const(bc, new_int(1)));
+    emit(bc, is_special(fn, builtin_inc) ? OP_ADD : OP_SUB);
+    compile_ref(bc, car(args), 1);
+    compile_ref(bc, car(args), 0);
+  } else if(is_special(fn, builtin_swap) && argc == 2
+    && (type(car(args)) == T_SYMBOL || type(car(args)) == T_REF)
+    && (type(car(cdr(args))) == T_SYMBOL || type(car(cdr(args))) == T_REF)) {
+    // b goes to a and the value of a left below it to b
+    compile_ref(bc, car(args), 0);
+    compile_ref(bc, car(cdr(args)), 0);
+    compile_ref(bc, car(args), 1);
+    compile_ref(bc, car(cdr(args)), 1);
+    emit_op(bc, OP_CONST, add_const(bc, NilObj));
+  } else if(is_special(fn, builtin_while) && argc == 2) {
+    int top = bc->count;
+    compile(bc, car(args), 0);
+    int exit = emit_op(bc, OP_JUMP_IF_NIL, 0);
+    compile(bc, car(cdr(args)), 0);
+    emit(bc, OP_POP);
+    emit_op(bc, OP_JUMP, top);
+    patch(bc, exit);
+    emit_op(bc, OP_CONST, add_const(bc, NilObj));
+  } else if(is_special(fn, builtin_set) && argc >= 2 && argc % 2 == 0) {
+    for(Obj* p = args; p != NilObj; p = cdr(cdr(p))) {
+      if(type(car(p)) != T_SYMBOL && type(car(p)) != T_REF) {
+        compile_tree(bc, x);
+        return;
+      }
+    }
+    for(Obj* p = args; p != NilObj; p = cdr(cdr(p))) {
+      compile(bc, car(cdr(p)), 0);
+      compile_ref(bc, car(p), 1);
+    }
+    emit_op(bc, OP_CONST, add_const(bc, NilObj));
+  } else {
+    compile_tree(bc, x);
+  }
 }
 
-Obj* parse(Parser* parser) {
-  Obj *head, *tail;
-  head = tail = cons(parse_obj(parser), NilObj);
-  while(peek_char(parser) != EOF) {
-    tail->v_cons.tail = cons(parse_obj(parser), NilObj);
-    tail = tail->v_cons.tail;
+Bytecode* compile_lambda(Obj* lambda) {
+  Obj* code = lambda->v_lambda.code;
+  if(code->v_code.bytecode == NULL) {
+    Bytecode* bc = new_bytecode();
+    compile_body(bc, code->v_code.body, 1);
+    emit(bc, OP_RETURN);
+    code->v_code.bytecode = bc;
   }
-  return head;
+  return code->v_code.bytecode;
 }
 
-Obj* parse_quote(Parser* parser) {
-  skip_char(parser, '\'');
-  return cons(intern("quote"), cons(parse_obj(parser), NilObj));
+void vm_init() {
+  TheInterp->vm.stack = (Obj**)malloc(sizeof(Obj*) * VM_STACK_SIZE);
+  TheInterp->vm.frames = (VmFrame*)malloc(sizeof(VmFrame) * VM_FRAMES_MAX);
+  TheInterp->vm.sp = 0;
+  TheInterp->vm.fp = 0;
+  TheInterp->frames.cells = (Obj*)calloc(FRAME_STACK_SIZE, sizeof(Obj));
+  TheInterp->frames.slots = (Obj**)malloc(sizeof(Obj*) * FRAME_SLOTS_SIZE);
+  TheInterp->frames.owners = (int*)malloc(sizeof(int) * FRAME_STACK_SIZE);
+  TheInterp->frames.escapes = NilObj;
+  TheInterp->frames.escape_mark = FRAME_STACK_SIZE;
 }
 
-Obj* parse_list(Parser* parser) {
-  skip_char(parser, '(');
-  if(peek_char(parser) == ')') {
-    next_char(parser);
-    return NilObj;
+// a head that turned out to be a macro or special form at runtime
+// gets the form evaluated by the tree-walker instead.
+Obj* vm_call_special(Obj* env, Obj* fn, Obj* x) {
+  if(type(car(x)) == T_SYMBOL || type(car(x)) == T_REF || type(car(x)) == T_EXPANSION) {
+    return eval(env, x);
   }
-  Obj *head, *tail;
-  head = tail = cons(parse_obj(parser), NilObj);
-  while(peek_char(parser) != ')') {
-    tail->v_cons.tail = cons(parse_obj(parser), NilObj);
-    tail = tail->v_cons.tail;
-    skip_whitespace(parser);
+  if(type(fn) == T_MACRO) {
+    return eval(env, expand_call_site(env, x, fn));
   }
-  skip_char(parser, ')');
-  return head;
+  return call(env, fn, x);
 }
 
-Obj* parse_number(Parser* parser) {
-  char str[32] = { 0 };
-  char* ptr = str;
-  int isfloat = 0;
-  while(isdigit(peek_char(parser))) {
-    *ptr++ = next_char(parser);
+#if defined(__GNUC__)
+#define VM_DISPATCH() goto *labels[*ip++]
+#define VM_CASE(op) L_##op
+#else
+#define VM_DISPATCH() goto dispatch
+#define VM_CASE(op) case op
+#endif
+#define VM_SYNC() (vm->sp = (int)(sp - vm->stack), frame->ip = ip, frame->env = env)
+#define VM_LOAD_FRAME() (frame = &vm->frames[vm->fp - 1], ip = frame->ip, env = frame->env, consts = frame->bytecode->consts)
+
+// runs frames until the one at entry_fp returns
+Obj* vm_execute(int entry_fp) {
+#if defined(__GNUC__)
+  static void* labels[] = {
+    &&L_OP_CONST, &&L_OP_LOAD_LOCAL, &&L_OP_LOAD_FREE, &&L_OP_LOAD_NAME,
+    &&L_OP_STORE_LOCAL, &&L_OP_STORE_FREE, &&L_OP_STORE_NAME, &&L_OP_POP,
+    &&L_OP_JUMP, &&L_OP_JUMP_IF_NIL, &&L_OP_PUSH_ENV, &&L_OP_POP_ENV,
+    &&L_OP_CLOSURE, &&L_OP_CHECK_EXPANSION, &&L_OP_CHECK_BUILTIN, &&L_OP_CHECK_CALLABLE,
+    &&L_OP_EVAL_TREE, &&L_OP_CALL, &&L_OP_TAIL_CALL, &&L_OP_RETURN,
+    &&L_OP_ADD, &&L_OP_SUB, &&L_OP_MUL, &&L_OP_DIV,
+    &&L_OP_EQ, &&L_OP_NEQ, &&L_OP_GT, &&L_OP_GTE, &&L_OP_LT, &&L_OP_LTE
+  };
+#endif
+  Vm* vm = &TheInterp->vm;
+  VmFrame* frame;
+  int32_t* ip;
+  Obj* env;
+  Obj** consts;
+  Obj** sp = vm->stack + vm->sp;
+  VM_LOAD_FRAME();
+#if defined(__GNUC__)
+  VM_DISPATCH();
+#else
+dispatch:
+  switch(*ip++) {
+#endif
+  VM_CASE(OP_CONST): {
+    *sp++ = consts[*ip++];
+    VM_DISPATCH();
   }
-  if(peek_char(parser) == '.') {
-    isfloat = 1;
-    *ptr++ = next_char(parser);
-    if(!isdigit(peek_char(parser))) {
-      printf("invalid syntax\n");
-      exit(-1);
+  VM_CASE(OP_LOAD_LOCAL): {
+    Obj* e = env;
+    for(int depth = *ip++; depth > 0; depth--) {
+      e = e->v_env.up;
     }
-    while(isdigit(peek_char(parser))) {
-      *ptr++ = next_char(parser);
+    *sp++ = e->v_env.slots[*ip++];
+    VM_DISPATCH();
+  }
+  VM_CASE(OP_LOAD_FREE): {
+    Obj* ref = consts[*ip++];
+    Obj** var = find_ref(env, ref);
+    if(var == NULL) {
+      VM_SYNC();
+      throw_error(env, "can't find symbol: %s", ref->v_ref.symbol->v_symbol);
     }
+    *sp++ = *var;
+    VM_DISPATCH();
   }
-  *ptr = '\0';
-  if(isfloat) {
-    return new_float(atof(str));
-  } else {
-    return new_int(atoll(str));
+  VM_CASE(OP_LOAD_NAME): {
+    Obj* symbol = consts[*ip++];
+    Obj** var = find_var(env, symbol);
+    if(var == NULL) {
+      VM_SYNC();
+      throw_error(env, "can't find symbol: %s", symbol->v_symbol);
+    }
+    *sp++ = *var;
+    VM_DISPATCH();
   }
-}
-
-Obj* parse_string(Parser* parser) {
-  skip_char(parser, '\"');
-  char str[3096] = { 0 };
-  char *p = str;
-  while(peek_char(parser) != '\"') {
-    char c = next_char(parser);
-    if(c == '\\') {
-      c = next_char(parser);
-      switch(c) {
-      case 'a':
-        c = '\a';
-        break;
-      case 'b':
-        c = '\b';
-        break;
-      case 'f':
-        c = '\f';
-        break;
-      case 'n':
-        c = '\n';
-        break;
-      case 't':
-        c = '\t';
-        break;
-      case 'r':
-        c = '\r';
-        break;
-      case 'v':
-        c = '\v';
-        break;
-      case '\\':
-        c = '\\';
-        break;
-      case '\"':
-        c = '\"';
-        break;
-      default: break;
+  VM_CASE(OP_STORE_LOCAL): {
+    Obj* e = env;
+    for(int depth = *ip++; depth > 0; depth--) {
+      e = e->v_env.up;
+    }
+    e->v_env.slots[*ip++] = *--sp;
+    VM_DISPATCH();
+  }
+  VM_CASE(OP_STORE_FREE):
+  VM_CASE(OP_STORE_NAME): {
+    Obj* target = consts[*ip++];
+    Obj** var = type(target) == T_REF ? find_ref(env, target) : find_var(env, target);
+    Obj* obj = *--sp;
+    name_lambda(target, obj);
+    if(var != NULL) {
+      if(invalidates_code(target, *var)) {
+        TheInterp->macro_epoch++;
       }
+      *var = obj;
+    } else {
+      *sp++ = obj;
+      VM_SYNC();
+      add_var(env, type(target) == T_REF ? target->v_ref.symbol : target, obj);
+      sp--;
     }
-    *p++ = c;
+    VM_DISPATCH();
   }
-  skip_char(parser, '\"');
-  *p = '\0';
-  return new_string(str);
-}
-
-Obj* parse_symbol(Parser* parser) {
-  char symbol[1024] = { 0 };
-  char* ptr = symbol;
-  *ptr++ = next_char(parser);
-  while(1) {
-    int c = peek_char(parser);
-    if(isalpha(c) || strchr("_+-*/=!@#$%^&<>", c) || isdigit(c)) {
-      *ptr++ = next_char(parser);
+  VM_CASE(OP_POP): {
+    sp--;
+    VM_DISPATCH();
+  }
+  VM_CASE(OP_JUMP): {
+    ip = frame->bytecode->ops + *ip;
+    VM_DISPATCH();
+  }
+  VM_CASE(OP_JUMP_IF_NIL): {
+    if(*--sp == NilObj) {
+      ip = frame->bytecode->ops + *ip;
     } else {
-      break;
+      ip++;
     }
+    VM_DISPATCH();
   }
-  *ptr = '\0';
-  return intern(symbol);
-}
-
-Obj* parse_obj(Parser* parser) {
-  while(1) {
-    int c = peek_char(parser);
-    if(isspace(c)) {
-      skip_whitespace(parser);
-      continue;
+  VM_CASE(OP_PUSH_ENV): {
+    VM_SYNC();
+    env = new_env(env, NilObj);
+    VM_DISPATCH();
+  }
+  VM_CASE(OP_POP_ENV): {
+    env = env->v_env.up;
+    VM_DISPATCH();
+  }
+  VM_CASE(OP_CLOSURE): {
+    Obj* proto = consts[*ip++];
+    VM_SYNC();
+    Obj* lambda = new_obj(T_LAMBDA);
+    lambda->v_lambda = proto->v_lambda;
+    lambda->v_lambda.env = env;
+    frames_capture(lambda);
+    *sp++ = lambda;
+    VM_DISPATCH();
+  }
+  VM_CASE(OP_CHECK_EXPANSION): {
+    Obj* node = consts[*ip++];
+    if(node->v_expansion.epoch == TheInterp->macro_epoch) {
+      TheInterp->macro_cache.hits++;
+      ip++;
+    } else {
+      ip = frame->bytecode->ops + *ip;
     }
-    if(c == EOF || c == '\0') {
-      break;
+    VM_DISPATCH();
+  }
+  VM_CASE(OP_CHECK_BUILTIN): {
+    Obj* head = consts[*ip++];
+    Obj* expected = consts[*ip++];
+    Obj** var = type(head) == T_REF ? find_ref(env, head) : find_var(env, head);
+    if(var != NULL && *var == expected) {
+      ip++;
+    } else {
+      ip = frame->bytecode->ops + *ip;
+    }
+    VM_DISPATCH();
+  }
+  VM_CASE(OP_CHECK_CALLABLE): {
+    Obj* fn = sp[-1];
+    if(type(fn) == T_MACRO || (type(fn) == T_BUILTIN && !fn->v_builtin.ep)) {
+      Obj* x = consts[*ip++];
+      VM_SYNC();
+      sp[-1] = vm_call_special(env, fn, x);
+      ip = frame->bytecode->ops + *ip;
+    } else {
+      ip += 2;
     }
-    if(c == ';') {
-      while(peek_char(parser) != '\n') {
-        next_char(parser);
+    VM_DISPATCH();
+  }
+  VM_CASE(OP_EVAL_TREE): {
+    Obj* x = consts[*ip++];
+    VM_SYNC();
+    Obj* res = eval(env, x);
+    *sp++ = res;
+    VM_DISPATCH();
+  }
+  VM_CASE(OP_CALL):
+  VM_CASE(OP_TAIL_CALL): {
+    int is_tail = ip[-1] == OP_TAIL_CALL;
+    int argc = *ip++;
+    Obj* form = consts[*ip++];
+    Obj** argv = sp - argc;
+    Obj* fn = argv[-1];
+    VM_SYNC();
+    if(type(fn) == T_LAMBDA) {
+      STAT(TheInterp->stats.calls[CALL_LAMBDA]++);
+      Obj* res;
+      if(TheInterp->jit_threshold > 0 && jit_call(fn, argc, argv, &res)) {
+        sp = argv - 1;
+        *sp++ = res;
+        if(is_tail) {
+          goto L_OP_RETURN_BODY;
+        }
+        VM_DISPATCH();
       }
-      skip_char(parser, '\n');
-      continue;
+      Bytecode* bc = compile_lambda(fn);
+      Obj* callee_env = bind_frame(env, fn, argc, argv, FRAME_HEAP);
+      if(is_tail) {
+        Obj** base = vm->stack + frame->base;
+        base[0] = fn;
+        sp = base + 1;
+        call_stack_replace(fn, form);
+      } else {
+        call_stack_push(fn, form);
+        if(vm->fp == VM_FRAMES_MAX) {
+          throw_error(env, "stack overflow");
+        }
+        int base = (int)(argv - 1 - vm->stack);
+        frame = &vm->frames[vm->fp++];
+        frame->base = base;
+        sp = argv;
+      }
+      frame->bytecode = bc;
+      frame->ip = bc->ops;
+      frame->env = callee_env;
+      VM_LOAD_FRAME();
+      if(sp - vm->stack >= VM_STACK_SIZE - 1024) {
+        VM_SYNC();
+        throw_error(env, "stack overflow");
+      }
+      VM_DISPATCH();
     }
-    if(c == '(') {
-      return parse_list(parser);
+    if(type(fn) != T_BUILTIN) {
+      throw_error(env, "can't call type: %s(%s)", obj_type_to_str(type(fn)), obj_repr(fn));
     }
-    if(isdigit(c)) {
-      return parse_number(parser);
+    STAT(TheInterp->stats.calls[CALL_BUILTIN]++);
+    check_args(env, fn, argc);
+    call_stack_push(fn, form);
+    Obj* res = fn->v_builtin.ptr(env, argc, argv);
+    TheInterp->calls.depth--;
+    sp = argv - 1;
+    *sp++ = res;
+    if(is_tail) {
+      goto L_OP_RETURN_BODY;
     }
-    if(c == '\"') {
-      return parse_string(parser);
+    VM_DISPATCH();
+  }
+  VM_CASE(OP_RETURN): {
+  L_OP_RETURN_BODY:;
+    Obj* res = *--sp;
+    sp = vm->stack + frame->base;
+    vm->fp--;
+    if(vm->fp == entry_fp) {
+      vm->sp = (int)(sp - vm->stack);
+      return res;
     }
-    if(c == '\'') {
-      return parse_quote(parser);
+    TheInterp->calls.depth--;
+    VM_LOAD_FRAME();
+    *sp++ = res;
+    VM_DISPATCH();
+  }
+#define VM_ARITH(op, f) \
+  VM_CASE(op): { \
+    VM_SYNC(); \
+    Obj* res = arith_##f(env, sp[-2], sp[-1]); \
+    sp -= 2; \
+    *sp++ = res; \
+    VM_DISPATCH(); \
+  }
+#define VM_COMPARE(op, f) \
+  VM_CASE(op): { \
+    int res = compare_##f(env, sp[-2], sp[-1]); \
+    sp -= 2; \
+    *sp++ = TO_BOOL_OBJ(res); \
+    VM_DISPATCH(); \
+  }
+  VM_ARITH(OP_ADD, add)
+  VM_ARITH(OP_SUB, sub)
+  VM_ARITH(OP_MUL, mul)
+  VM_ARITH(OP_DIV, div)
+  VM_COMPARE(OP_EQ, eq)
+  VM_COMPARE(OP_NEQ, neq)
+  VM_COMPARE(OP_GT, gt)
+  VM_COMPARE(OP_GTE, gte)
+  VM_COMPARE(OP_LT, lt)
+  VM_COMPARE(OP_LTE, lte)
+#undef VM_ARITH
+#undef VM_COMPARE
+#if !defined(__GNUC__)
+  default: break;
+  }
+#endif
+  return NilObj;
+}
+
+// pushes an entry frame for bytecode, fn is kept in the base slot as a gc root
+Obj* vm_enter(Obj* fn, Bytecode* bc, Obj* env) {
+  Vm* vm = &TheInterp->vm;
+  if(vm->fp == VM_FRAMES_MAX || vm->sp >= VM_STACK_SIZE - 1024) {
+    throw_error(env, "stack overflow");
+  }
+  int entry_fp = vm->fp;
+  VmFrame* frame = &vm->frames[vm->fp++];
+  frame->bytecode = bc;
+  frame->ip = bc->ops;
+  frame->env = env;
+  frame->base = vm->sp;
+  vm->stack[vm->sp++] = fn;
+  return vm_execute(entry_fp);
+}
+
+Obj* vm_apply(Obj* lambda, int argc, Obj** argv) {
+  Bytecode* bc = compile_lambda(lambda);
+  return vm_enter(lambda, bc, bind_frame(lambda->v_lambda.env, lambda, argc, argv, FRAME_HEAP));
+}
+
+Obj* vm_run_toplevel(Obj* env, Obj* x) {
+  Obj* code = new_code(x);
+  Bytecode* bc = new_bytecode();
+  code->v_code.bytecode = bc;
+  compile(bc, x, 0);
+  emit(bc, OP_RETURN);
+  return vm_enter(code, bc, env);
+}
+
+// a lambda called jit_threshold times is compiled to x86-64 code, see
+// jit_compile. only forms without side effects are compiled, so native code
+// that meets what it doesn't handle (an operand that isn't a fixnum, an
+// overflow, a recursion deeper than JIT_STACK_BUDGET) returns NULL and the
+// interpreter runs the call again from the start.
+#if defined(__x86_64__) && !defined(TOYLISP_NO_JIT)
+
+// the labels every function starts with
+enum { JIT_ENTRY, JIT_BODY, JIT_RETURN, JIT_BAIL };
+
+// x86 condition codes, cc ^ 1 is the opposite condition
+enum { CC_O = 0x0, CC_B = 0x2, CC_E = 0x4, CC_NE = 0x5, CC_L = 0xc, CC_GE = 0xd, CC_LE = 0xe, CC_G = 0xf };
+
+#define JIT_EMIT(j, ...) jit_emit(j, (const unsigned char[]){ __VA_ARGS__ }, sizeof((const unsigned char[]){ __VA_ARGS__ }))
+#define JIT_FIXNUM(v) ((Obj*)(((uintptr_t)(v) << 1) | TAG_FIXNUM))
+
+int jit_expr(JitCompiler* j, Obj* x, int tail);
+
+static void jit_emit(JitCompiler* j, const unsigned char* bytes, size_t n) {
+  strbuf_append(&j->code, (const char*)bytes, n);
+}
+
+static void jit_imm32(JitCompiler* j, int32_t v) {
+  strbuf_append(&j->code, (const char*)&v, sizeof(v));
+}
+
+static void jit_imm64(JitCompiler* j, uint64_t v) {
+  strbuf_append(&j->code, (const char*)&v, sizeof(v));
+}
+
+static int jit_label(JitCompiler* j) {
+  if(j->label_count == j->label_capacity) {
+    j->label_capacity = j->label_capacity ? j->label_capacity * 2 : 16;
+    j->labels = (int*)realloc(j->labels, sizeof(int) * j->label_capacity);
+  }
+  j->labels[j->label_count] = -1;
+  return j->label_count++;
+}
+
+static void jit_bind(JitCompiler* j, int label) {
+  j->labels[label] = (int)j->code.length;
+}
+
+// a rel32 operand jumping to label, filled in by jit_link
+static void jit_rel32(JitCompiler* j, int label) {
+  if(j->patch_count + 2 > j->patch_capacity) {
+    j->patch_capacity = j->patch_capacity ? j->patch_capacity * 2 : 32;
+    j->patches = (int*)realloc(j->patches, sizeof(int) * j->patch_capacity);
+  }
+  j->patches[j->patch_count++] = (int)j->code.length;
+  j->patches[j->patch_count++] = label;
+  jit_imm32(j, 0);
+}
+
+static void jit_jump(JitCompiler* j, int label) {
+  JIT_EMIT(j, 0xe9);
+  jit_rel32(j, label);
+}
+
+static void jit_jcc(JitCompiler* j, int cc, int label) {
+  JIT_EMIT(j, 0x0f, 0x80 | cc);
+  jit_rel32(j, label);
+}
+
+static void jit_link(JitCompiler* j) {
+  for(int i = 0; i < j->patch_count; i += 2) {
+    int at = j->patches[i];
+    int32_t rel = j->labels[j->patches[i + 1]] - (at + 4);
+    memcpy(j->code.data + at, &rel, sizeof(rel));
+  }
+}
+
+// the code only runs while symbol keeps its current value
+static void jit_guard(JitCompiler* j, Obj* symbol) {
+  for(int i = 0; i < j->guard_count; i++) {
+    if(j->guards[i].symbol == symbol) {
+      return;
     }
-    if(isalpha(c) || strchr("_+-*/=!@#$%^&<>", c)) {
-      return parse_symbol(parser);
+  }
+  if(j->guard_count == j->guard_capacity) {
+    j->guard_capacity = j->guard_capacity ? j->guard_capacity * 2 : 8;
+    j->guards = (JitGuard*)realloc(j->guards, sizeof(JitGuard) * j->guard_capacity);
+  }
+  j->guards[j->guard_count].symbol = symbol;
+  j->guards[j->guard_count].value = symbol->v_global;
+  j->guard_count++;
+}
+
+// the value x always evaluates to, NULL if it isn't a constant.
+// NIL and T are taken as constants under a guard.
+static Obj* jit_constant(JitCompiler* j, Obj* x) {
+  switch(type(x)) {
+    case T_NULL:
+    case T_BOOL:
+    case T_INT:
+    case T_FLOAT:
+    case T_STRING:
+      return x;
+    case T_REF: {
+      Obj* symbol = x->v_ref.symbol;
+      if(x->v_ref.slot < 0 && symbol->v_global != NULL && (symbol == TheInterp->nil_symbol || symbol == TheInterp->t_symbol)) {
+        jit_guard(j, symbol);
+        return symbol->v_global;
+      }
+      return NULL;
     }
-    throw_error(GlobalEnv, "ParserError: unprocessed character: %c", c);
+    default: return NULL;
   }
-  return NilObj;
 }
 
-Obj* intern(const char* s) {
-  char* symbol = strdup(s);
-  symbol = strupr(symbol);
-  for(Obj* p = Symbols; p != NilObj; p = cdr(p)) {
-    if(strcmp(car(p)->v_symbol, symbol) == 0) {
-      return car(p);
+static inline int jit_is_param(Obj* x) {
+  return type(x) == T_REF && x->v_ref.slot >= 0 && x->v_ref.depth == 0;
+}
+
+// the builtin, special form or lambda the head of the call x names, under a guard
+static Obj* jit_callee(JitCompiler* j, Obj* x) {
+  if(type(x) != T_CONS) {
+    return NULL;
+  }
+  Obj* head = car(x);
+  Obj* fn = compile_time_binding(head);
+  if(fn != NULL && type(head) != T_BUILTIN) {
+    jit_guard(j, type(head) == T_REF ? head->v_ref.symbol : head);
+  }
+  return fn;
+}
+
+// mov rax, imm64
+static void jit_load_constant(JitCompiler* j, Obj* x) {
+  JIT_EMIT(j, 0x48, 0xb8);
+  jit_imm64(j, (uint64_t)(uintptr_t)x);
+  j->fixnum = is_fixnum(x) != 0;
+}
+
+// evaluates b into rcx keeping rax, fixnum is set if b is known to be one
+static int jit_operand(JitCompiler* j, Obj* b, int* fixnum) {
+  Obj* c = jit_constant(j, b);
+  if(c != NULL) {
+    JIT_EMIT(j, 0x48, 0xb9); // mov rcx, imm64
+    jit_imm64(j, (uint64_t)(uintptr_t)c);
+    *fixnum = is_fixnum(c) != 0;
+    return 1;
+  }
+  if(jit_is_param(b)) {
+    JIT_EMIT(j, 0x48, 0x8b, 0x8b); // mov rcx, [rbx + disp32]
+    jit_imm32(j, 8 * b->v_ref.slot);
+    *fixnum = 0;
+    return 1;
+  }
+  int a_fixnum = j->fixnum;
+  JIT_EMIT(j, 0x50); // push rax
+  if(!jit_expr(j, b, 0)) {
+    return 0;
+  }
+  *fixnum = j->fixnum;
+  JIT_EMIT(j, 0x48, 0x89, 0xc1, 0x58); // mov rcx, rax; pop rax
+  j->fixnum = a_fixnum;
+  return 1;
+}
+
+// bails out unless rax and rcx both hold fixnums
+static void jit_check_fixnums(JitCompiler* j, int b_fixnum) {
+  if(j->fixnum && b_fixnum) {
+    return;
+  }
+  if(j->fixnum) {
+    JIT_EMIT(j, 0xf6, 0xc1, 0x01); // test cl, 1
+  } else if(b_fixnum) {
+    JIT_EMIT(j, 0xa8, 0x01); // test al, 1
+  } else {
+    JIT_EMIT(j, 0x89, 0xc2, 0x21, 0xca, 0xf6, 0xc2, 0x01); // mov edx, eax; and edx, ecx; test dl, 1
+  }
+  jit_jcc(j, CC_E, JIT_BAIL);
+}
+
+// +, - and * fold left like the builtins. on tagged fixnums 2a+1 and 2b+1
+// the sum is 2a+1 + 2b, the difference 2a+1 - 2b and the product a * 2b + 1,
+// so a result that doesn't fit a fixnum overflows and bails out.
+static int jit_arith(JitCompiler* j, Builtin f, Obj* args) {
+  int argc = list_length(args);
+  Obj* identity = JIT_FIXNUM(f == builtin_mul ? 1 : 0);
+  if(argc == 0 && f == builtin_sub) {
+    return 0;
+  }
+  if(argc <= 1) {
+    jit_load_constant(j, identity);
+  } else {
+    if(!jit_expr(j, car(args), 0)) {
+      return 0;
     }
+    args = cdr(args);
   }
-  Obj* obj = new_symbol(symbol);
-  INC_REF(obj);
-  free(symbol);
-  return obj;
+  for(Obj* p = args; p != NilObj; p = cdr(p)) {
+    int b_fixnum;
+    if(!jit_operand(j, car(p), &b_fixnum)) {
+      return 0;
+    }
+    jit_check_fixnums(j, b_fixnum);
+    JIT_EMIT(j, 0x48, 0x83, 0xe9, 0x01); // sub rcx, 1
+    if(f == builtin_add) {
+      JIT_EMIT(j, 0x48, 0x01, 0xc8); // add rax, rcx
+    } else if(f == builtin_sub) {
+      JIT_EMIT(j, 0x48, 0x29, 0xc8); // sub rax, rcx
+    } else {
+      JIT_EMIT(j, 0x48, 0xd1, 0xf8, 0x48, 0x0f, 0xaf, 0xc1); // sar rax, 1; imul rax, rcx
+    }
+    jit_jcc(j, CC_O, JIT_BAIL);
+    if(f == builtin_mul) {
+      JIT_EMIT(j, 0x48, 0x83, 0xc8, 0x01); // or rax, 1
+    }
+    j->fixnum = 1;
+  }
+  return 1;
 }
 
-Obj* print(Obj* x) {
-  char str[1024] = { 0 };
-  printf("%s", obj_to_str(x, str));
-  return NilObj;
+// the condition code a comparison builtin holds on, -1 for anything else
+static int jit_condition(Obj* fn) {
+  if(is_builtin(fn, builtin_eq)) return CC_E;
+  if(is_builtin(fn, builtin_neq)) return CC_NE;
+  if(is_builtin(fn, builtin_lt)) return CC_L;
+  if(is_builtin(fn, builtin_lte)) return CC_LE;
+  if(is_builtin(fn, builtin_gt)) return CC_G;
+  if(is_builtin(fn, builtin_gte)) return CC_GE;
+  return -1;
 }
 
-Obj* progn(Obj* env, Obj* x) {
-  Obj* res = NilObj;
-  Obj* newEnv = new_env(env, NilObj);
-  for(Obj* p = x; p != NilObj; p = cdr(p)) {
-    res = eval(newEnv, car(p));
+// compares the two args and returns the condition code that holds if the
+// comparison does. < and friends take fixnums, == and != compare fixnums
+// and NIL by identity, anything else bails out.
+static int jit_compare(JitCompiler* j, Obj* fn, Obj* args) {
+  int cc = jit_condition(fn);
+  if(list_length(args) != 2) {
+    return -1;
   }
-  return res;
+  Obj* a = car(args);
+  Obj* b = car(cdr(args));
+  int nil = jit_constant(j, a) == NilObj || jit_constant(j, b) == NilObj;
+  int b_fixnum;
+  if(!jit_expr(j, a, 0) || !jit_operand(j, b, &b_fixnum)) {
+    return -1;
+  }
+  if(cc != CC_E && cc != CC_NE) {
+    jit_check_fixnums(j, b_fixnum);
+  } else if(!nil && !(j->fixnum && b_fixnum)) {
+    int same = jit_label(j);
+    JIT_EMIT(j, 0x89, 0xc2, 0x21, 0xca, 0xf6, 0xc2, 0x01); // mov edx, eax; and edx, ecx; test dl, 1
+    jit_jcc(j, CC_NE, same);
+    JIT_EMIT(j, 0x48, 0x83, 0xf8, 0x04); // cmp rax, NIL
+    jit_jcc(j, CC_E, same);
+    JIT_EMIT(j, 0x48, 0x83, 0xf9, 0x04); // cmp rcx, NIL
+    jit_jcc(j, CC_NE, JIT_BAIL);
+    jit_bind(j, same);
+  }
+  JIT_EMIT(j, 0x48, 0x39, 0xc8); // cmp rax, rcx
+  j->fixnum = 0;
+  return cc;
 }
 
-Obj* macroexpand(Obj* env, Obj* macro, Obj* args) {
-  return progn(push_env(env, macro->v_macro.params, args, NilObj), macro->v_macro.body);
+// jumps to label if x evaluates to NIL
+static int jit_test(JitCompiler* j, Obj* x, int label) {
+  Obj* c = jit_constant(j, x);
+  if(c != NULL) {
+    if(c == NilObj) {
+      jit_jump(j, label);
+    }
+    return 1;
+  }
+  if(type(x) == T_CONS && type(car(x)) == T_EXPANSION && car(x)->v_expansion.epoch == TheInterp->macro_epoch) {
+    return jit_test(j, car(x)->v_expansion.expansion, label);
+  }
+  Obj* fn = jit_callee(j, x);
+  if(fn != NULL && jit_condition(fn) >= 0) {
+    int cc = jit_compare(j, fn, cdr(x));
+    if(cc < 0) {
+      return 0;
+    }
+    jit_jcc(j, cc ^ 1, label);
+    return 1;
+  }
+  if(fn != NULL && is_special(fn, builtin_and)) {
+    for(Obj* p = cdr(x); p != NilObj; p = cdr(p)) {
+      if(!jit_test(j, car(p), label)) {
+        return 0;
+      }
+    }
+    return 1;
+  }
+  if(fn != NULL && is_special(fn, builtin_or)) {
+    int pass = jit_label(j);
+    for(Obj* p = cdr(x); p != NilObj; p = cdr(p)) {
+      int next = jit_label(j);
+      if(!jit_test(j, car(p), next)) {
+        return 0;
+      }
+      jit_jump(j, pass);
+      jit_bind(j, next);
+    }
+    jit_jump(j, label);
+    jit_bind(j, pass);
+    return 1;
+  }
+  if(!jit_expr(j, x, 0)) {
+    return 0;
+  }
+  JIT_EMIT(j, 0x48, 0x83, 0xf8, 0x04); // cmp rax, NIL
+  jit_jcc(j, CC_E, label);
+  return 1;
 }
 
-DEFINE_BUILTIN(print) {
-  for(Obj* p = x; p != NilObj; p = cdr(p)) {
-    print(car(p));
-    printf(" ");
+static int jit_seq(JitCompiler* j, Obj* body, int tail) {
+  if(body == NilObj) {
+    jit_load_constant(j, NilObj);
+    return 1;
   }
-  return NilObj;
+  for(Obj* p = body; p != NilObj; p = cdr(p)) {
+    if(!jit_expr(j, car(p), tail && cdr(p) == NilObj)) {
+      return 0;
+    }
+  }
+  return 1;
 }
 
-DEFINE_BUILTIN(println) {
-  builtin_print(env, x);
-  putchar('\n');
-  return NilObj;
+// like builtin_cond a clause gives its first body form
+static int jit_cond(JitCompiler* j, Obj* clauses, int tail) {
+  int end = jit_label(j);
+  for(Obj* p = clauses; p != NilObj; p = cdr(p)) {
+    Obj* clause = car(p);
+    if(type(clause) != T_CONS || type(cdr(clause)) != T_CONS) {
+      return 0;
+    }
+    int next = jit_label(j);
+    if(!jit_test(j, car(clause), next) || !jit_expr(j, car(cdr(clause)), tail)) {
+      return 0;
+    }
+    jit_jump(j, end);
+    jit_bind(j, next);
+  }
+  jit_load_constant(j, NilObj);
+  jit_bind(j, end);
+  j->fixnum = 0;
+  return 1;
 }
 
-DEFINE_BUILTIN(car) {
-  return car(car(x));
+// a call of the lambda being compiled. the arguments are pushed last first so
+// they lie in order at rsp, a tail call copies them over the parameters and
+// jumps back to the body instead.
+static int jit_self_call(JitCompiler* j, Obj* args, int tail) {
+  Obj* argv[JIT_MAX_PARAMS];
+  int argc = 0;
+  for(Obj* p = args; p != NilObj; p = cdr(p)) {
+    if(argc == j->self->v_lambda.paramc) {
+      return 0;
+    }
+    argv[argc++] = car(p);
+  }
+  if(argc != j->self->v_lambda.paramc) {
+    return 0;
+  }
+  for(int i = argc - 1; i >= 0; i--) {
+    if(!jit_expr(j, argv[i], 0)) {
+      return 0;
+    }
+    JIT_EMIT(j, 0x50); // push rax
+  }
+  if(tail) {
+    for(int i = 0; i < argc; i++) {
+      JIT_EMIT(j, 0x58, 0x48, 0x89, 0x83); // pop rax; mov [rbx + disp32], rax
+      jit_imm32(j, 8 * i);
+    }
+    jit_jump(j, JIT_BODY);
+    return 1;
+  }
+  JIT_EMIT(j, 0x48, 0x89, 0xe7, 0x4c, 0x89, 0xe6, 0xe8); // mov rdi, rsp; mov rsi, r12; call
+  jit_rel32(j, JIT_ENTRY);
+  JIT_EMIT(j, 0x48, 0x81, 0xc4); // add rsp, imm32
+  jit_imm32(j, 8 * argc);
+  JIT_EMIT(j, 0x48, 0x85, 0xc0); // test rax, rax
+  jit_jcc(j, CC_E, JIT_BAIL);
+  j->fixnum = 0;
+  return 1;
+}
+
+// compiles x to leave its value in rax, 0 if x isn't covered
+int jit_expr(JitCompiler* j, Obj* x, int tail) {
+  Obj* c = jit_constant(j, x);
+  if(c != NULL) {
+    jit_load_constant(j, c);
+    return 1;
+  }
+  if(type(x) == T_REF) {
+    if(x->v_ref.slot >= 0) {
+      if(x->v_ref.depth != 0) {
+        return 0;
+      }
+      JIT_EMIT(j, 0x48, 0x8b, 0x83); // mov rax, [rbx + disp32]
+      jit_imm32(j, 8 * x->v_ref.slot);
+    } else {
+      // nothing in the subset adds variables to the frame, a free ref is a global
+      JIT_EMIT(j, 0x48, 0xb8); // mov rax, imm64
+      jit_imm64(j, (uint64_t)(uintptr_t)&x->v_ref.symbol->v_global);
+      JIT_EMIT(j, 0x48, 0x8b, 0x00, 0x48, 0x85, 0xc0); // mov rax, [rax]; test rax, rax
+      jit_jcc(j, CC_E, JIT_BAIL);
+    }
+    j->fixnum = 0;
+    return 1;
+  }
+  if(type(x) != T_CONS || list_length(x) < 0) {
+    return 0;
+  }
+  Obj* head = car(x);
+  if(type(head) == T_EXPANSION) {
+    if(head->v_expansion.epoch != TheInterp->macro_epoch) {
+      return 0;
+    }
+    return jit_expr(j, head->v_expansion.expansion, tail);
+  }
+  if(head == TheInterp->seq_builtin) {
+    return jit_seq(j, cdr(x), tail);
+  }
+  Obj* fn = jit_callee(j, x);
+  if(fn == NULL) {
+    return 0;
+  }
+  if(fn == j->self) {
+    return jit_self_call(j, cdr(x), tail);
+  }
+  if(is_special(fn, builtin_cond)) {
+    return jit_cond(j, cdr(x), tail);
+  }
+  if(is_special(fn, builtin_if) && list_length(x) == 4) {
+    int other = jit_label(j), end = jit_label(j);
+    if(!jit_test(j, car(cdr(x)), other) || !jit_expr(j, car(cdr(cdr(x))), tail)) {
+      return 0;
+    }
+    jit_jump(j, end);
+    jit_bind(j, other);
+    if(!jit_expr(j, car(cdr(cdr(cdr(x)))), tail)) {
+      return 0;
+    }
+    jit_bind(j, end);
+    j->fixnum = 0;
+    return 1;
+  }
+  if(is_special(fn, builtin_and) || is_special(fn, builtin_or)) {
+    int fail = jit_label(j), end = jit_label(j);
+    if(!jit_test(j, x, fail)) {
+      return 0;
+    }
+    jit_load_constant(j, TrueObj);
+    jit_jump(j, end);
+    jit_bind(j, fail);
+    jit_load_constant(j, NilObj);
+    jit_bind(j, end);
+    j->fixnum = 0;
+    return 1;
+  }
+  if(is_builtin(fn, builtin_add) || is_builtin(fn, builtin_sub) || is_builtin(fn, builtin_mul)) {
+    return jit_arith(j, fn->v_builtin.ptr, cdr(x));
+  }
+  if(jit_condition(fn) >= 0) {
+    int cc = jit_compare(j, fn, cdr(x));
+    if(cc < 0) {
+      return 0;
+    }
+    JIT_EMIT(j, 0x0f, 0x90 | cc, 0xc2, 0x0f, 0xb6, 0xd2); // setcc dl; movzx edx, dl
+    JIT_EMIT(j, 0x48, 0x8d, 0x04, 0xd5); // lea rax, [rdx * 8 + NIL], T is NIL + 8
+    jit_imm32(j, (int32_t)(uintptr_t)NilObj);
+    return 1;
+  }
+  return 0;
+}
+
+// copies the code to pages of its own and makes them executable
+static JitCode* jit_map(JitCompiler* j) {
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  size_t size = (j->code.length + page - 1) / page * page;
+  void* mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(mem == MAP_FAILED) {
+    return NULL;
+  }
+  memcpy(mem, j->code.data, j->code.length);
+  if(mprotect(mem, size, PROT_READ | PROT_EXEC) != 0) {
+    munmap(mem, size);
+    return NULL;
+  }
+  JitCode* jit = (JitCode*)malloc(sizeof(JitCode));
+  jit->entry = (JitEntry)mem;
+  jit->size = size;
+  jit->paramc = j->self->v_lambda.paramc;
+  jit->epoch = TheInterp->macro_epoch;
+  jit->guards = j->guards;
+  jit->guard_count = j->guard_count;
+  jit->bails = 0;
+  j->guards = NULL;
+  return jit;
 }
 
-DEFINE_BUILTIN(cdr) {
-  return cdr(car(x));
+// compiles fn if its body keeps to constants, parameters, globals, fixnum
+// + - * and comparisons, cond and the macros expanding to it, progn and calls
+// of fn itself. NULL if it doesn't.
+//
+// the code gets the arguments in rdi and the stack limit in rsi and keeps
+// them in rbx and r12. a form leaves its value in rax and pushes what it
+// holds on to meanwhile, rbp marks the frame so a bail out can drop it.
+JitCode* jit_compile(Obj* fn) {
+  if(fn->v_lambda.rest != NilObj || fn->v_lambda.paramc > JIT_MAX_PARAMS || fn->v_lambda.env != TheInterp->global_env) {
+    return NULL;
+  }
+  JitCompiler j;
+  memset(&j, 0, sizeof(j));
+  j.self = fn;
+  for(int i = JIT_ENTRY; i <= JIT_BAIL; i++) {
+    jit_label(&j);
+  }
+  jit_bind(&j, JIT_ENTRY);
+  JIT_EMIT(&j, 0x55, 0x48, 0x89, 0xe5, 0x53, 0x41, 0x54); // push rbp; mov rbp, rsp; push rbx; push r12
+  JIT_EMIT(&j, 0x48, 0x89, 0xfb, 0x49, 0x89, 0xf4); // mov rbx, rdi; mov r12, rsi
+  JIT_EMIT(&j, 0x4c, 0x39, 0xe4); // cmp rsp, r12
+  jit_jcc(&j, CC_B, JIT_BAIL);
+  jit_bind(&j, JIT_BODY);
+  int ok = jit_seq(&j, fn->v_lambda.code->v_code.body, 1);
+  jit_bind(&j, JIT_RETURN);
+  JIT_EMIT(&j, 0x48, 0x8d, 0x65, 0xf0, 0x41, 0x5c, 0x5b, 0x5d, 0xc3); // lea rsp, [rbp - 16]; pop r12; pop rbx; pop rbp; ret
+  jit_bind(&j, JIT_BAIL);
+  JIT_EMIT(&j, 0x31, 0xc0); // xor eax, eax
+  jit_jump(&j, JIT_RETURN);
+  JitCode* jit = NULL;
+  if(ok) {
+    jit_link(&j);
+    jit = jit_map(&j);
+  }
+  free(j.code.data);
+  free(j.labels);
+  free(j.patches);
+  free(j.guards);
+  if(jit != NULL) {
+    STAT(TheInterp->stats.jit_compiled++);
+  }
+  return jit;
 }
 
-DEFINE_BUILTIN(cons) {
-  return cons(param1, param2);
+void jit_free(JitCode* jit) {
+  munmap((void*)jit->entry, jit->size);
+  free(jit->guards);
+  free(jit);
 }
 
-DEFINE_BUILTIN(progn) {
-  return progn(env, x);
+// drops the code of a lambda, it is compiled again after calls more calls
+static void jit_discard(Obj* code, int calls) {
+  jit_free(code->v_code.jit);
+  code->v_code.jit = NULL;
+  code->v_code.jit_calls = calls;
 }
 
-DEFINE_BUILTIN(set) {
-  throw_error_assert(type(param1) == T_SYMBOL, env, "can't set to type(%s)", obj_type_to_str(type(param1)));
-  throw_error_assert(cdr(x) != NilObj, env, "can't set to too few arguments");
-  Obj* var = find_var(env, param1);
-  Obj* obj = eval(env, param2);
-  INC_REF(obj);
-  if(var != NilObj) {
-    DEC_REF(cdr(var));
-    cdr(var) = obj;
-  } else {
-    add_var(env, param1, obj);
+static int jit_valid(JitCode* jit) {
+  if(jit->epoch != TheInterp->macro_epoch) {
+    return 0;
   }
-  if(cdr(cdr(x)) != NilObj) {
-    builtin_set(env, cdr(cdr(x)));
+  for(int i = 0; i < jit->guard_count; i++) {
+    if(jit->guards[i].symbol->v_global != jit->guards[i].value) {
+      return 0;
+    }
   }
-  return NilObj;
+  return 1;
 }
 
-DEFINE_BUILTIN(lambda) {
-  char name[64] = { 0 };
-  Obj* params = param1;
-  Obj* lambda = new_obj(T_LAMBDA);
-  lambda->v_lambda.rest = NilObj;
-  for(Obj* p = params; p != NilObj; p = cdr(p)) {
-    if(car(p) != intern("&rest")) {
-      continue;
+// counts a call of the lambda fn, compiling it on the jit_threshold-th, and
+// runs it natively if it is compiled. returns 0 if the interpreter has to make
+// the call, nothing has been evaluated then.
+int jit_call(Obj* fn, int argc, Obj** argv, Obj** res) {
+  Interp* interp = TheInterp;
+  Obj* code = fn->v_lambda.code;
+  JitCode* jit = code->v_code.jit;
+  if(jit == NULL) {
+    if(code->v_code.jit_calls == JIT_NEVER || ++code->v_code.jit_calls < interp->jit_threshold) {
+      return 0;
     }
-    if(cdr(p) == NilObj) {
-      throw_error(env, "invalid syntax: next param of &rest is null");
+    jit = code->v_code.jit = jit_compile(fn);
+    if(jit == NULL) {
+      code->v_code.jit_calls = JIT_NEVER;
+      return 0;
     }
-    if(cdr(cdr(p)) != NilObj) {
-      throw_error(env, "invalid syntax: next param of &rest is not last param");
+  }
+  if(!jit_valid(jit)) {
+    jit_discard(code, 0);
+    return 0;
+  }
+  if(argc != jit->paramc || fn->v_lambda.env != interp->global_env) {
+    return 0;
+  }
+  // the native code writes tail call arguments over its own
+  Obj* args[JIT_MAX_PARAMS];
+  memcpy(args, argv, sizeof(Obj*) * argc);
+  char* limit = (char*)__builtin_frame_address(0) - JIT_STACK_BUDGET;
+  Obj* value = jit->entry(args, limit);
+  if(value == NULL) {
+    STAT(interp->stats.jit_bails++);
+    if(++jit->bails == JIT_MAX_BAILS) {
+      jit_discard(code, JIT_NEVER);
     }
-    car(p) = car(cdr(p));
-    cdr(p) = NilObj;
-    lambda->v_lambda.rest = car(p);
-    break;
+    return 0;
   }
-  sprintf(name, "<%p>", lambda);
-  lambda->v_lambda.name = intern(name);
-  lambda->v_lambda.paramc = list_length(params);
-  lambda->v_lambda.params = params;
-  lambda->v_lambda.body = cdr(x);
-  lambda->v_lambda.env = env;
-  return lambda;
-}
-
-DEFINE_BUILTIN(defmacro) {
-  Obj* macro = new_obj(T_MACRO);
-  macro->v_macro.name = param1;
-  macro->v_macro.params = param2;
-  macro->v_macro.paramc = list_length(param2);
-  macro->v_macro.body = cdr(cdr(x));
-  add_var(env, param1, macro);
-  return macro;
+  STAT(interp->stats.jit_calls++);
+  *res = value;
+  return 1;
 }
 
-DEFINE_BUILTIN(macroexpand) {
-  return macroexpand(env, cdr(find_var(env, car(car(x)))), cdr(car(x)));
-}
+#else
 
-DEFINE_BUILTIN(quote) {
-  return car(x);
+int jit_call(Obj* fn, int argc, Obj** argv, Obj** res) {
+  return 0;
 }
 
-DEFINE_BUILTIN(typeof) {
-  return intern(obj_type_to_str(type(param1)));
-}
-
-#define binary_op(f, op) \
-DEFINE_BUILTIN(f) {    \
-  Obj* a = param1; \
-  Obj* b = param2; \
-  if(strcmp(#op, "+") == 0 && (type(a) == T_STRING && type(b) == T_STRING)) return new_string(strcat(a->v_str, b->v_str)); \
-  if(type(a) == T_INT) {  \
-    if(type(b) == T_INT) return new_int(a->v_int op b->v_int);    \
-    else if(type(b) == T_FLOAT) return new_int((double)(a->v_int) op b->v_float);   \
-  } else if(type(a) == T_FLOAT) { \
-    if(type(b) == T_INT) return new_float(a->v_float op (double)(b->v_int));   \
-    else if(type(b) == T_FLOAT) return new_float(a->v_float op b->v_float);  \
-  } \
-  throw_error(env, "TypeError: unsupported operand type(s) for %s: '%s' and '%s'", #op, obj_type_to_str(type(a)), obj_type_to_str(type(b))); \
-  return NilObj; \
+void jit_free(JitCode* jit) {
 }
 
-binary_op(add, +);
-binary_op(sub, -);
-binary_op(mul, *);
-binary_op(div, /);
+#endif
 
-#define binary_logic_op(f, op) \
-DEFINE_BUILTIN(f) { \
-  Obj* a = param1; \
-  Obj* b = param2; \
-  if((a == b) && (strcmp(#op , "==") == 0)) return TrueObj; \
-  if((a == NilObj || b == NilObj) && (strcmp(#op , "==") == 0 || strcmp(#op , "!=") == 0)) return TO_BOOL_OBJ(a op b); \
-  if(type(a) == T_INT) { \
-    if(type(b) == T_INT) return TO_BOOL_OBJ(a->v_int op b->v_int); \
-    if(type(b) == T_FLOAT) return TO_BOOL_OBJ(a->v_int op (int64_t)(b->v_float)); \
-  } \
-  if(type(a) == T_FLOAT) { \
-    if(type(b) == T_FLOAT) return TO_BOOL_OBJ(a->v_float op b->v_float); \
-    if(type(b) == T_INT) return TO_BOOL_OBJ(a->v_float op (double)(b->v_int)); \
-  } \
-  if(type(a) == T_STRING && type(b) == T_STRING && strcmp(#op , "==") == 0) return TO_BOOL_OBJ(strcmp(a->v_str, b->v_str) == 0); \
-  if(type(a) == T_STRING && type(b) == T_STRING && strcmp(#op , "!=") == 0) return TO_BOOL_OBJ(strcmp(a->v_str, b->v_str) != 0); \
-  if(type(a) == T_SYMBOL && type(b) == T_SYMBOL && (strcmp(#op , "==") == 0 || strcmp(#op , "!=") == 0)) return TO_BOOL_OBJ(a op b); \
-  throw_error(env, "TypeError: unsupported operand type(s) for %s: '%s' and '%s'", #op, obj_type_to_str(type(a)), obj_type_to_str(type(b))); \
-  return NilObj; \
-} \
+// forms are read and evaluated one at a time, a form is garbage as soon
+// as it has run unless something still refers to it.
+// returns -1 if a form raised an error, the forms after it are skipped.
+int run_forms(Obj* env, Parser* parser, Obj** res) {
+  Interp* interp = TheInterp;
+  int vm_sp = interp->vm.sp, vm_fp = interp->vm.fp, depth = interp->calls.depth, frames = interp->frames.top;
+  jmp_buf* outer = interp->handler;
+  jmp_buf handler;
+  interp->handler = &handler;
+  *res = NilObj;
+  if(setjmp(handler) != 0) {
+    // catch exception...
+    interp->vm.sp = vm_sp;
+    interp->vm.fp = vm_fp;
+    interp->calls.depth = depth;
+    frames_pop(frames);
+    interp->handler = outer;
+    *res = NilObj;
+    return -1;
+  }
+  while(!parser_at_end(parser)) {
+    Obj* x = parse_obj(parser);
+    if(interp->optimize && env == interp->global_env) {
+      x = optimize_toplevel(x);
+    }
+    *res = interp->engine == ENGINE_VM ? vm_run_toplevel(env, x) : eval(env, x);
+  }
+  interp->handler = outer;
+  return 0;
+}
 
-binary_logic_op(eq, ==);
-binary_logic_op(neq, !=);
-binary_logic_op(gt, >);
-binary_logic_op(gte, >=);
-binary_logic_op(lt, <);
-binary_logic_op(lte, <=);
+Obj* run(Obj* env, Parser* parser) {
+  Obj* res;
+  run_forms(env, parser, &res);
+  return res;
+}
 
-DEFINE_BUILTIN(cond) {
-  for(Obj* p = x; p != NilObj; p = cdr(p)) {
-    Obj* item = car(p);
-    Obj* cond = eval(env, car(item));
-    if(cond != NilObj) {
-      return eval(env, car(cdr(item)));
-    }
+// status, if not NULL, gets run_forms's result
+Obj* run_file(Obj* env, const char* filename, int* status) {
+  Parser parser;
+  if(!parser_open(&parser, filename)) {
+    printf("can't open file: %s\n", filename);
+    exit(-1);
   }
-  return NilObj;
+  Obj* res;
+  int rc = run_forms(env, &parser, &res);
+  parser_close(&parser);
+  if(status != NULL) {
+    *status = rc;
+  }
+  return res;
 }
 
-DEFINE_BUILTIN(while) {
-  while(eval(env, car(x)) != NilObj) {
-    eval(env, car(cdr(x)));
+Obj* run_string(Obj* env, const char* source, size_t length) {
+  Parser parser;
+  parser_init(&parser, "<STDIN>", source, length);
+  return run(env, &parser);
+}
+
+// an object found while dumping, numbered in the order found. builtins and
+// the global environment are referred to by IMAGE_EXT instead
+int image_add(ImageWriter* w, Obj* x) {
+  Interp* interp = TheInterp;
+  if(x == NULL || !is_heap_obj(x) || type(x) == T_BUILTIN || x == interp->global_env) return 1;
+  if(type(x) == T_FUTURE) return 0;
+  int added;
+  size_t slot = ptr_table_put(&w->objs, x, &added);
+  if(added) {
+    w->objs.values[slot] = (uint32_t)(w->objs.count - 1);
   }
-  return NilObj;
+  return 1;
 }
 
-DEFINE_BUILTIN(eval) {
-  if(type(param1) == T_STRING) {
-    return run(env, parse_source(param1->v_str));
+// bytes owned by an object, 8 byte aligned, as their offset in the image
+Obj* image_bytes(ImageWriter* w, const void* data, size_t len) {
+  uint64_t offset = w->bytes_offset + w->bytes.length;
+  strbuf_append(&w->bytes, (const char*)data, len);
+  while(w->bytes.length % 8 != 0) {
+    strbuf_push(&w->bytes, 0);
   }
-  return eval(env, param1);
+  return (Obj*)(uintptr_t)offset;
 }
 
-void add_var(Obj* env, Obj* symbol, Obj* obj) {
-  env->v_env.vars = acons(symbol, obj, env->v_env.vars);
+Obj* image_ref(ImageWriter* w, Obj* x) {
+  Interp* interp = TheInterp;
+  if(x == NULL || !is_heap_obj(x)) return x;
+  if(x == interp->global_env) return (Obj*)IMAGE_EXT;
+  if(x == interp->closure_builtin) return (Obj*)(IMAGE_EXT | 8);
+  if(x == interp->seq_builtin) return (Obj*)(IMAGE_EXT | 16);
+  if(type(x) == T_BUILTIN) return (Obj*)(IMAGE_EXT_BUILTIN | (uintptr_t)image_ref(w, x->v_builtin.name));
+  int added;
+  size_t slot = ptr_table_put(&w->objs, x, &added);
+  return (Obj*)(uintptr_t)(sizeof(ImageHeader) + sizeof(Obj) * w->objs.values[slot]);
 }
 
-Obj* find_var(Obj* env, Obj* symbol) {
-  Obj* vars = env->v_env.vars;
-  if(vars != NilObj) {
-    for(Obj* var = car(vars); vars != NilObj; vars = cdr(vars), var = car(vars)) {
-      if(car(var) == symbol || strcmp(car(var)->v_symbol, symbol->v_symbol) == 0) {
-        return var;
+// the objects x refers to, 0 if one of them can't be dumped
+int image_add_children(ImageWriter* w, Obj* x) {
+  switch(type(x)) {
+    case T_STRING: string_chars(x); return 1;
+    case T_SYMBOL: return image_add(w, x->v_global);
+    case T_CONS: return image_add(w, car(x)) && image_add(w, cdr(x));
+    case T_LAMBDA: {
+      return image_add(w, x->v_lambda.name) && image_add(w, x->v_lambda.params) && image_add(w, x->v_lambda.body) &&
+        image_add(w, x->v_lambda.env) && image_add(w, x->v_lambda.rest) && image_add(w, x->v_lambda.code);
+    }
+    case T_MACRO: return image_add(w, x->v_macro.name) && image_add(w, x->v_macro.params) && image_add(w, x->v_macro.body);
+    case T_ENV: {
+      int ok = image_add(w, x->v_env.up) && image_add(w, x->v_env.vars) && image_add(w, x->v_env.names);
+      for(int i = 0; ok && i < x->v_env.count; i++) {
+        ok = image_add(w, x->v_env.slots[i]);
+      }
+      return ok;
+    }
+    case T_REF: return image_add(w, x->v_ref.symbol);
+    case T_EXPANSION: {
+      return image_add(w, x->v_expansion.head) && image_add(w, x->v_expansion.macro) && image_add(w, x->v_expansion.expansion);
+    }
+    case T_CODE: return image_add(w, x->v_code.body);
+    case T_VECTOR: {
+      int ok = 1;
+      for(size_t i = 0; ok && i < x->v_vector.length; i++) {
+        ok = image_add(w, x->v_vector.items[i]);
+      }
+      return ok;
+    }
+    case T_HASHTABLE: {
+      size_t pos = 0;
+      int ok = 1;
+      for(HashEntry* e; ok && (e = hash_next(x, &pos)) != NULL;) {
+        ok = image_add(w, e->key) && image_add(w, e->value);
       }
+      return ok;
     }
+    default: return 1;
   }
-  if(env->v_env.up != NilObj) {
-    return find_var(env->v_env.up, symbol);
+}
+
+// the cell of x with its pointers turned into image references. a hash
+// table keeps only its live entries as key value pairs, rehashed on load
+// since keys without a value hash are hashed by address
+Obj image_cell(ImageWriter* w, Obj* x, size_t index) {
+  Obj cell = *x;
+  cell.marked = 0;
+  switch(type(x)) {
+    case T_STRING: {
+      cell.v_string.chars = (char*)image_bytes(w, x->v_string.chars, x->v_string.length + 1);
+      cell.v_string.left = cell.v_string.right = NULL;
+      break;
+    }
+    case T_SYMBOL: {
+      cell.v_symbol = (char*)image_bytes(w, x->v_symbol, strlen(x->v_symbol) + 1);
+      cell.v_global = image_ref(w, x->v_global);
+      break;
+    }
+    case T_CONS: {
+      cell.v_cons.head = image_ref(w, car(x));
+      cell.v_cons.tail = image_ref(w, cdr(x));
+      break;
+    }
+    case T_LAMBDA: {
+      cell.v_lambda.name = image_ref(w, x->v_lambda.name);
+      cell.v_lambda.params = image_ref(w, x->v_lambda.params);
+      cell.v_lambda.body = image_ref(w, x->v_lambda.body);
+      cell.v_lambda.env = image_ref(w, x->v_lambda.env);
+      cell.v_lambda.rest = image_ref(w, x->v_lambda.rest);
+      cell.v_lambda.code = image_ref(w, x->v_lambda.code);
+      break;
+    }
+    case T_MACRO: {
+      cell.v_macro.name = image_ref(w, x->v_macro.name);
+      cell.v_macro.params = image_ref(w, x->v_macro.params);
+      cell.v_macro.body = image_ref(w, x->v_macro.body);
+      break;
+    }
+    case T_ENV: {
+      cell.v_env.up = image_ref(w, x->v_env.up);
+      cell.v_env.vars = image_ref(w, x->v_env.vars);
+      cell.v_env.names = image_ref(w, x->v_env.names);
+      Obj** slots = x->v_env.slots == x->v_env.inline_slots ? cell.v_env.inline_slots : (Obj**)malloc(sizeof(Obj*) * (x->v_env.count + 1));
+      memset(cell.v_env.inline_slots, 0, sizeof(cell.v_env.inline_slots));
+      for(int i = 0; i < x->v_env.count; i++) {
+        slots[i] = image_ref(w, x->v_env.slots[i]);
+      }
+      if(x->v_env.slots == x->v_env.inline_slots) {
+        cell.v_env.slots = (Obj**)(uintptr_t)(sizeof(ImageHeader) + sizeof(Obj) * index + offsetof(Obj, v_env.inline_slots));
+      } else {
+        cell.v_env.slots = x->v_env.slots != NULL ? (Obj**)image_bytes(w, slots, sizeof(Obj*) * x->v_env.count) : NULL;
+        free(slots);
+      }
+      break;
+    }
+    case T_REF: cell.v_ref.symbol = image_ref(w, x->v_ref.symbol); break;
+    case T_EXPANSION: {
+      cell.v_expansion.head = image_ref(w, x->v_expansion.head);
+      cell.v_expansion.macro = image_ref(w, x->v_expansion.macro);
+      cell.v_expansion.expansion = image_ref(w, x->v_expansion.expansion);
+      break;
+    }
+    case T_CODE: {
+      cell.v_code.body = image_ref(w, x->v_code.body);
+      cell.v_code.bytecode = NULL;
+      cell.v_code.jit = NULL;
+      cell.v_code.jit_calls = 0;
+      break;
+    }
+    case T_VECTOR: {
+      Obj** items = (Obj**)malloc(sizeof(Obj*) * (x->v_vector.length + 1));
+      for(size_t i = 0; i < x->v_vector.length; i++) {
+        items[i] = image_ref(w, x->v_vector.items[i]);
+      }
+      cell.v_vector.items = (Obj**)image_bytes(w, items, sizeof(Obj*) * x->v_vector.length);
+      free(items);
+      break;
+    }
+    case T_F64VECTOR:
+    case T_I64VECTOR: {
+      cell.v_vector.f64 = (double*)image_bytes(w, x->v_vector.f64, sizeof(double) * x->v_vector.length);
+      break;
+    }
+    case T_HASHTABLE: {
+      Obj** pairs = (Obj**)malloc(sizeof(Obj*) * 2 * (x->v_hash.count + 1));
+      size_t pos = 0, n = 0;
+      for(HashEntry* e; (e = hash_next(x, &pos)) != NULL; n++) {
+        pairs[2 * n] = image_ref(w, e->key);
+        pairs[2 * n + 1] = image_ref(w, e->value);
+      }
+      cell.v_hash.entries = (HashEntry*)image_bytes(w, pairs, sizeof(Obj*) * 2 * n);
+      cell.v_hash.old_entries = NULL;
+      cell.v_hash.capacity = cell.v_hash.old_capacity = cell.v_hash.old_index = 0;
+      cell.v_hash.count = n;
+      cell.v_hash.used = 0;
+      free(pairs);
+      break;
+    }
+    default: break;
   }
-  return NilObj;
+  return cell;
 }
 
-void init_global_vars() {
-  NilObj = new_obj(T_NULL);
-  TrueObj = new_obj(T_BOOL);
-  GlobalEnv = new_env(NilObj, NilObj);
-  Symbols = NilObj;
-  add_var(GlobalEnv, intern("NIL"), NilObj);
-  add_var(GlobalEnv, intern("T"), TrueObj);
-  INC_REF(NilObj);
-  INC_REF(TrueObj);
+// writes every symbol and everything reachable from them, which takes in
+// the globals, to filename. -1 if it can't be written or a future is reachable
+int image_dump(const char* filename) {
+  Interp* interp = TheInterp;
+  ImageWriter w;
+  memset(&w, 0, sizeof(w));
+  int ok = 1;
+  for(uint32_t i = 0; i < interp->symbols.capacity; i++) {
+    image_add(&w, interp->symbols.slots[i]);
+  }
+  for(size_t i = 0; ok && i < w.objs.count; i++) {
+    ok = image_add_children(&w, w.objs.order[i]);
+  }
+  FILE* fp = ok ? fopen(filename, "wb") : NULL;
+  if(fp == NULL) {
+    ptr_table_free(&w.objs);
+    return -1;
+  }
+  ImageHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, IMAGE_MAGIC, sizeof(header.magic));
+  header.obj_size = sizeof(Obj);
+  header.cells = sizeof(ImageHeader);
+  header.count = w.objs.count;
+  header.macro_epoch = interp->macro_epoch;
+  w.bytes_offset = header.cells + sizeof(Obj) * header.count;
+  Obj* cells = (Obj*)malloc(sizeof(Obj) * (header.count + 1));
+  for(size_t i = 0; i < header.count; i++) {
+    cells[i] = image_cell(&w, w.objs.order[i], i);
+  }
+  header.size = w.bytes_offset + w.bytes.length;
+  ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+    fwrite(cells, sizeof(Obj), header.count, fp) == header.count &&
+    fwrite(w.bytes.data, 1, w.bytes.length, fp) == w.bytes.length;
+  ok = fclose(fp) == 0 && ok;
+  free(cells);
+  free(w.bytes.data);
+  ptr_table_free(&w.objs);
+  return ok ? 0 : -1;
 }
 
-void add_builtin(Obj* env, const char* name, Builtin builtin, int paramc, int ep) {
-  Obj* obj = new_obj(T_BUILTIN);
-  obj->v_builtin.name = intern(name);
-  obj->v_builtin.paramc = paramc;
-  obj->v_builtin.ptr = builtin;
-  obj->v_builtin.ep = ep;
-  INC_REF(obj);
-  add_var(env, obj->v_builtin.name, obj);
+// the count units of bytes at offset in the image as a pointer into the mapping,
+// NULL if they don't all lie in it
+static inline void* image_span(char* base, ImageHeader* header, uint64_t offset, uint64_t count, uint64_t unit) {
+  if(offset < sizeof(ImageHeader) || offset > header->size || count > (header->size - offset) / unit) return NULL;
+  return base + offset;
 }
 
-void init_builtins(Obj* env) {
-  add_builtin(GlobalEnv, "print", builtin_print, -1, 1);
-  add_builtin(GlobalEnv, "println", builtin_println, -1, 1);
-  add_builtin(GlobalEnv, "car", builtin_car, 1, 1);
-  add_builtin(GlobalEnv, "cdr", builtin_cdr, 1, 1);
-  add_builtin(GlobalEnv, "cons", builtin_cons, 2, 1);
-  add_builtin(GlobalEnv, "progn", builtin_progn, -1, 0);
-  add_builtin(GlobalEnv, "set", builtin_set, -1, 0);
-  add_builtin(GlobalEnv, "lambda", builtin_lambda, 2, 0);
-  add_builtin(GlobalEnv, "defmacro", builtin_defmacro, 3, 0);
-  add_builtin(GlobalEnv, "macroexpand", builtin_macroexpand, 1, 1);
-  add_builtin(GlobalEnv, "quote", builtin_quote, 1, 0);
-  add_builtin(GlobalEnv, "typeof", builtin_typeof, 1, 1);
-  add_builtin(GlobalEnv, "+", builtin_add, 2, 1);
-  add_builtin(GlobalEnv, "-", builtin_sub, 2, 1);
-  add_builtin(GlobalEnv, "*", builtin_mul, 2, 1);
-  add_builtin(GlobalEnv, "/", builtin_div, 2, 1);
-  add_builtin(GlobalEnv, "==", builtin_eq, 2, 1);
-  add_builtin(GlobalEnv, "!=", builtin_neq, 2, 1);
-  add_builtin(GlobalEnv, ">", builtin_gt, 2, 1);
-  add_builtin(GlobalEnv, ">=", builtin_gte, 2, 1);
-  add_builtin(GlobalEnv, "<", builtin_lt, 2, 1);
-  add_builtin(GlobalEnv, "<=", builtin_lte, 2, 1);
-  add_builtin(GlobalEnv, "cond", builtin_cond, -1, 0);
-  add_builtin(GlobalEnv, "while", builtin_while, 2, 0);
-  add_builtin(GlobalEnv, "eval", builtin_eval, 1, 1);
-}
-
-Obj* call(Obj* env, Obj* callable, Obj* args) {
-  int paramc = -1;
-  int argc = list_length(args);
-  Obj* name = NilObj;
-  int is_rest = 0;
-  if(type(callable) == T_BUILTIN) {
-    paramc = callable->v_builtin.paramc;
-    name = callable->v_builtin.name;
+// an image reference to a pointer into the mapping, see image_ref. NULL if it
+// isn't one: a reference that misses the cells, or a builtin this interpreter lacks.
+// forward holds the interpreter's own symbol for the image symbols it already had
+static inline Obj* image_reloc(char* base, ImageHeader* header, Obj** forward, Obj* x) {
+  uintptr_t word = (uintptr_t)x;
+  if(word == 0 || (word & TAG_MASK)) return x;
+  Interp* interp = TheInterp;
+  if(word & IMAGE_EXT_BUILTIN) {
+    // builtin names are interned by every interpreter, so the symbol is one of its own
+    Obj* symbol = image_reloc(base, header, forward, (Obj*)(word & ~IMAGE_EXT_BUILTIN));
+    if(symbol == NULL || ((char*)symbol >= base && (char*)symbol < base + header->size) || type(symbol) != T_SYMBOL) return NULL;
+    return symbol->v_global != NULL && type(symbol->v_global) == T_BUILTIN ? symbol->v_global : NULL;
   }
-  if(type(callable) == T_LAMBDA) {
-    paramc = callable->v_lambda.paramc;
-    name = callable->v_lambda.name;
-    is_rest = callable->v_lambda.rest != NilObj;
+  if(word & IMAGE_EXT) {
+    word &= ~IMAGE_EXT;
+    return word == 0 ? interp->global_env : word == 8 ? interp->closure_builtin : word == 16 ? interp->seq_builtin : NULL;
   }
-  if(type(callable) == T_MACRO) {
-    paramc = callable->v_macro.paramc;
-    name = callable->v_macro.name;
+  if(word < header->cells || (word - header->cells) % sizeof(Obj) != 0) return NULL;
+  size_t index = (word - header->cells) / sizeof(Obj);
+  if(index >= header->count) return NULL;
+  return forward[index] != NULL ? forward[index] : (Obj*)(base + word);
+}
+
+#define RELOC(field) do { Obj* ref = field; field = image_reloc(base, header, forward, ref); ok = ok && (field != NULL || ref == NULL); } while(0)
+#define SPAN(field, count, unit) do { field = image_span(base, header, (uintptr_t)field, count, unit); ok = ok && field != NULL; } while(0)
+
+// maps an image written by image_dump into the current interpreter.
+// its symbols join the symbol table, those already interned (the builtins)
+// take the image's global, the other objects are used in place.
+// -1 for an image that is truncated or whose offsets lead outside of it
+int image_load(const char* filename) {
+  Interp* interp = TheInterp;
+  if(interp->image != NULL) return -1;
+  int fd = open(filename, O_RDONLY);
+  if(fd < 0) return -1;
+  struct stat st;
+  char* base = fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(ImageHeader) ?
+    (char*)mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0) : (char*)MAP_FAILED;
+  close(fd);
+  if(base == (char*)MAP_FAILED) return -1;
+  ImageHeader* header = (ImageHeader*)base;
+  if(memcmp(header->magic, IMAGE_MAGIC, sizeof(header->magic)) != 0 || header->obj_size != sizeof(Obj) ||
+    header->size != (uint64_t)st.st_size || header->cells < sizeof(ImageHeader) || header->cells % 8 != 0 ||
+    header->cells > header->size || header->count > (header->size - header->cells) / sizeof(Obj)) {
+    munmap(base, st.st_size);
+    return -1;
   }
-  if(is_rest) {
-    throw_error_assert(argc >= paramc - 1, env, 
-    "%s() the number of arguments is less than %d", 
-    name->v_symbol, paramc - 1);
-  } else {
-    throw_error_assert(paramc == -1 || argc == paramc, env, 
-    "%s() takes %d positional arguments but %d were given", 
-    name->v_symbol, paramc, argc);
+  Obj* cells = (Obj*)(base + header->cells);
+  Obj** forward = (Obj**)calloc(header->count + 1, sizeof(Obj*));
+  int ok = 1;
+  for(size_t i = 0; ok && i < header->count; i++) {
+    Obj* x = &cells[i];
+    // cells holding native pointers of the interpreter that wrote them are never dumped
+    if((unsigned)x->type >= T_FUTURE || x->type == T_BUILTIN) {
+      ok = 0;
+    }
+    if(x->type != T_SYMBOL) continue;
+    SPAN(x->v_symbol, 1, 1);
+    if(!ok || memchr(x->v_symbol, 0, base + header->size - x->v_symbol) == NULL) {
+      ok = 0;
+      break;
+    }
+    size_t len = strlen(x->v_symbol);
+    forward[i] = interp->symbols.slots[symbol_slot(&interp->symbols, x->v_symbol, len, x->v_symbol_hash)];
   }
-  if(type(callable) == T_MACRO) {
-    return eval(env, macroexpand(env, callable, args));
+  for(size_t i = 0; ok && i < header->count; i++) {
+    Obj* x = &cells[i];
+    switch(x->type) {
+      case T_STRING: {
+        ok = x->v_string.length < header->size;
+        SPAN(x->v_string.chars, x->v_string.length + 1, 1);
+        ok = ok && x->v_string.chars[x->v_string.length] == '\0';
+        x->v_string.left = x->v_string.right = NULL;
+        break;
+      }
+      case T_SYMBOL: RELOC(x->v_global); break;
+      case T_CONS: RELOC(car(x)); RELOC(cdr(x)); break;
+      case T_LAMBDA: {
+        RELOC(x->v_lambda.name);
+        RELOC(x->v_lambda.params);
+        RELOC(x->v_lambda.body);
+        RELOC(x->v_lambda.env);
+        RELOC(x->v_lambda.rest);
+        RELOC(x->v_lambda.code);
+        break;
+      }
+      case T_MACRO: RELOC(x->v_macro.name); RELOC(x->v_macro.params); RELOC(x->v_macro.body); break;
+      case T_ENV: {
+        RELOC(x->v_env.up);
+        RELOC(x->v_env.vars);
+        RELOC(x->v_env.names);
+        ok = ok && x->v_env.count >= 0 && (x->v_env.slots != NULL || x->v_env.count == 0);
+        if(ok && x->v_env.slots != NULL) {
+          SPAN(x->v_env.slots, (uint64_t)x->v_env.count, sizeof(Obj*));
+        }
+        for(int j = 0; ok && j < x->v_env.count; j++) {
+          RELOC(x->v_env.slots[j]);
+        }
+        break;
+      }
+      case T_REF: RELOC(x->v_ref.symbol); break;
+      case T_EXPANSION: RELOC(x->v_expansion.head); RELOC(x->v_expansion.macro); RELOC(x->v_expansion.expansion); break;
+      case T_CODE: {
+        RELOC(x->v_code.body);
+        x->v_code.bytecode = NULL;
+        x->v_code.jit = NULL;
+        break;
+      }
+      case T_VECTOR: {
+        SPAN(x->v_vector.items, x->v_vector.length, sizeof(Obj*));
+        for(size_t j = 0; ok && j < x->v_vector.length; j++) {
+          RELOC(x->v_vector.items[j]);
+        }
+        break;
+      }
+      case T_F64VECTOR:
+      case T_I64VECTOR: SPAN(x->v_vector.f64, x->v_vector.length, sizeof(double)); break;
+      case T_HASHTABLE: {
+        Obj** pairs = (Obj**)x->v_hash.entries;
+        SPAN(pairs, x->v_hash.count, 2 * sizeof(Obj*));
+        for(size_t j = 0; ok && j < 2 * x->v_hash.count; j++) {
+          RELOC(pairs[j]);
+        }
+        x->v_hash.entries = (HashEntry*)pairs;
+        x->v_hash.old_entries = NULL;
+        break;
+      }
+      default: break;
+    }
   }
-  if(type(callable) == T_LAMBDA || (type(callable) == T_BUILTIN && callable->v_builtin.ep)) {
-    args = eval_list(env, args);
+  // a builtin the image refers to is missing from this interpreter, or the image is damaged
+  if(!ok) {
+    free(forward);
+    munmap(base, st.st_size);
+    return -1;
   }
-  if(type(callable) == T_BUILTIN) {
-    return callable->v_builtin.ptr(env, args);
+  for(size_t i = 0; i < header->count; i++) {
+    Obj* x = &cells[i];
+    if(x->type == T_SYMBOL && forward[i] != NULL) {
+      if(x->v_global != NULL) {
+        forward[i]->v_global = x->v_global;
+      }
+      x->type = T_FREE;
+    } else if(x->type == T_SYMBOL) {
+      add_symbol(&interp->symbols, symbol_slot(&interp->symbols, x->v_symbol, strlen(x->v_symbol), x->v_symbol_hash), x);
+    } else if(x->type == T_HASHTABLE) {
+      Obj** pairs = (Obj**)x->v_hash.entries;
+      x->v_hash.capacity = hash_capacity_for(x->v_hash.count);
+      x->v_hash.entries = (HashEntry*)calloc(x->v_hash.capacity, sizeof(HashEntry));
+      for(size_t j = 0; j < x->v_hash.count; j++) {
+        hash_insert_new(x, pairs[2 * j], pairs[2 * j + 1], hash_key(pairs[2 * j]));
+      }
+    }
   }
-  if(type(callable) == T_LAMBDA) {
-    Obj* newEnv = push_env(callable->v_lambda.env, callable->v_lambda.params, args, callable->v_lambda.rest);
-    return builtin_progn(newEnv, callable->v_lambda.body);
+  free(forward);
+  interp->image = base;
+  interp->image_size = st.st_size;
+  interp->image_cells = cells;
+  interp->image_count = header->count;
+  if(header->macro_epoch > interp->macro_epoch) {
+    interp->macro_epoch = header->macro_epoch;
   }
-  char objStr[1024] = { 0 };
-  throw_error(env, "can't call type: %s(%s)", obj_type_to_str(type(callable)), obj_to_str(callable, objStr));
-  return NilObj;
+  return 0;
 }
 
-Obj* eval_list(Obj* env, Obj* x) {
-  Obj *head, *tail;
-  head = tail = NULL;
-  for(Obj *p = x; p != NilObj; p = cdr(p)) {
-    Obj *tmp = eval(env, car(p));
-    if(head == NULL) {
-      head = tail = cons(tmp, NilObj);
-    } else {
-      tail->v_cons.tail = cons(tmp, NilObj);
-      tail = tail->v_cons.tail;
+#undef RELOC
+#undef SPAN
+
+// what the image objects acquired since loading, their cells go with the mapping
+void image_release() {
+  Interp* interp = TheInterp;
+  for(size_t i = 0; i < interp->image_count; i++) {
+    Obj* x = &interp->image_cells[i];
+    if(x->type == T_CODE || x->type == T_HASHTABLE) {
+      finalize_obj(x);
     }
   }
-  return head == NULL ? NilObj : head;
+  if(interp->image != NULL) {
+    munmap(interp->image, interp->image_size);
+  }
 }
 
-Obj* eval(Obj* env, Obj* x) {
-  switch(type(x)) {
-    case T_NULL:
-    case T_BOOL:
-    case T_INT:
-    case T_FLOAT:
-    case T_STRING:
-      return x;
-    case T_SYMBOL: {
-      Obj* obj = find_var(env, x);
-      if(obj == NilObj) {
-        throw_error(env, "can't find symbol: %s", x->v_symbol);
-      }
-      return cdr(obj);
-    }
-    case T_CONS: {
-      return call(env, eval(env, car(x)), cdr(x));
-    }
-    default: break;
+static pthread_once_t ProcessInit = PTHREAD_ONCE_INIT;
+
+// EVAL_STACK_MARGIN above the end of the current thread's stack
+static char* stack_limit() {
+  pthread_attr_t attr;
+  void* addr;
+  size_t size;
+  if(pthread_getattr_np(pthread_self(), &attr) != 0) {
+    return NULL;
   }
-  return x;
+  int ok = pthread_attr_getstack(&attr, &addr, &size) == 0 && size > 2 * EVAL_STACK_MARGIN;
+  pthread_attr_destroy(&attr);
+  return ok ? (char*)addr + EVAL_STACK_MARGIN : NULL;
 }
 
-Obj* run(Obj* env, Obj* x) {
-  Obj* res = NilObj;
-  int code = setjmp(g_buf);
-  if(code == 0) {
-    for(Obj* p = x; p != NilObj; p = cdr(p)) {
-      res = eval(env, car(p));
-    }
-    return res;
-  } else {
-    // catch exception...
+// makes interp the current thread's interpreter. the outermost entry marks
+// where the collector's stack scan ends, nested entries keep it.
+static Interp* interp_enter(Interp* interp, char* frame) {
+  Interp* prev = TheInterp;
+  TheInterp = interp;
+  if(interp->entered++ == 0) {
+    interp->heap.stack_bottom = frame;
+    interp->stack_limit = stack_limit();
   }
-  return NilObj;
+  return prev;
 }
 
-void init_int_cache() {
-  for(int i = INT_CACHE_MIN; i <= INT_CACHE_MAX; i++) {
-    IntCache[INT_CACHE_NORMAL_INDEX(i)] = __new_int((int64_t)i);
-    REF_COUNT(IntCache[INT_CACHE_NORMAL_INDEX(i)]) = 1;
-  }
+static void interp_leave(Interp* interp, Interp* prev) {
+  interp->entered--;
+  TheInterp = prev;
 }
 
-void init() {
+Interp* interp_new() {
+  pthread_once(&ProcessInit, vector_init);
+  Interp* interp = (Interp*)calloc(1, sizeof(Interp));
+  if(interp == NULL) {
+    return NULL;
+  }
+  Interp* prev = interp_enter(interp, (char*)__builtin_frame_address(0));
+  gc_init((char*)__builtin_frame_address(0));
+  interp->engine = ENGINE_TREE;
+  interp->optimize = 1;
+  vm_init();
   init_global_vars();
-  init_builtins(GlobalEnv);
-  init_int_cache();
+  init_builtins(interp->global_env);
+  interp_leave(interp, prev);
+  return interp;
+}
+
+int interp_eval_string(Interp* interp, const char* source, const char** result) {
+  Interp* prev = interp_enter(interp, (char*)__builtin_frame_address(0));
+  Parser parser;
+  parser_init(&parser, "<STRING>", source, strlen(source));
+  Obj* res;
+  int status = run_forms(interp->global_env, &parser, &res);
+  if(status == 0 && result != NULL) {
+    *result = obj_repr(res);
+  }
+  interp_leave(interp, prev);
+  return status;
+}
+
+int interp_load_file(Interp* interp, const char* filename) {
+  Interp* prev = interp_enter(interp, (char*)__builtin_frame_address(0));
+  Parser parser;
+  int status = -1;
+  if(parser_open(&parser, filename)) {
+    Obj* res;
+    status = run_forms(interp->global_env, &parser, &res);
+    parser_close(&parser);
+  }
+  interp_leave(interp, prev);
+  return status;
+}
+
+int interp_dump_image(Interp* interp, const char* filename) {
+  Interp* prev = interp_enter(interp, (char*)__builtin_frame_address(0));
+  int status = image_dump(filename);
+  interp_leave(interp, prev);
+  return status;
+}
+
+int interp_load_image(Interp* interp, const char* filename) {
+  Interp* prev = interp_enter(interp, (char*)__builtin_frame_address(0));
+  int status = image_load(filename);
+  interp_leave(interp, prev);
+  return status;
+}
+
+void interp_free(Interp* interp) {
+  Interp* prev = interp_enter(interp, (char*)__builtin_frame_address(0));
+  profile_stop();
+  profile_reset();
+  pool_release(&interp->pool);
+  image_release();
+  free(interp->prof.samples);
+  free(interp->symbols.slots);
+  free(interp->vm.stack);
+  free(interp->vm.frames);
+  free(interp->frames.cells);
+  free(interp->frames.slots);
+  free(interp->frames.owners);
+  free(interp->heap.mark_stack);
+  free(interp->repr.data);
+  interp_leave(interp, prev);
+  free(interp);
 }
 
 void repl() {
@@ -892,22 +7864,114 @@ void repl() {
   for(;;) {
     ptr = input;
     printf(">>> ");
+    fflush(stdout);
     while((ch = getchar()) != EOF && ch != '\n') {
       *ptr++ = ch;
     }
     *ptr = '\0';
-    print(run(GlobalEnv, parse_source(input)));
+    print(run_string(TheInterp->global_env, input, ptr - input));
     printf("\r\n");
   }
 }
 
+#ifndef TOYLISP_NO_MAIN
 int main(int argc, char const *argv[]) {
-  init();
-  run(GlobalEnv, parse_file("./lib.lisp"));
-  if(argc > 1) {
-    print(run(GlobalEnv, parse_file(argv[1])));
-  } else {
+  const char* filename = NULL;
+  const char* profile = NULL;
+  const char* dump_image = NULL;
+  int macro_stats = 0;
+  int gc_stats = 0;
+  int runtime_stats = 0;
+  int status = 0;
+  Interp* interp = interp_new();
+  interp_enter(interp, (char*)__builtin_frame_address(0));
+  if(!isatty(STDOUT_FILENO)) {
+    setvbuf(stdout, NULL, _IOFBF, PRINT_BLOCK_SIZE);
+  }
+  for(int i = 1; i < argc; i++) {
+    if(strncmp(argv[i], "--gc-growth=", 12) == 0) {
+      TheInterp->heap.growth = atof(argv[i] + 12);
+      if(TheInterp->heap.growth <= 1.0) {
+        printf("invalid gc growth factor: %s\n", argv[i] + 12);
+        exit(-1);
+      }
+    } else if(strcmp(argv[i], "--macro-stats") == 0) {
+      macro_stats = 1;
+    } else if(strcmp(argv[i], "--gc-stats") == 0) {
+      gc_stats = 1;
+    } else if(strcmp(argv[i], "--stats") == 0) {
+      runtime_stats = 1;
+    } else if(strcmp(argv[i], "--engine=tree") == 0) {
+      TheInterp->engine = ENGINE_TREE;
+    } else if(strcmp(argv[i], "--engine=vm") == 0) {
+      TheInterp->engine = ENGINE_VM;
+    } else if(strcmp(argv[i], "--jit=off") == 0) {
+      TheInterp->jit_threshold = 0;
+    } else if(strcmp(argv[i], "--jit=on") == 0) {
+      TheInterp->jit_threshold = JIT_DEFAULT_THRESHOLD;
+    } else if(strncmp(argv[i], "--jit=threshold=", 16) == 0) {
+      TheInterp->jit_threshold = atoi(argv[i] + 16);
+      if(TheInterp->jit_threshold <= 0) {
+        printf("invalid jit threshold: %s\n", argv[i] + 16);
+        exit(-1);
+      }
+    } else if(strcmp(argv[i], "--no-opt") == 0) {
+      TheInterp->optimize = 0;
+    } else if(strncmp(argv[i], "--workers=", 10) == 0) {
+      WorkerCount = atoi(argv[i] + 10);
+      if(WorkerCount <= 0) {
+        printf("invalid worker count: %s\n", argv[i] + 10);
+        exit(-1);
+      }
+    } else if(strncmp(argv[i], "--image=", 8) == 0) {
+      ImageFile = argv[i] + 8;
+    } else if(strncmp(argv[i], "--dump-image=", 13) == 0) {
+      dump_image = argv[i] + 13;
+    } else if(strncmp(argv[i], "--profile=", 10) == 0) {
+      profile = argv[i] + 10;
+    } else {
+      filename = argv[i];
+    }
+  }
+  if(ImageFile == NULL) {
+    run_file(TheInterp->global_env, "./lib.lisp", NULL);
+  } else if(image_load(ImageFile) != 0) {
+    printf("can't load image: %s\n", ImageFile);
+    exit(-1);
+  }
+  // count the program, not the prelude
+  memset(&TheInterp->stats, 0, sizeof(TheInterp->stats));
+  if(profile != NULL) {
+    profile_start();
+  }
+  if(filename != NULL) {
+    print(run_file(TheInterp->global_env, filename, &status));
+  } else if(dump_image == NULL) {
     repl();
   }
-  return 0;
+  if(dump_image != NULL && image_dump(dump_image) != 0) {
+    printf("can't write image: %s\n", dump_image);
+    exit(-1);
+  }
+  if(profile != NULL) {
+    profile_stop();
+    if(!profile_write(profile)) {
+      fprintf(stderr, "can't write profile: %s\n", profile);
+    }
+    print_profile_summary(stderr);
+  }
+  if(macro_stats) {
+    print_macro_cache_stats();
+  }
+  if(gc_stats) {
+    print_gc_stats();
+  }
+  if(runtime_stats) {
+    print_runtime_stats(stderr);
+  }
+  sched_stop();
+  interp_free(interp);
+  // a program that raised an error fails, scripts can tell a broken run
+  return status == 0 ? 0 : 1;
 }
+#endif
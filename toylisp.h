@@ -0,0 +1,38 @@
+#ifndef TOYLISP_H
+#define TOYLISP_H
+
+// embedding api. build main.c with -DTOYLISP_NO_MAIN and link it into the program.
+//
+// each interpreter has its own heap, symbols and globals, objects never cross
+// between them. an interpreter may be used from any thread but by one thread
+// at a time, different interpreters run in parallel on different threads.
+
+typedef struct Interp Interp;
+
+// a fresh interpreter with the builtins defined but lib.lisp not loaded,
+// NULL if out of memory
+Interp* interp_new();
+
+// evaluates every form of source in turn. on success returns 0 and, if result
+// isn't NULL, points it at the printed value of the last form, valid until the
+// next call on this interpreter. returns -1 once a form raises an error,
+// which has been printed, the forms after it are skipped.
+int interp_eval_string(Interp* interp, const char* source, const char** result);
+
+// evaluates the forms of a file like interp_eval_string,
+// -1 if it can't be opened or a form raises an error
+int interp_load_file(Interp* interp, const char* filename);
+
+// writes the symbols, globals, lambdas and macros of the interpreter to a
+// heap image file, -1 if it can't be written or holds a future
+int interp_dump_image(Interp* interp, const char* filename);
+
+// maps a heap image written by interp_dump_image into a fresh interpreter,
+// in place of loading lib.lisp. -1 if it can't be read, was written by a
+// different build, or the interpreter already has an image
+int interp_load_image(Interp* interp, const char* filename);
+
+// frees the interpreter and every object in it
+void interp_free(Interp* interp);
+
+#endif